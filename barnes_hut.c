@@ -0,0 +1,302 @@
+#include "barnes_hut.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#define BH_MAX_DEPTH 48
+#define BH_STACK_SIZE (7 * BH_MAX_DEPTH + 8)
+
+static const int DEFAULT_LEAF_SIZE = 8;
+
+int init_bh_tree(double theta, struct bh_tree *out) {
+    struct bh_tree tree = {
+            theta, DEFAULT_LEAF_SIZE,
+            NULL, 0, 0,
+            NULL, NULL, 0
+    };
+    *out = tree;
+
+    return 1;
+}
+
+void destroy_bh_tree(struct bh_tree *tree) {
+    free(tree->nodes);
+    free(tree->order);
+    free(tree->scratch);
+
+    tree->nodes = NULL;
+    tree->order = NULL;
+    tree->scratch = NULL;
+    tree->n_nodes = 0;
+    tree->node_cap = 0;
+    tree->order_cap = 0;
+}
+
+static int alloc_nodes(struct bh_tree *tree, int count) {
+    if (tree->n_nodes + count > tree->node_cap) {
+        int cap = tree->node_cap ? tree->node_cap : 64;
+        while (cap < tree->n_nodes + count) {
+            cap *= 2;
+        }
+
+        struct bh_node *nodes = realloc(tree->nodes, cap * sizeof(*nodes));
+        if (!nodes) {
+            return -1;
+        }
+
+        tree->nodes = nodes;
+        tree->node_cap = cap;
+    }
+
+    int first = tree->n_nodes;
+    tree->n_nodes += count;
+    return first;
+}
+
+static int octant(const struct bh_node *node, double x, double y, double z) {
+    return (x >= node->cx) | ((y >= node->cy) << 1) | ((z >= node->cz) << 2);
+}
+
+static void summarize_leaf(struct bh_tree *tree, const struct body_soa *soa, int node_idx) {
+    struct bh_node *node = tree->nodes + node_idx;
+
+    double mass = 0.0;
+    double mx = 0.0;
+    double my = 0.0;
+    double mz = 0.0;
+    for (int k = node->begin; k < node->end; ++k) {
+        int i = tree->order[k];
+        mass += soa->mass[i];
+        mx += soa->mass[i] * soa->x[i];
+        my += soa->mass[i] * soa->y[i];
+        mz += soa->mass[i] * soa->z[i];
+    }
+
+    node->mass = mass;
+    if (mass > 0.0) {
+        node->mx = mx / mass;
+        node->my = my / mass;
+        node->mz = mz / mass;
+    } else {
+        node->mx = node->cx;
+        node->my = node->cy;
+        node->mz = node->cz;
+    }
+}
+
+static int build_node(struct bh_tree *tree, const struct body_soa *soa, int node_idx, int depth) {
+    struct bh_node *node = tree->nodes + node_idx;
+    int begin = node->begin;
+    int end = node->end;
+    if (end - begin <= tree->leaf_size || depth >= BH_MAX_DEPTH) {
+        summarize_leaf(tree, soa, node_idx);
+        return 1;
+    }
+
+    // Counting sort of the node's bodies into octants
+    int counts[8] = {0};
+    for (int k = begin; k < end; ++k) {
+        int i = tree->order[k];
+        counts[octant(node, soa->x[i], soa->y[i], soa->z[i])]++;
+    }
+
+    int offsets[8];
+    for (int o = 0, offset = begin; o < 8; ++o) {
+        offsets[o] = offset;
+        offset += counts[o];
+    }
+
+    for (int k = begin; k < end; ++k) {
+        int i = tree->order[k];
+        tree->scratch[offsets[octant(node, soa->x[i], soa->y[i], soa->z[i])]++] = i;
+    }
+    for (int k = begin; k < end; ++k) {
+        tree->order[k] = tree->scratch[k];
+    }
+
+    int child = alloc_nodes(tree, 8);
+    if (child < 0) {
+        return 0;
+    }
+
+    // alloc_nodes may have moved the pool
+    node = tree->nodes + node_idx;
+    node->child = child;
+
+    double half = node->half / 2.0;
+    for (int o = 0, offset = begin; o < 8; ++o) {
+        struct bh_node *c = tree->nodes + child + o;
+        c->cx = node->cx + ((o & 1) ? half : -half);
+        c->cy = node->cy + ((o & 2) ? half : -half);
+        c->cz = node->cz + ((o & 4) ? half : -half);
+        c->half = half;
+        c->child = -1;
+        c->begin = offset;
+        c->end = offset + counts[o];
+        offset += counts[o];
+    }
+
+    double mass = 0.0;
+    double mx = 0.0;
+    double my = 0.0;
+    double mz = 0.0;
+    for (int o = 0; o < 8; ++o) {
+        if (!build_node(tree, soa, child + o, depth + 1)) {
+            return 0;
+        }
+
+        struct bh_node *c = tree->nodes + child + o;
+        mass += c->mass;
+        mx += c->mass * c->mx;
+        my += c->mass * c->my;
+        mz += c->mass * c->mz;
+    }
+
+    node = tree->nodes + node_idx;
+    node->mass = mass;
+    if (mass > 0.0) {
+        node->mx = mx / mass;
+        node->my = my / mass;
+        node->mz = mz / mass;
+    } else {
+        node->mx = node->cx;
+        node->my = node->cy;
+        node->mz = node->cz;
+    }
+
+    return 1;
+}
+
+int build_bh_tree(struct bh_tree *tree, const struct body_soa *soa) {
+    int n = soa->n_massive;
+    if (n > tree->order_cap) {
+        int *order = realloc(tree->order, n * sizeof(*order));
+        if (!order) {
+            return 0;
+        }
+        tree->order = order;
+
+        int *scratch = realloc(tree->scratch, n * sizeof(*scratch));
+        if (!scratch) {
+            return 0;
+        }
+        tree->scratch = scratch;
+
+        tree->order_cap = n;
+    }
+
+    double min_x = INFINITY, min_y = INFINITY, min_z = INFINITY;
+    double max_x = -INFINITY, max_y = -INFINITY, max_z = -INFINITY;
+    for (int i = 0; i < n; ++i) {
+        tree->order[i] = i;
+
+        min_x = fmin(min_x, soa->x[i]);
+        min_y = fmin(min_y, soa->y[i]);
+        min_z = fmin(min_z, soa->z[i]);
+        max_x = fmax(max_x, soa->x[i]);
+        max_y = fmax(max_y, soa->y[i]);
+        max_z = fmax(max_z, soa->z[i]);
+    }
+
+    tree->n_nodes = 0;
+    int root_idx = alloc_nodes(tree, 1);
+    if (root_idx < 0) {
+        return 0;
+    }
+
+    struct bh_node *root = tree->nodes + root_idx;
+    if (n == 0) {
+        struct bh_node empty = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, -1, 0, 0};
+        *root = empty;
+        return 1;
+    }
+
+    double extent = fmax(max_x - min_x, fmax(max_y - min_y, max_z - min_z));
+    root->cx = (min_x + max_x) / 2.0;
+    root->cy = (min_y + max_y) / 2.0;
+    root->cz = (min_z + max_z) / 2.0;
+    // Pad slightly so that bodies on the upper faces fall inside
+    root->half = extent / 2.0 * (1.0 + 1e-9) + 1e-9;
+    root->child = -1;
+    root->begin = 0;
+    root->end = n;
+
+    return build_node(tree, soa, root_idx, 0);
+}
+
+static int inside(const struct bh_node *node, double x, double y, double z) {
+    return fabs(x - node->cx) <= node->half &&
+           fabs(y - node->cy) <= node->half &&
+           fabs(z - node->cz) <= node->half;
+}
+
+void compute_gravity_bh(const struct bh_tree *tree, struct body_soa *soa, int begin, int end) {
+    const struct bh_node *nodes = tree->nodes;
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    double theta2 = tree->theta * tree->theta;
+
+    int stack[BH_STACK_SIZE];
+    for (int i = begin; i < end; ++i) {
+        double xi = x[i];
+        double yi = y[i];
+        double zi = z[i];
+
+        double ax = 0.0;
+        double ay = 0.0;
+        double az = 0.0;
+
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const struct bh_node *node = nodes + stack[--top];
+            if (node->mass == 0.0) {
+                continue;
+            }
+
+            if (node->child < 0) {
+                for (int k = node->begin; k < node->end; ++k) {
+                    int j = tree->order[k];
+                    double dx = x[j] - xi;
+                    double dy = y[j] - yi;
+                    double dz = z[j] - zi;
+                    double r2 = dx * dx + dy * dy + dz * dz;
+                    if (r2 == 0.0) {
+                        continue;
+                    }
+
+                    double inv_r = 1.0 / sqrt(r2);
+                    double s = mass[j] * inv_r * inv_r * inv_r;
+                    ax += s * dx;
+                    ay += s * dy;
+                    az += s * dz;
+                }
+                continue;
+            }
+
+            double dx = node->mx - xi;
+            double dy = node->my - yi;
+            double dz = node->mz - zi;
+            double r2 = dx * dx + dy * dy + dz * dz;
+            double size = 2.0 * node->half;
+            if (size * size < theta2 * r2 && !inside(node, xi, yi, zi)) {
+                double inv_r = 1.0 / sqrt(r2);
+                double s = node->mass * inv_r * inv_r * inv_r;
+                ax += s * dx;
+                ay += s * dy;
+                az += s * dz;
+                continue;
+            }
+
+            for (int o = 7; o >= 0; --o) {
+                stack[top++] = node->child + o;
+            }
+        }
+
+        soa->ax[i] = G * ax;
+        soa->ay[i] = G * ay;
+        soa->az[i] = G * az;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef ORBITAL_BARNES_HUT_H
+#define ORBITAL_BARNES_HUT_H
+
+#include "gravity.h"
+
+struct bh_node {
+    double cx;
+    double cy;
+    double cz;
+    double half;
+
+    double mass;
+    double mx;
+    double my;
+    double mz;
+
+    // Index of the first of 8 contiguous children, or -1 for a leaf
+    int child;
+    int begin;
+    int end;
+};
+
+/*
+ * Octree over a body_soa. Nodes and the body ordering are
+ * kept in pools that are reset, not freed, on every build so
+ * that rebuilding each step does not allocate once warm.
+ */
+struct bh_tree {
+    double theta;
+    int leaf_size;
+
+    struct bh_node *nodes;
+    int n_nodes;
+    int node_cap;
+
+    int *order;
+    int *scratch;
+    int order_cap;
+};
+
+int init_bh_tree(double theta, struct bh_tree *out);
+
+void destroy_bh_tree(struct bh_tree *tree);
+
+int build_bh_tree(struct bh_tree *tree, const struct body_soa *soa);
+
+void compute_gravity_bh(const struct bh_tree *tree, struct body_soa *soa, int begin, int end);
+
+#endif // ORBITAL_BARNES_HUT_H
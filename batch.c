@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include "system.h"
+#include "ensemble.h"
+#include "integrator.h"
+#include "scenario.h"
+#include "scenario_file.h"
+#include "snapshot.h"
+#include "trajectory.h"
+#include "simulation.h"
+#include "input_log.h"
+
+static const double NS_PER_SEC = 1000000000.0;
+static const double TWO_PI = 6.283185307179586;
+
+struct batch_opts {
+    const char *scenario;
+    int n_bodies;
+    long n_steps;
+    double dt;
+    const struct integrator *integrator;
+    int n_threads;
+    double theta;
+    const char *out_path;
+    const char *resume_path;
+    const char *checkpoint_path;
+    long checkpoint_every;
+    const char *trajectory_path;
+    enum trajectory_format trajectory_format;
+    int decimation;
+    int n_members;
+    double force_sigma;
+    double start_sigma;
+    const char *replay_path;
+};
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s leo|debris|constellation|file] [-n bodies] [-N steps] [-d dt] [-i integrator]\n"
+                    "          [-t threads] [-b theta] [-o final_state.csv]\n"
+                    "          [-r resume.snap] [-c checkpoint.snap] [-C checkpoint_every_steps]\n"
+                    "          [-T trajectory] [-F bin|csv] [-k every_kth_step]\n"
+                    "          [-E members] [-D force_sigma] [-J start_sigma_sec] [-R input.log]\n", prog);
+}
+
+static int parse_args(int argc, char **argv, struct batch_opts *opts) {
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:N:d:i:t:b:o:r:c:C:T:F:k:E:D:J:R:")) != -1) {
+        switch (opt) {
+            case 's':
+                opts->scenario = optarg;
+                break;
+            case 'n':
+                opts->n_bodies = atoi(optarg);
+                break;
+            case 'N':
+                opts->n_steps = atol(optarg);
+                break;
+            case 'd':
+                opts->dt = atof(optarg);
+                break;
+            case 'i':
+                opts->integrator = find_integrator(optarg);
+                if (!opts->integrator) {
+                    fprintf(stderr, "Unknown integrator '%s'\n", optarg);
+                    return 0;
+                }
+                break;
+            case 't':
+                opts->n_threads = atoi(optarg);
+                break;
+            case 'b':
+                opts->theta = atof(optarg);
+                break;
+            case 'o':
+                opts->out_path = optarg;
+                break;
+            case 'r':
+                opts->resume_path = optarg;
+                break;
+            case 'c':
+                opts->checkpoint_path = optarg;
+                break;
+            case 'C':
+                opts->checkpoint_every = atol(optarg);
+                break;
+            case 'T':
+                opts->trajectory_path = optarg;
+                break;
+            case 'F':
+                if (strcmp(optarg, "bin") == 0) {
+                    opts->trajectory_format = TRAJECTORY_BINARY;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    opts->trajectory_format = TRAJECTORY_CSV;
+                } else {
+                    fprintf(stderr, "Unknown trajectory format '%s'\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'k':
+                opts->decimation = atoi(optarg);
+                break;
+            case 'E':
+                opts->n_members = atoi(optarg);
+                break;
+            case 'D':
+                opts->force_sigma = atof(optarg);
+                break;
+            case 'J':
+                opts->start_sigma = atof(optarg);
+                break;
+            case 'R':
+                opts->replay_path = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 0;
+        }
+    }
+
+    if (opts->n_steps < 0 || opts->n_threads < 1 || opts->dt <= 0.0 || opts->checkpoint_every < 1 ||
+        opts->decimation < 1 || opts->n_members < 0 || opts->force_sigma < 0.0 || opts->start_sigma < 0.0) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    return 1;
+}
+
+static int write_state(const char *path, int n_bodies, const struct body *bodies) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", path);
+        return 0;
+    }
+
+    fprintf(file, "index,mass,x,y,z,vx,vy,vz\n");
+    for (int i = 0; i < n_bodies; ++i) {
+        const struct body *body = bodies + i;
+        fprintf(file, "%d,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n", i, body->mass,
+                body->pos.x, body->pos.y, body->pos.z, body->vel.x, body->vel.y, body->vel.z);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write '%s'\n", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+static double elapsed_sec(const struct timespec *begin, const struct timespec *end) {
+    return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / NS_PER_SEC;
+}
+
+static int write_ensemble_state(const char *path, const struct ensemble *ens) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", path);
+        return 0;
+    }
+
+    fprintf(file, "member,index,mass,x,y,z,vx,vy,vz\n");
+    for (int k = 0; k < ens->n_members; ++k) {
+        for (int b = 0; b < ens->n_bodies; ++b) {
+            size_t i = (size_t) b * ens->stride + k;
+            fprintf(file, "%d,%d,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n", k, b, ens->mass[i],
+                    ens->x[i], ens->y[i], ens->z[i], ens->vx[i], ens->vy[i], ens->vz[i]);
+        }
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write '%s'\n", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+// splitmix64, so every run draws the same dispersions
+static double next_uniform(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return ((z >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static double next_gaussian(unsigned long long *state) {
+    double u = next_uniform(state);
+    double v = next_uniform(state);
+    return sqrt(-2.0 * log(u)) * cos(TWO_PI * v);
+}
+
+/*
+ * Each burn gets an error of force_sigma times its magnitude,
+ * drawn independently per component, and starts start_sigma
+ * seconds early or late on average.
+ */
+static int disperse_burns(const struct burn_schedule *nominal, double force_sigma, double start_sigma,
+                          unsigned long long *seed, struct burn_schedule *out) {
+    for (int q = 0; q < nominal->n_burns; ++q) {
+        struct burn burn = nominal->burns[q];
+        const struct vector *f = &burn.force;
+        double mag = sqrt(f->x * f->x + f->y * f->y + f->z * f->z);
+
+        burn.force.x += force_sigma * mag * next_gaussian(seed);
+        burn.force.y += force_sigma * mag * next_gaussian(seed);
+        burn.force.z += force_sigma * mag * next_gaussian(seed);
+        burn.start += start_sigma * next_gaussian(seed);
+        if (!add_burn(out, &burn)) {
+            return 0;
+        }
+    }
+
+    sort_burns(out);
+    return 1;
+}
+
+// RMS and largest distance of each burning body from its position averaged over the ensemble
+static void print_dispersion(const struct ensemble *ens, const struct burn_schedule *nominal) {
+    for (int b = 0; b < ens->n_bodies; ++b) {
+        int burns = 0;
+        for (int q = 0; q < nominal->n_burns; ++q) {
+            burns |= nominal->burns[q].body == b;
+        }
+        if (!burns) {
+            continue;
+        }
+
+        const double *x = ens->x + (size_t) b * ens->stride;
+        const double *y = ens->y + (size_t) b * ens->stride;
+        const double *z = ens->z + (size_t) b * ens->stride;
+        double mean[3] = {0.0, 0.0, 0.0};
+        for (int k = 0; k < ens->n_members; ++k) {
+            mean[0] += x[k] / ens->n_members;
+            mean[1] += y[k] / ens->n_members;
+            mean[2] += z[k] / ens->n_members;
+        }
+
+        double sum_sq = 0.0;
+        double max = 0.0;
+        for (int k = 0; k < ens->n_members; ++k) {
+            double dx = x[k] - mean[0];
+            double dy = y[k] - mean[1];
+            double dz = z[k] - mean[2];
+            double d2 = dx * dx + dy * dy + dz * dz;
+            sum_sq += d2;
+            max = fmax(max, sqrt(d2));
+        }
+
+        printf("body=%d rms_dispersion=%.3fm max_dispersion=%.3fm\n", b, sqrt(sum_sq / ens->n_members), max);
+    }
+}
+
+/*
+ * Monte Carlo run: member 0 flies the nominal burns and every
+ * other member a dispersed copy of them.
+ */
+static int run_ensemble(const struct batch_opts *opts, struct thread_pool *pool, const struct scenario *scenario,
+                        double sim_time, long first_step) {
+    struct ensemble ens;
+    if (!init_ensemble(opts->integrator, opts->n_members, scenario->n_bodies, scenario->bodies, &ens)) {
+        return 0;
+    }
+    ens.time = sim_time;
+
+    unsigned long long seed = 1;
+    for (int k = 0; k < ens.n_members; ++k) {
+        double force_sigma = k == 0 ? 0.0 : opts->force_sigma;
+        double start_sigma = k == 0 ? 0.0 : opts->start_sigma;
+        if (!disperse_burns(&scenario->burns, force_sigma, start_sigma, &seed, ens.burns + k)) {
+            fprintf(stderr, "Failed to allocate the burns\n");
+            destroy_ensemble(&ens);
+            return 0;
+        }
+    }
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    long n_run = opts->n_steps > first_step ? opts->n_steps - first_step : 0;
+    int ok = step_ensemble(&ens, pool, opts->dt, n_run);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double wall = elapsed_sec(&begin, &end);
+    double member_steps = (double) n_run * ens.n_members;
+    printf("scenario=%s bodies=%d members=%d steps=%ld dt=%g integrator=%s threads=%d\n",
+           opts->scenario, ens.n_bodies, ens.n_members, n_run, opts->dt, opts->integrator->name, opts->n_threads);
+    printf("wall=%.6fs member_steps_per_sec=%.3f sim_time=%.3fs\n", wall,
+           wall > 0.0 ? member_steps / wall : 0.0, ens.time);
+    print_dispersion(&ens, &scenario->burns);
+
+    if (ok && opts->out_path) {
+        ok = write_ensemble_state(opts->out_path, &ens);
+    }
+
+    destroy_ensemble(&ens);
+    return ok;
+}
+
+static int record_tick(void *arg, const struct simulation *sim) {
+    return record_trajectory(arg, sim->step, sim->time, sim->n_bodies, sim->bodies);
+}
+
+/*
+ * Reruns a session recorded by the viewer with the viewer's
+ * own tick logic, so the trajectory matches the one the viewer
+ * wrote. Like the viewer, only the states after each tick are
+ * recorded.
+ */
+static int run_replay(const struct batch_opts *opts, const struct input_log *log, struct system_workspace *ws,
+                      struct scenario *scenario, double sim_time, long first_step) {
+    struct simulation sim;
+    if (!init_simulation(scenario->n_bodies, scenario->bodies, ws, log->tick_sec, &sim)) {
+        return 0;
+    }
+    sim.burns = &scenario->burns;
+    sim.time = sim_time;
+    sim.initial_time = sim_time;
+    sim.step = first_step;
+
+    struct trajectory_writer trajectory;
+    if (opts->trajectory_path && !open_trajectory(opts->trajectory_path, opts->trajectory_format, opts->decimation,
+                                                  sim.n_bodies, &trajectory)) {
+        destroy_simulation(&sim);
+        return 0;
+    }
+    // Every tick is kept so the file can be compared with the viewer's
+    trajectory.blocking = 1;
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    int ok = replay_input_log(log, &sim, opts->trajectory_path ? record_tick : NULL, &trajectory);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (opts->trajectory_path) {
+        ok &= close_trajectory(&trajectory);
+    }
+
+    double wall = elapsed_sec(&begin, &end);
+    long n_run = sim.step - first_step;
+    printf("replay=%s scenario=%s bodies=%d ticks=%ld events=%d steps=%ld integrator=%s threads=%d\n",
+           opts->replay_path, log->scenario, sim.n_bodies, log->n_ticks, log->n_events, n_run,
+           ws->integrator->name, opts->n_threads);
+    printf("wall=%.6fs ticks_per_sec=%.3f sim_time=%.3fs speedup=%.1fx\n", wall,
+           wall > 0.0 ? log->n_ticks / wall : 0.0, sim.time,
+           wall > 0.0 ? log->n_ticks * log->tick_sec / wall : 0.0);
+
+    if (ok && opts->out_path) {
+        ok = write_state(opts->out_path, sim.n_bodies, sim.bodies);
+    }
+    if (ok && opts->checkpoint_path) {
+        ok = save_snapshot(opts->checkpoint_path, sim.time, sim.step, sim.n_bodies, sim.bodies);
+    }
+
+    destroy_simulation(&sim);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    struct batch_opts opts = {"leo", 2, 1000, 5.0, &INTEGRATOR_EULER, 1, -1.0, NULL, NULL, NULL, 1000,
+                              NULL, TRAJECTORY_BINARY, 1, 0, 0.0, 0.0, NULL};
+    if (!parse_args(argc, argv, &opts)) {
+        return EXIT_FAILURE;
+    }
+
+    // A replay starts the way the recorded session did, whatever the other options say
+    struct input_log log = {0};
+    if (opts.replay_path) {
+        if (opts.n_members > 0 || opts.theta >= 0.0) {
+            fprintf(stderr, "Replays use the viewer's direct summation and a single system\n");
+            return EXIT_FAILURE;
+        }
+        if (!load_input_log(opts.replay_path, &log)) {
+            return EXIT_FAILURE;
+        }
+
+        opts.scenario = log.scenario;
+        opts.n_bodies = log.n_bodies;
+        opts.resume_path = log.resume;
+        opts.integrator = find_integrator(log.integrator);
+        if (!opts.integrator) {
+            fprintf(stderr, "Unknown integrator '%s'\n", log.integrator);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct thread_pool pool;
+    if (!init_thread_pool(opts.n_threads, &pool)) {
+        fprintf(stderr, "Failed to start the thread pool\n");
+        return EXIT_FAILURE;
+    }
+
+    // A resumed run picks up the snapshot's clock and stops at the same total step count
+    struct scenario scenario;
+    double sim_time = 0.0;
+    long first_step = 0;
+    if (opts.resume_path) {
+        struct snapshot snap;
+        if (!load_snapshot(opts.resume_path, &snap)) {
+            return EXIT_FAILURE;
+        }
+
+        int ok = init_scenario_snapshot(&snap, &scenario);
+        sim_time = snap.time;
+        first_step = snap.step;
+        close_snapshot(&snap);
+        if (!ok) {
+            return EXIT_FAILURE;
+        }
+
+        // Snapshots hold no burns, so they still come from a scenario file
+        if (!is_builtin_scenario(opts.scenario)) {
+            struct scenario file;
+            if (!load_scenario_file(opts.scenario, &pool, &file)) {
+                return EXIT_FAILURE;
+            }
+            destroy_burn_schedule(&scenario.burns);
+            scenario.burns = file.burns;
+            init_burn_schedule(&file.burns);
+            destroy_scenario(&file);
+        }
+        opts.scenario = opts.resume_path;
+    } else if (is_builtin_scenario(opts.scenario)) {
+        if (!init_scenario(opts.scenario, opts.n_bodies, &scenario)) {
+            return EXIT_FAILURE;
+        }
+    } else if (!load_scenario_file(opts.scenario, &pool, &scenario)) {
+        return EXIT_FAILURE;
+    }
+
+    if (opts.n_members > 0) {
+        if (opts.theta >= 0.0 || opts.checkpoint_path || opts.trajectory_path) {
+            fprintf(stderr, "Ensembles use direct summation and write only the final states\n");
+            return EXIT_FAILURE;
+        }
+
+        int ok = run_ensemble(&opts, &pool, &scenario, sim_time, first_step);
+        destroy_thread_pool(&pool);
+        destroy_scenario(&scenario);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    struct system_workspace ws;
+    if (!init_workspace(scenario.n_bodies, &ws)) {
+        fprintf(stderr, "Failed to initialize the workspace\n");
+        return EXIT_FAILURE;
+    }
+    ws.pool = &pool;
+    ws.integrator = opts.integrator;
+    if (opts.theta >= 0.0) {
+        use_barnes_hut(&ws, opts.theta);
+    }
+
+    if (opts.replay_path) {
+        int ok = run_replay(&opts, &log, &ws, &scenario, sim_time, first_step);
+        destroy_input_log(&log);
+        destroy_workspace(&ws);
+        destroy_thread_pool(&pool);
+        destroy_scenario(&scenario);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    struct trajectory_writer trajectory;
+    if (opts.trajectory_path) {
+        if (!open_trajectory(opts.trajectory_path, opts.trajectory_format, opts.decimation, scenario.n_bodies,
+                             &trajectory)) {
+            return EXIT_FAILURE;
+        }
+        // Offline runs keep every frame, however far the disk falls behind
+        trajectory.blocking = 1;
+        record_trajectory(&trajectory, first_step, sim_time, scenario.n_bodies, scenario.bodies);
+    }
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    int ok = 1;
+    long step = first_step;
+    while (step < opts.n_steps) {
+        apply_burns(&scenario.burns, sim_time, opts.dt, scenario.n_bodies, scenario.bodies);
+        if (!recompute_system(&ws, opts.dt, scenario.n_bodies, scenario.bodies)) {
+            fprintf(stderr, "Step %ld failed\n", step);
+            ok = 0;
+            break;
+        }
+        step++;
+        sim_time += opts.dt;
+
+        if (opts.trajectory_path) {
+            record_trajectory(&trajectory, step, sim_time, scenario.n_bodies, scenario.bodies);
+        }
+
+        if (opts.checkpoint_path && (step % opts.checkpoint_every == 0 || step == opts.n_steps)) {
+            ok = save_snapshot(opts.checkpoint_path, sim_time, step, scenario.n_bodies, scenario.bodies);
+            if (!ok) {
+                break;
+            }
+        }
+    }
+    long n_run = step - first_step;
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (opts.trajectory_path) {
+        ok &= close_trajectory(&trajectory);
+    }
+
+    double wall = elapsed_sec(&begin, &end);
+    printf("scenario=%s bodies=%d steps=%ld dt=%g integrator=%s backend=%s threads=%d\n",
+           opts.scenario, scenario.n_bodies, n_run, opts.dt, opts.integrator->name,
+           ws.backend == GRAVITY_BARNES_HUT ? "barnes-hut" : "direct", opts.n_threads);
+    printf("wall=%.6fs steps_per_sec=%.3f sim_time=%.3fs speedup=%.1fx\n", wall,
+           wall > 0.0 ? n_run / wall : 0.0, sim_time,
+           wall > 0.0 ? n_run * opts.dt / wall : 0.0);
+
+    if (ok && opts.out_path) {
+        ok = write_state(opts.out_path, scenario.n_bodies, scenario.bodies);
+    }
+
+    destroy_workspace(&ws);
+    destroy_thread_pool(&pool);
+    destroy_scenario(&scenario);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
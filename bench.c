@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "system.h"
+#include "integrator.h"
+#include "scenario.h"
+
+#define MAX_CASES 16
+
+static const double NS_PER_SEC = 1000000000.0;
+// Energy is an O(N^2) sum, so drift is not reported above this
+static const int ENERGY_MAX_BODIES = 20000;
+
+enum bench_backend {
+    BENCH_DIRECT,
+    BENCH_BARNES_HUT
+};
+
+struct bench_opts {
+    int n_counts;
+    int counts[MAX_CASES];
+    int n_dts;
+    double dts[MAX_CASES];
+    int n_backends;
+    enum bench_backend backends[2];
+    int n_integrators;
+    const struct integrator *integrators[MAX_CASES];
+
+    double span;
+    double budget;
+    int direct_max;
+    double theta;
+    int n_threads;
+    const char *scenario;
+};
+
+struct bench_case {
+    int n_bodies;
+    double dt;
+    enum bench_backend backend;
+    const struct integrator *integrator;
+};
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n 2,1024,...] [-d 5,60,...] [-B direct,bh] [-i euler,leapfrog,...]\n"
+                    "          [-S span_sec] [-w budget_sec] [-D direct_max] [-b theta] [-t threads]\n"
+                    "          [-s debris|constellation]\n", prog);
+}
+
+static int parse_list(char *arg, int max, const char *what, int (*parse)(const char *, void *, int), void *out) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == max) {
+            fprintf(stderr, "Too many %s values\n", what);
+            return -1;
+        }
+
+        if (!parse(tok, out, n)) {
+            fprintf(stderr, "Invalid %s '%s'\n", what, tok);
+            return -1;
+        }
+        n++;
+    }
+
+    return n;
+}
+
+static int parse_count(const char *tok, void *out, int idx) {
+    int n = atoi(tok);
+    ((int *) out)[idx] = n;
+    return n >= 2;
+}
+
+static int parse_dt(const char *tok, void *out, int idx) {
+    double dt = atof(tok);
+    ((double *) out)[idx] = dt;
+    return dt > 0.0;
+}
+
+static int parse_backend(const char *tok, void *out, int idx) {
+    enum bench_backend *backends = out;
+    if (strcmp(tok, "direct") == 0) {
+        backends[idx] = BENCH_DIRECT;
+    } else if (strcmp(tok, "bh") == 0) {
+        backends[idx] = BENCH_BARNES_HUT;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int parse_integrator(const char *tok, void *out, int idx) {
+    const struct integrator **integrators = out;
+    integrators[idx] = find_integrator(tok);
+    return integrators[idx] != NULL;
+}
+
+static int parse_args(int argc, char **argv, struct bench_opts *opts) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:B:i:S:w:D:b:t:s:")) != -1) {
+        switch (opt) {
+            case 'n':
+                opts->n_counts = parse_list(optarg, MAX_CASES, "body count", parse_count, opts->counts);
+                break;
+            case 'd':
+                opts->n_dts = parse_list(optarg, MAX_CASES, "dt", parse_dt, opts->dts);
+                break;
+            case 'B':
+                opts->n_backends = parse_list(optarg, 2, "backend", parse_backend, opts->backends);
+                break;
+            case 'i':
+                opts->n_integrators = parse_list(optarg, MAX_CASES, "integrator", parse_integrator,
+                                                 opts->integrators);
+                break;
+            case 'S':
+                opts->span = atof(optarg);
+                break;
+            case 'w':
+                opts->budget = atof(optarg);
+                break;
+            case 'D':
+                opts->direct_max = atoi(optarg);
+                break;
+            case 'b':
+                opts->theta = atof(optarg);
+                break;
+            case 't':
+                opts->n_threads = atoi(optarg);
+                break;
+            case 's':
+                opts->scenario = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 0;
+        }
+    }
+
+    if (opts->n_counts < 0 || opts->n_dts < 0 || opts->n_backends < 0 || opts->n_integrators < 0 ||
+        opts->span <= 0.0 || opts->budget <= 0.0 || opts->n_threads < 1) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    return 1;
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / NS_PER_SEC;
+}
+
+static double vec_mag(struct vector v) {
+    return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+/*
+ * Runs in a forked child so that the peak RSS it reports
+ * belongs to this case alone. Stepping stops at the end of
+ * the simulated span or when the wall budget runs out, in
+ * which case the drift is over the shorter span actually run.
+ * Two bodies always run "leo".
+ */
+static int run_case(const struct bench_opts *opts, const struct bench_case *c) {
+    const char *name = c->n_bodies == 2 ? "leo" : opts->scenario;
+    struct scenario scenario;
+    if (!init_scenario(name, c->n_bodies, &scenario)) {
+        return 0;
+    }
+
+    struct thread_pool pool;
+    struct system_workspace ws;
+    if (!init_thread_pool(opts->n_threads, &pool) || !init_workspace(scenario.n_bodies, &ws)) {
+        return 0;
+    }
+    ws.pool = &pool;
+    ws.integrator = c->integrator;
+    if (c->backend == BENCH_BARNES_HUT) {
+        use_barnes_hut(&ws, opts->theta);
+    }
+
+    int n = scenario.n_bodies;
+    int with_energy = n <= ENERGY_MAX_BODIES;
+    double e0 = with_energy ? system_energy(n, scenario.bodies) : 0.0;
+    struct vector L0 = system_angular_momentum(n, scenario.bodies);
+
+    long target_steps = (long) ceil(opts->span / c->dt);
+    long steps = 0;
+    double begin = now_sec();
+    double elapsed = 0.0;
+    while (steps < target_steps && elapsed < opts->budget) {
+        if (!recompute_system(&ws, c->dt, n, scenario.bodies)) {
+            return 0;
+        }
+        steps++;
+        elapsed = now_sec() - begin;
+    }
+
+    double e1 = with_energy ? system_energy(n, scenario.bodies) : 0.0;
+    struct vector L1 = system_angular_momentum(n, scenario.bodies);
+    struct vector dL = {L1.x - L0.x, L1.y - L0.y, L1.z - L0.z};
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    /*
+     * Interactions actually evaluated: source pairs plus each test
+     * particle against every source, pro rata for the evaluations
+     * that only covered the bodies due for one
+     */
+    double m = ws.soa.n_massive;
+    double pairs = (double) ws.n_force_rows / n * (m * (m - 1) / 2.0 + (n - m) * m);
+    printf("{\"scenario\":\"%s\",\"bodies\":%d,\"massive\":%d,\"dt\":%g,\"backend\":\"%s\",\"integrator\":\"%s\",\"threads\":%d,"
+           "\"kernel\":\"%s\",\"steps\":%ld,\"complete\":%s,\"sim_span\":%g,\"wall_sec\":%.6f,"
+           "\"steps_per_sec\":%.3f,\"force_evals\":%ld,\"force_rows\":%ld,\"ns_per_pair\":%.4f,\"peak_rss_kb\":%ld,",
+           name, n, ws.soa.n_massive, c->dt, c->backend == BENCH_BARNES_HUT ? "bh" : "direct", c->integrator->name, opts->n_threads,
+           gravity_kernel_name(get_gravity_kernel()), steps, steps == target_steps ? "true" : "false",
+           steps * c->dt, elapsed, elapsed > 0.0 ? steps / elapsed : 0.0, ws.n_force_evals, ws.n_force_rows,
+           pairs > 0.0 ? elapsed * NS_PER_SEC / pairs : 0.0, usage.ru_maxrss);
+    if (with_energy) {
+        printf("\"energy_drift\":%.6e,", fabs((e1 - e0) / e0));
+    } else {
+        printf("\"energy_drift\":null,");
+    }
+    printf("\"angular_momentum_drift\":%.6e}\n", vec_mag(dL) / vec_mag(L0));
+
+    destroy_workspace(&ws);
+    destroy_thread_pool(&pool);
+    destroy_scenario(&scenario);
+    return 1;
+}
+
+static int fork_case(const struct bench_opts *opts, const struct bench_case *c) {
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork\n");
+        return 0;
+    }
+
+    if (pid == 0) {
+        int ok = run_case(opts, c);
+        fflush(stdout);
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "Case bodies=%d dt=%g failed\n", c->n_bodies, c->dt);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    struct bench_opts opts = {
+            7, {2, 16, 128, 1024, 8192, 65536, 1000000},
+            2, {5.0, 60.0},
+            2, {BENCH_DIRECT, BENCH_BARNES_HUT},
+            2, {&INTEGRATOR_EULER, &INTEGRATOR_LEAPFROG},
+            6000.0, 10.0, 65536, 0.5, 1, "debris"
+    };
+    if (!parse_args(argc, argv, &opts)) {
+        return EXIT_FAILURE;
+    }
+
+    int ok = 1;
+    for (int ni = 0; ni < opts.n_counts; ++ni) {
+        for (int bi = 0; bi < opts.n_backends; ++bi) {
+            if (opts.backends[bi] == BENCH_DIRECT && opts.counts[ni] > opts.direct_max) {
+                continue;
+            }
+
+            for (int ii = 0; ii < opts.n_integrators; ++ii) {
+                for (int di = 0; di < opts.n_dts; ++di) {
+                    struct bench_case c = {opts.counts[ni], opts.dts[di], opts.backends[bi], opts.integrators[ii]};
+                    ok &= fork_case(&opts, &c);
+                }
+            }
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
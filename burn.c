@@ -0,0 +1,210 @@
+#include "burn.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+void init_burn_schedule(struct burn_schedule *out) {
+    out->n_burns = 0;
+    out->cap = 0;
+    out->burns = NULL;
+    out->n_ended = 0;
+    out->ended_by = 0.0;
+}
+
+void destroy_burn_schedule(struct burn_schedule *schedule) {
+    free(schedule->burns);
+    schedule->burns = NULL;
+    schedule->n_burns = 0;
+    schedule->cap = 0;
+    schedule->n_ended = 0;
+}
+
+int add_burn(struct burn_schedule *schedule, const struct burn *burn) {
+    if (schedule->n_burns == schedule->cap) {
+        int cap = schedule->cap ? 2 * schedule->cap : 16;
+        struct burn *burns = realloc(schedule->burns, cap * sizeof(*burns));
+        if (!burns) {
+            return 0;
+        }
+
+        schedule->burns = burns;
+        schedule->cap = cap;
+    }
+
+    schedule->burns[schedule->n_burns++] = *burn;
+    schedule->n_ended = 0;
+    return 1;
+}
+
+static int compare_burns(const void *a, const void *b) {
+    const struct burn *x = a;
+    const struct burn *y = b;
+    if (x->start != y->start) {
+        return x->start < y->start ? -1 : 1;
+    }
+
+    return x->body - y->body;
+}
+
+void sort_burns(struct burn_schedule *schedule) {
+    qsort(schedule->burns, schedule->n_burns, sizeof(struct burn), compare_burns);
+    schedule->n_ended = 0;
+}
+
+// Index of the first burn starting at or after time
+int first_burn_after(const struct burn_schedule *schedule, double time) {
+    int lo = 0;
+    int hi = schedule->n_burns;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (schedule->burns[mid].start < time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static struct vector unit(struct vector v) {
+    double mag = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    struct vector zero = {0.0, 0.0, 0.0};
+    if (mag == 0.0) {
+        return zero;
+    }
+
+    struct vector result = {v.x / mag, v.y / mag, v.z / mag};
+    return result;
+}
+
+static struct vector cross(struct vector a, struct vector b) {
+    struct vector result = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+    return result;
+}
+
+/*
+ * Prograde is along the velocity relative to body 0, normal
+ * along the orbital angular momentum and radial completes the
+ * right-handed frame, pointing away from body 0 on a circular
+ * orbit.
+ */
+static struct vector burn_force(const struct burn *burn, struct vector r, struct vector v) {
+    if (burn->frame == BURN_INERTIAL) {
+        return burn->force;
+    }
+
+    struct vector prograde = unit(v);
+    struct vector normal = unit(cross(r, v));
+    struct vector radial = cross(prograde, normal);
+
+    const struct vector *f = &burn->force;
+    struct vector result = {
+            f->x * prograde.x + f->y * normal.x + f->z * radial.x,
+            f->x * prograde.y + f->y * normal.y + f->z * radial.y,
+            f->x * prograde.z + f->y * normal.z + f->z * radial.z
+    };
+    return result;
+}
+
+/*
+ * A burn covering only part of the step is scaled by the
+ * covered fraction, so the impulse delivered is independent
+ * of dt.
+ */
+int average_burn_force(const struct burn *burn, double time, double dt, struct vector rel_pos,
+                       struct vector rel_vel, struct vector *out) {
+    double begin = burn->start > time ? burn->start : time;
+    double stop = burn->start + burn->duration < time + dt ? burn->start + burn->duration : time + dt;
+    if (stop <= begin) {
+        return 0;
+    }
+
+    struct vector f = burn_force(burn, rel_pos, rel_vel);
+    double s = dt > 0.0 ? (stop - begin) / dt : 1.0;
+    struct vector result = {s * f.x, s * f.y, s * f.z};
+    *out = result;
+    return 1;
+}
+
+int retire_burns(struct burn_schedule *schedule, double time) {
+    if (time < schedule->ended_by) {
+        schedule->n_ended = 0;
+    }
+    schedule->ended_by = time;
+
+    int first = schedule->n_ended;
+    while (schedule->n_ended < schedule->n_burns) {
+        const struct burn *burn = schedule->burns + schedule->n_ended;
+        if (burn->start + burn->duration > time) {
+            break;
+        }
+        schedule->n_ended++;
+    }
+
+    return first;
+}
+
+/*
+ * Sets F_net_ext of every body with a burn that has begun by
+ * the end of the step [time, time + dt). Burns that have ended
+ * clear their body's force once and are then skipped. Returns
+ * the number of burns that act during the step.
+ */
+int apply_burns(struct burn_schedule *schedule, double time, double dt, int n_bodies, struct body *bodies) {
+    int first = retire_burns(schedule, time);
+    int end = first_burn_after(schedule, time + dt);
+    struct vector zero = {0.0, 0.0, 0.0};
+    for (int k = first; k < end; ++k) {
+        int i = schedule->burns[k].body;
+        if (i < n_bodies) {
+            bodies[i].F_net_ext = zero;
+        }
+    }
+
+    int n_active = 0;
+    for (int k = schedule->n_ended; k < end; ++k) {
+        const struct burn *burn = schedule->burns + k;
+        if (burn->body >= n_bodies) {
+            continue;
+        }
+
+        struct body *body = bodies + burn->body;
+        struct vector r = {body->pos.x - bodies->pos.x, body->pos.y - bodies->pos.y, body->pos.z - bodies->pos.z};
+        struct vector v = {body->vel.x - bodies->vel.x, body->vel.y - bodies->vel.y, body->vel.z - bodies->vel.z};
+        struct vector f;
+        if (!average_burn_force(burn, time, dt, r, v, &f)) {
+            continue;
+        }
+
+        body->F_net_ext.x += f.x;
+        body->F_net_ext.y += f.y;
+        body->F_net_ext.z += f.z;
+        n_active++;
+    }
+
+    return n_active;
+}
+
+int is_burning(const struct burn_schedule *schedule, double time) {
+    int end = first_burn_after(schedule, time);
+    int k = time >= schedule->ended_by ? schedule->n_ended : 0;
+    for (; k < end; ++k) {
+        const struct burn *burn = schedule->burns + k;
+        if (burn->start + burn->duration > time) {
+            return 1;
+        }
+    }
+
+    // A burn starting exactly now
+    return end < schedule->n_burns && schedule->burns[end].start == time;
+}
+
+double next_burn_start(const struct burn_schedule *schedule, double time) {
+    int k = first_burn_after(schedule, time);
+    while (k < schedule->n_burns && schedule->burns[k].start <= time) {
+        k++;
+    }
+
+    return k < schedule->n_burns ? schedule->burns[k].start : INFINITY;
+}
@@ -0,0 +1,71 @@
+#ifndef ORBITAL_BURN_H
+#define ORBITAL_BURN_H
+
+#include "system.h"
+
+enum burn_frame {
+    // Force components along x, y and z
+    BURN_INERTIAL,
+    // Prograde, orbit normal and radial components relative to body 0
+    BURN_ORBIT
+};
+
+/*
+ * A constant force on one body over [start, start + duration).
+ */
+struct burn {
+    int body;
+    enum burn_frame frame;
+    double start;
+    double duration;
+    struct vector force;
+};
+
+/*
+ * Burns kept sorted by start time. Applying them depends only
+ * on the time, so a reset or a resumed run sees exactly the
+ * same forces.
+ */
+struct burn_schedule {
+    int n_burns;
+    int cap;
+    struct burn *burns;
+
+    // Burns before n_ended had all ended by ended_by, and stepping skips them
+    int n_ended;
+    double ended_by;
+};
+
+void init_burn_schedule(struct burn_schedule *out);
+
+void destroy_burn_schedule(struct burn_schedule *schedule);
+
+int add_burn(struct burn_schedule *schedule, const struct burn *burn);
+
+void sort_burns(struct burn_schedule *schedule);
+
+int first_burn_after(const struct burn_schedule *schedule, double time);
+
+/*
+ * Force of one burn averaged over the step [time, time + dt),
+ * given the position and velocity of its body relative to body
+ * 0. Returns 0 if the burn does not act during the step.
+ */
+int average_burn_force(const struct burn *burn, double time, double dt, struct vector rel_pos,
+                       struct vector rel_vel, struct vector *out);
+
+/*
+ * Moves n_ended past the leading burns that have ended by time
+ * and returns its previous value, so the caller can clear the
+ * force of each burn it moved past once. Time running backwards,
+ * as on a reset, starts again from the first burn.
+ */
+int retire_burns(struct burn_schedule *schedule, double time);
+
+int apply_burns(struct burn_schedule *schedule, double time, double dt, int n_bodies, struct body *bodies);
+
+int is_burning(const struct burn_schedule *schedule, double time);
+
+double next_burn_start(const struct burn_schedule *schedule, double time);
+
+#endif // ORBITAL_BURN_H
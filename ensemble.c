@@ -0,0 +1,393 @@
+#include "ensemble.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ORBITAL_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Members per pool block, a multiple of ENSEMBLE_WIDTH
+static const int MEMBER_BLOCK_SIZE = 64;
+// Lanes are padded to whole cache lines
+static const int LANE_ALIGN = 8;
+static const int ENSEMBLE_WIDTH = 4;
+static const size_t ENSEMBLE_ARRAYS = 14;
+
+/*
+ * Every supported integrator is a sequence of drifts and
+ * kicks, drift[0], kick[0], drift[1], ... drift[n_kicks],
+ * with a force evaluation before each kick.
+ */
+struct scheme {
+    int n_kicks;
+    double drift[4];
+    double kick[3];
+};
+
+struct ensemble_task {
+    struct ensemble *ens;
+    const struct scheme *scheme;
+    double dt;
+    long n_steps;
+    int simd;
+};
+
+static int get_scheme(const struct integrator *integrator, struct scheme *out) {
+    if (integrator == &INTEGRATOR_EULER) {
+        struct scheme euler = {1, {0.0, 1.0}, {1.0}};
+        *out = euler;
+    } else if (integrator == &INTEGRATOR_LEAPFROG) {
+        struct scheme leapfrog = {1, {0.5, 0.5}, {1.0}};
+        *out = leapfrog;
+    } else if (integrator == &INTEGRATOR_YOSHIDA4) {
+        double cbrt2 = cbrt(2.0);
+        double w1 = 1.0 / (2.0 - cbrt2);
+        double w0 = -cbrt2 / (2.0 - cbrt2);
+        struct scheme yoshida = {
+                3, {w1 / 2.0, (w0 + w1) / 2.0, (w0 + w1) / 2.0, w1 / 2.0}, {w1, w0, w1}
+        };
+        *out = yoshida;
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int init_ensemble(const struct integrator *integrator, int n_members, int n_bodies, const struct body *bodies,
+                  struct ensemble *out) {
+    struct scheme scheme;
+    if (!get_scheme(integrator, &scheme)) {
+        fprintf(stderr, "An ensemble cannot be stepped with %s\n", integrator->name);
+        return 0;
+    }
+
+    out->n_members = n_members;
+    out->n_bodies = n_bodies;
+    out->stride = (n_members + LANE_ALIGN - 1) / LANE_ALIGN * LANE_ALIGN;
+    out->time = 0.0;
+    out->integrator = integrator;
+    out->n_pairs = 0;
+    out->pairs = malloc((n_bodies * (n_bodies - 1) + 1) * sizeof(int));
+    out->flags = malloc((n_bodies > 0 ? n_bodies : 1) * sizeof(int));
+    out->burns = malloc((n_members > 0 ? n_members : 1) * sizeof(struct burn_schedule));
+
+    void *lanes = NULL;
+    size_t size = ENSEMBLE_ARRAYS * (size_t) (n_bodies > 0 ? n_bodies : 1) * out->stride * sizeof(double);
+    if (posix_memalign(&lanes, 64, size) != 0) {
+        lanes = NULL;
+    }
+    out->mass = lanes;
+
+    if (!out->pairs || !out->flags || !out->burns || !lanes) {
+        fprintf(stderr, "Failed to allocate an ensemble of %d members\n", n_members);
+        free(lanes);
+        free(out->pairs);
+        free(out->flags);
+        free(out->burns);
+        out->mass = NULL;
+        out->pairs = NULL;
+        out->flags = NULL;
+        out->burns = NULL;
+        return 0;
+    }
+
+    double **arrays[] = {
+            &out->mass, &out->gm, &out->x, &out->y, &out->z, &out->vx, &out->vy, &out->vz,
+            &out->ax, &out->ay, &out->az, &out->ex, &out->ey, &out->ez
+    };
+    for (size_t i = 0; i < ENSEMBLE_ARRAYS; ++i) {
+        *arrays[i] = (double *) lanes + i * (size_t) n_bodies * out->stride;
+    }
+
+    // Test particles never pull on each other
+    for (int i = 0; i < n_bodies; ++i) {
+        out->flags[i] = bodies[i].flags;
+        for (int j = i + 1; j < n_bodies; ++j) {
+            if (!(bodies[i].flags & bodies[j].flags & BODY_TEST_PARTICLE)) {
+                out->pairs[2 * out->n_pairs] = i;
+                out->pairs[2 * out->n_pairs + 1] = j;
+                out->n_pairs++;
+            }
+        }
+    }
+
+    // The padding lanes are copies too, so vectors running past the last member stay finite
+    for (int k = 0; k < out->stride; ++k) {
+        set_ensemble_member(out, k, bodies);
+    }
+    for (int k = 0; k < n_members; ++k) {
+        init_burn_schedule(out->burns + k);
+    }
+
+    return 1;
+}
+
+void destroy_ensemble(struct ensemble *ens) {
+    for (int k = 0; k < ens->n_members; ++k) {
+        destroy_burn_schedule(ens->burns + k);
+    }
+
+    free(ens->mass);
+    free(ens->pairs);
+    free(ens->flags);
+    free(ens->burns);
+    ens->mass = NULL;
+    ens->pairs = NULL;
+    ens->flags = NULL;
+    ens->burns = NULL;
+    ens->n_members = 0;
+}
+
+void set_ensemble_member(struct ensemble *ens, int member, const struct body *bodies) {
+    for (int b = 0; b < ens->n_bodies; ++b) {
+        const struct body *body = bodies + b;
+        size_t i = (size_t) b * ens->stride + member;
+
+        ens->mass[i] = body->mass;
+        ens->gm[i] = ens->flags[b] & BODY_TEST_PARTICLE ? 0.0 : G * body->mass;
+        ens->x[i] = body->pos.x;
+        ens->y[i] = body->pos.y;
+        ens->z[i] = body->pos.z;
+        ens->vx[i] = body->vel.x;
+        ens->vy[i] = body->vel.y;
+        ens->vz[i] = body->vel.z;
+        ens->ax[i] = 0.0;
+        ens->ay[i] = 0.0;
+        ens->az[i] = 0.0;
+        ens->ex[i] = body->F_net_ext.x / body->mass;
+        ens->ey[i] = body->F_net_ext.y / body->mass;
+        ens->ez[i] = body->F_net_ext.z / body->mass;
+    }
+}
+
+void get_ensemble_member(const struct ensemble *ens, int member, struct body *out) {
+    for (int b = 0; b < ens->n_bodies; ++b) {
+        struct body *body = out + b;
+        size_t i = (size_t) b * ens->stride + member;
+
+        add_body(ens->mass[i], body);
+        body->flags = ens->flags[b];
+
+        struct vector F_net_ext = {ens->ex[i] * body->mass, ens->ey[i] * body->mass, ens->ez[i] * body->mass};
+        body->F_net_ext = F_net_ext;
+
+        struct vector pos = {ens->x[i], ens->y[i], ens->z[i]};
+        body->pos = pos;
+
+        struct vector vel = {ens->vx[i], ens->vy[i], ens->vz[i]};
+        body->vel = vel;
+
+        struct vector acl = {ens->ax[i] + ens->ex[i], ens->ay[i] + ens->ey[i], ens->az[i] + ens->ez[i]};
+        body->acl = acl;
+    }
+}
+
+/*
+ * Same pairwise sum as the gravity kernels, one pair of bodies
+ * at a time across the members [begin, end). A pair with zero
+ * separation contributes nothing.
+ */
+static void ensemble_accel_scalar(struct ensemble *ens, int begin, int end) {
+    int s = ens->stride;
+    for (int b = 0; b < ens->n_bodies; ++b) {
+        for (int k = begin; k < end; ++k) {
+            ens->ax[b * s + k] = 0.0;
+            ens->ay[b * s + k] = 0.0;
+            ens->az[b * s + k] = 0.0;
+        }
+    }
+
+    for (int p = 0; p < ens->n_pairs; ++p) {
+        int i = ens->pairs[2 * p] * s;
+        int j = ens->pairs[2 * p + 1] * s;
+
+        for (int k = begin; k < end; ++k) {
+            double dx = ens->x[j + k] - ens->x[i + k];
+            double dy = ens->y[j + k] - ens->y[i + k];
+            double dz = ens->z[j + k] - ens->z[i + k];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0.0) {
+                continue;
+            }
+
+            double inv_r = 1.0 / sqrt(r2);
+            double inv_r3 = inv_r * inv_r * inv_r;
+            double si = ens->gm[j + k] * inv_r3;
+            double sj = ens->gm[i + k] * inv_r3;
+
+            ens->ax[i + k] += si * dx;
+            ens->ay[i + k] += si * dy;
+            ens->az[i + k] += si * dz;
+            ens->ax[j + k] -= sj * dx;
+            ens->ay[j + k] -= sj * dy;
+            ens->az[j + k] -= sj * dz;
+        }
+    }
+}
+
+#ifdef ORBITAL_X86_SIMD
+/*
+ * begin and end are multiples of ENSEMBLE_WIDTH and the lanes
+ * are 64-byte aligned, so every access is a full aligned
+ * vector of 4 members.
+ */
+__attribute__((target("avx2,fma")))
+static void ensemble_accel_avx2(struct ensemble *ens, int begin, int end) {
+    int s = ens->stride;
+    __m256d zero = _mm256_setzero_pd();
+    for (int b = 0; b < ens->n_bodies; ++b) {
+        for (int k = begin; k < end; k += 4) {
+            _mm256_store_pd(ens->ax + b * s + k, zero);
+            _mm256_store_pd(ens->ay + b * s + k, zero);
+            _mm256_store_pd(ens->az + b * s + k, zero);
+        }
+    }
+
+    __m256d one = _mm256_set1_pd(1.0);
+    for (int p = 0; p < ens->n_pairs; ++p) {
+        int i = ens->pairs[2 * p] * s;
+        int j = ens->pairs[2 * p + 1] * s;
+
+        for (int k = begin; k < end; k += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_load_pd(ens->x + j + k), _mm256_load_pd(ens->x + i + k));
+            __m256d dy = _mm256_sub_pd(_mm256_load_pd(ens->y + j + k), _mm256_load_pd(ens->y + i + k));
+            __m256d dz = _mm256_sub_pd(_mm256_load_pd(ens->z + j + k), _mm256_load_pd(ens->z + i + k));
+            __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+
+            __m256d inv_r = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+            __m256d inv_r3 = _mm256_mul_pd(_mm256_mul_pd(inv_r, inv_r), inv_r);
+            inv_r3 = _mm256_and_pd(inv_r3, _mm256_cmp_pd(r2, zero, _CMP_NEQ_OQ));
+            __m256d si = _mm256_mul_pd(_mm256_load_pd(ens->gm + j + k), inv_r3);
+            __m256d sj = _mm256_mul_pd(_mm256_load_pd(ens->gm + i + k), inv_r3);
+
+            _mm256_store_pd(ens->ax + i + k, _mm256_fmadd_pd(si, dx, _mm256_load_pd(ens->ax + i + k)));
+            _mm256_store_pd(ens->ay + i + k, _mm256_fmadd_pd(si, dy, _mm256_load_pd(ens->ay + i + k)));
+            _mm256_store_pd(ens->az + i + k, _mm256_fmadd_pd(si, dz, _mm256_load_pd(ens->az + i + k)));
+            _mm256_store_pd(ens->ax + j + k, _mm256_fnmadd_pd(sj, dx, _mm256_load_pd(ens->ax + j + k)));
+            _mm256_store_pd(ens->ay + j + k, _mm256_fnmadd_pd(sj, dy, _mm256_load_pd(ens->ay + j + k)));
+            _mm256_store_pd(ens->az + j + k, _mm256_fnmadd_pd(sj, dz, _mm256_load_pd(ens->az + j + k)));
+        }
+    }
+}
+#endif
+
+static void ensemble_drift(struct ensemble *ens, int begin, int end, double h) {
+    size_t total = (size_t) ens->n_bodies * ens->stride;
+    for (size_t base = 0; base < total; base += ens->stride) {
+        for (size_t i = base + begin; i < base + end; ++i) {
+            ens->x[i] += ens->vx[i] * h;
+            ens->y[i] += ens->vy[i] * h;
+            ens->z[i] += ens->vz[i] * h;
+        }
+    }
+}
+
+static void ensemble_kick(struct ensemble *ens, int begin, int end, double h) {
+    size_t total = (size_t) ens->n_bodies * ens->stride;
+    for (size_t base = 0; base < total; base += ens->stride) {
+        for (size_t i = base + begin; i < base + end; ++i) {
+            ens->vx[i] += (ens->ax[i] + ens->ex[i]) * h;
+            ens->vy[i] += (ens->ay[i] + ens->ey[i]) * h;
+            ens->vz[i] += (ens->az[i] + ens->ez[i]) * h;
+        }
+    }
+}
+
+// The member's counterpart of apply_burns followed by loading F_net_ext / mass
+static void apply_member_burns(struct ensemble *ens, int member, double time, double dt) {
+    struct burn_schedule *schedule = ens->burns + member;
+    int first = retire_burns(schedule, time);
+    int end = first_burn_after(schedule, time + dt);
+    int s = ens->stride;
+
+    for (int q = first; q < end; ++q) {
+        int b = schedule->burns[q].body;
+        if (b < ens->n_bodies) {
+            ens->ex[b * s + member] = 0.0;
+            ens->ey[b * s + member] = 0.0;
+            ens->ez[b * s + member] = 0.0;
+        }
+    }
+
+    for (int q = schedule->n_ended; q < end; ++q) {
+        const struct burn *burn = schedule->burns + q;
+        if (burn->body >= ens->n_bodies) {
+            continue;
+        }
+
+        int i = burn->body * s + member;
+        struct vector r = {ens->x[i] - ens->x[member], ens->y[i] - ens->y[member], ens->z[i] - ens->z[member]};
+        struct vector v = {ens->vx[i] - ens->vx[member], ens->vy[i] - ens->vy[member],
+                           ens->vz[i] - ens->vz[member]};
+        struct vector f;
+        if (!average_burn_force(burn, time, dt, r, v, &f)) {
+            continue;
+        }
+
+        ens->ex[i] += f.x / ens->mass[i];
+        ens->ey[i] += f.y / ens->mass[i];
+        ens->ez[i] += f.z / ens->mass[i];
+    }
+}
+
+static void ensemble_task(void *arg, int begin, int end) {
+    struct ensemble_task *task = arg;
+    struct ensemble *ens = task->ens;
+    const struct scheme *scheme = task->scheme;
+    double dt = task->dt;
+
+    // The vectors may run on into the padding lanes, which are never read back
+    int lanes_end = (end + ENSEMBLE_WIDTH - 1) / ENSEMBLE_WIDTH * ENSEMBLE_WIDTH;
+    double time = ens->time;
+    for (long step = 0; step < task->n_steps; ++step) {
+        for (int k = begin; k < end; ++k) {
+            apply_member_burns(ens, k, time, dt);
+        }
+
+        for (int stage = 0; stage <= scheme->n_kicks; ++stage) {
+            if (scheme->drift[stage] != 0.0) {
+                ensemble_drift(ens, begin, lanes_end, scheme->drift[stage] * dt);
+            }
+            if (stage == scheme->n_kicks) {
+                break;
+            }
+
+#ifdef ORBITAL_X86_SIMD
+            if (task->simd) {
+                ensemble_accel_avx2(ens, begin, lanes_end);
+            } else {
+                ensemble_accel_scalar(ens, begin, lanes_end);
+            }
+#else
+            ensemble_accel_scalar(ens, begin, lanes_end);
+#endif
+            ensemble_kick(ens, begin, lanes_end, scheme->kick[stage] * dt);
+        }
+
+        time += dt;
+    }
+}
+
+int step_ensemble(struct ensemble *ens, struct thread_pool *pool, double dt, long n_steps) {
+    struct scheme scheme;
+    if (n_steps < 0 || !get_scheme(ens->integrator, &scheme)) {
+        return 0;
+    }
+
+    // Follows the gravity kernel, so forcing that to scalar also covers the ensemble
+    struct ensemble_task task = {ens, &scheme, dt, n_steps, get_gravity_kernel() != KERNEL_SCALAR};
+#ifdef ORBITAL_X86_SIMD
+    task.simd = task.simd && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+    run_parallel(pool, ens->n_members, MEMBER_BLOCK_SIZE, ensemble_task, &task);
+
+    for (long step = 0; step < n_steps; ++step) {
+        ens->time += dt;
+    }
+
+    return 1;
+}
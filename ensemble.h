@@ -0,0 +1,73 @@
+#ifndef ORBITAL_ENSEMBLE_H
+#define ORBITAL_ENSEMBLE_H
+
+#include "system.h"
+#include "burn.h"
+#include "integrator.h"
+#include "thread_pool.h"
+
+/*
+ * n_members independent copies of one small system, stepped
+ * together. Every per-body value is stored member-innermost,
+ * at [body * stride + member], so each SIMD lane holds a
+ * different member and a pair of bodies is evaluated for a
+ * whole vector of members at once. Members may differ in
+ * state, masses and burns; which bodies are test particles
+ * comes from the template.
+ */
+struct ensemble {
+    int n_members;
+    int n_bodies;
+    int stride;
+    double time;
+    const struct integrator *integrator;
+
+    // Body pairs that interact, two indices each
+    int n_pairs;
+    int *pairs;
+    int *flags;
+
+    double *mass;
+    // G times the gravitating mass
+    double *gm;
+    double *x;
+    double *y;
+    double *z;
+    double *vx;
+    double *vy;
+    double *vz;
+    double *ax;
+    double *ay;
+    double *az;
+    double *ex;
+    double *ey;
+    double *ez;
+
+    // One schedule per member, kept sorted by start like any other
+    struct burn_schedule *burns;
+};
+
+/*
+ * Every member starts as a copy of bodies. Only integrators
+ * that are compositions of drifts and kicks (euler, leapfrog
+ * and yoshida4) can step an ensemble.
+ */
+int init_ensemble(const struct integrator *integrator, int n_members, int n_bodies, const struct body *bodies,
+                  struct ensemble *out);
+
+void destroy_ensemble(struct ensemble *ens);
+
+void set_ensemble_member(struct ensemble *ens, int member, const struct body *bodies);
+
+void get_ensemble_member(const struct ensemble *ens, int member, struct body *out);
+
+/*
+ * Advances every member by n_steps steps of dt, applying each
+ * member's burns before every step. Blocks of members are
+ * handed to the pool whole, so each worker runs all the steps
+ * of its members without synchronizing with the others, and
+ * results do not depend on the number of threads.
+ */
+int step_ensemble(struct ensemble *ens, struct thread_pool *pool, double dt, long n_steps);
+
+#endif // ORBITAL_ENSEMBLE_H
@@ -0,0 +1,729 @@
+#include "gravity.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ORBITAL_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+const double G = 0.000000000066743;
+
+static const size_t SOA_ALIGN = 64;
+
+typedef void (*gravity_rows_fn)(struct body_soa *soa, int begin, int end);
+
+typedef void (*gravity_pairs_fn)(struct body_soa *soa);
+
+static double *alloc_doubles(int n) {
+    void *ptr;
+    if (posix_memalign(&ptr, SOA_ALIGN, (n > 0 ? n : 1) * sizeof(double)) != 0) {
+        return NULL;
+    }
+
+    return ptr;
+}
+
+static void select_gravity_kernel();
+
+int init_body_soa(int cap, struct body_soa *out) {
+    // Chosen here rather than in the kernels, before any worker thread reads it
+    select_gravity_kernel();
+
+    struct body_soa soa = {
+            0, 0, cap,
+            alloc_doubles(cap), alloc_doubles(cap), alloc_doubles(cap), alloc_doubles(cap),
+            alloc_doubles(cap), alloc_doubles(cap), alloc_doubles(cap),
+            alloc_doubles(cap), alloc_doubles(cap), alloc_doubles(cap),
+            alloc_doubles(cap), alloc_doubles(cap), alloc_doubles(cap)
+    };
+    *out = soa;
+
+    if (!soa.mass || !soa.x || !soa.y || !soa.z || !soa.vx || !soa.vy || !soa.vz ||
+        !soa.ax || !soa.ay || !soa.az || !soa.ex || !soa.ey || !soa.ez) {
+        destroy_body_soa(out);
+        return 0;
+    }
+
+    return 1;
+}
+
+void destroy_body_soa(struct body_soa *soa) {
+    double **arrays[] = {
+            &soa->mass, &soa->x, &soa->y, &soa->z, &soa->vx, &soa->vy, &soa->vz,
+            &soa->ax, &soa->ay, &soa->az, &soa->ex, &soa->ey, &soa->ez
+    };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(*arrays); ++i) {
+        free(*arrays[i]);
+        *arrays[i] = NULL;
+    }
+
+    soa->n = 0;
+    soa->n_massive = 0;
+    soa->cap = 0;
+}
+
+/*
+ * Each kernel computes the full acceleration of the rows
+ * [begin, end) against every source body. A pair with zero
+ * separation (including i == j) contributes nothing, which
+ * replaces the explicit self-interaction check.
+ */
+static void gravity_rows_scalar(struct body_soa *soa, int begin, int end) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    int n = soa->n_massive;
+
+    for (int i = begin; i < end; ++i) {
+        double xi = x[i];
+        double yi = y[i];
+        double zi = z[i];
+
+        double ax = 0.0;
+        double ay = 0.0;
+        double az = 0.0;
+        for (int j = 0; j < n; ++j) {
+            double dx = x[j] - xi;
+            double dy = y[j] - yi;
+            double dz = z[j] - zi;
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0.0) {
+                continue;
+            }
+
+            double inv_r = 1.0 / sqrt(r2);
+            double s = mass[j] * inv_r * inv_r * inv_r;
+
+            ax += s * dx;
+            ay += s * dy;
+            az += s * dz;
+        }
+
+        soa->ax[i] = G * ax;
+        soa->ay[i] = G * ay;
+        soa->az[i] = G * az;
+    }
+}
+
+/*
+ * The pair kernels visit each i < j pair of sources once and
+ * apply equal and opposite contributions, so they must start
+ * from zeroed accumulators and scale by G afterwards.
+ */
+static void gravity_pairs_scalar(struct body_soa *soa) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    double *ax = soa->ax;
+    double *ay = soa->ay;
+    double *az = soa->az;
+    int n = soa->n_massive;
+
+    for (int i = 0; i < n; ++i) {
+        double xi = x[i];
+        double yi = y[i];
+        double zi = z[i];
+        double mi = mass[i];
+
+        double axi = 0.0;
+        double ayi = 0.0;
+        double azi = 0.0;
+        for (int j = i + 1; j < n; ++j) {
+            double dx = x[j] - xi;
+            double dy = y[j] - yi;
+            double dz = z[j] - zi;
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0.0) {
+                continue;
+            }
+
+            double inv_r = 1.0 / sqrt(r2);
+            double inv_r3 = inv_r * inv_r * inv_r;
+            double si = mass[j] * inv_r3;
+            double sj = mi * inv_r3;
+
+            axi += si * dx;
+            ayi += si * dy;
+            azi += si * dz;
+
+            ax[j] -= sj * dx;
+            ay[j] -= sj * dy;
+            az[j] -= sj * dz;
+        }
+
+        ax[i] += axi;
+        ay[i] += ayi;
+        az[i] += azi;
+    }
+}
+
+/*
+ * The test-particle kernels run the other way around: the
+ * targets [begin, end) are the vector lanes and each source is
+ * broadcast in turn, so the cost is linear in the number of
+ * test particles and vectorizes however few sources there are.
+ */
+static void gravity_tests_scalar(struct body_soa *soa, int begin, int end) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    int m = soa->n_massive;
+
+    for (int i = begin; i < end; ++i) {
+        double ax = 0.0;
+        double ay = 0.0;
+        double az = 0.0;
+        for (int j = 0; j < m; ++j) {
+            double dx = x[j] - x[i];
+            double dy = y[j] - y[i];
+            double dz = z[j] - z[i];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0.0) {
+                continue;
+            }
+
+            double inv_r = 1.0 / sqrt(r2);
+            double s = mass[j] * inv_r * inv_r * inv_r;
+
+            ax += s * dx;
+            ay += s * dy;
+            az += s * dz;
+        }
+
+        soa->ax[i] = G * ax;
+        soa->ay[i] = G * ay;
+        soa->az[i] = G * az;
+    }
+}
+
+#ifdef ORBITAL_X86_SIMD
+__attribute__((target("avx2,fma")))
+static double hsum_avx2(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2,fma")))
+static void gravity_rows_avx2(struct body_soa *soa, int begin, int end) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    int n = soa->n_massive;
+    int n_vec = n & ~3;
+
+    __m256d zero = _mm256_setzero_pd();
+    __m256d one = _mm256_set1_pd(1.0);
+
+    for (int i = begin; i < end; ++i) {
+        __m256d xi = _mm256_set1_pd(x[i]);
+        __m256d yi = _mm256_set1_pd(y[i]);
+        __m256d zi = _mm256_set1_pd(z[i]);
+
+        __m256d ax = zero;
+        __m256d ay = zero;
+        __m256d az = zero;
+        for (int j = 0; j < n_vec; j += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+            __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+
+            __m256d r2 = _mm256_mul_pd(dx, dx);
+            r2 = _mm256_fmadd_pd(dy, dy, r2);
+            r2 = _mm256_fmadd_pd(dz, dz, r2);
+
+            __m256d inv_r = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+            __m256d s = _mm256_mul_pd(_mm256_mul_pd(inv_r, inv_r), inv_r);
+            s = _mm256_mul_pd(s, _mm256_loadu_pd(mass + j));
+            s = _mm256_andnot_pd(_mm256_cmp_pd(r2, zero, _CMP_EQ_OQ), s);
+
+            ax = _mm256_fmadd_pd(s, dx, ax);
+            ay = _mm256_fmadd_pd(s, dy, ay);
+            az = _mm256_fmadd_pd(s, dz, az);
+        }
+
+        double sx = hsum_avx2(ax);
+        double sy = hsum_avx2(ay);
+        double sz = hsum_avx2(az);
+        for (int j = n_vec; j < n; ++j) {
+            double dx = x[j] - x[i];
+            double dy = y[j] - y[i];
+            double dz = z[j] - z[i];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0.0) {
+                continue;
+            }
+
+            double inv_r = 1.0 / sqrt(r2);
+            double s = mass[j] * inv_r * inv_r * inv_r;
+
+            sx += s * dx;
+            sy += s * dy;
+            sz += s * dz;
+        }
+
+        soa->ax[i] = G * sx;
+        soa->ay[i] = G * sy;
+        soa->az[i] = G * sz;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void gravity_pairs_avx2(struct body_soa *soa) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    double *ax = soa->ax;
+    double *ay = soa->ay;
+    double *az = soa->az;
+    int n = soa->n_massive;
+
+    __m256d zero = _mm256_setzero_pd();
+    __m256d one = _mm256_set1_pd(1.0);
+
+    for (int i = 0; i < n; ++i) {
+        __m256d xi = _mm256_set1_pd(x[i]);
+        __m256d yi = _mm256_set1_pd(y[i]);
+        __m256d zi = _mm256_set1_pd(z[i]);
+        __m256d mi = _mm256_set1_pd(mass[i]);
+
+        __m256d axi = zero;
+        __m256d ayi = zero;
+        __m256d azi = zero;
+
+        int j = i + 1;
+        for (; j + 4 <= n; j += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + j), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + j), yi);
+            __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + j), zi);
+
+            __m256d r2 = _mm256_mul_pd(dx, dx);
+            r2 = _mm256_fmadd_pd(dy, dy, r2);
+            r2 = _mm256_fmadd_pd(dz, dz, r2);
+
+            __m256d inv_r = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+            __m256d inv_r3 = _mm256_mul_pd(_mm256_mul_pd(inv_r, inv_r), inv_r);
+            inv_r3 = _mm256_andnot_pd(_mm256_cmp_pd(r2, zero, _CMP_EQ_OQ), inv_r3);
+
+            __m256d si = _mm256_mul_pd(inv_r3, _mm256_loadu_pd(mass + j));
+            __m256d sj = _mm256_mul_pd(inv_r3, mi);
+
+            axi = _mm256_fmadd_pd(si, dx, axi);
+            ayi = _mm256_fmadd_pd(si, dy, ayi);
+            azi = _mm256_fmadd_pd(si, dz, azi);
+
+            _mm256_storeu_pd(ax + j, _mm256_fnmadd_pd(sj, dx, _mm256_loadu_pd(ax + j)));
+            _mm256_storeu_pd(ay + j, _mm256_fnmadd_pd(sj, dy, _mm256_loadu_pd(ay + j)));
+            _mm256_storeu_pd(az + j, _mm256_fnmadd_pd(sj, dz, _mm256_loadu_pd(az + j)));
+        }
+
+        double sx = hsum_avx2(axi);
+        double sy = hsum_avx2(ayi);
+        double sz = hsum_avx2(azi);
+        for (; j < n; ++j) {
+            double dx = x[j] - x[i];
+            double dy = y[j] - y[i];
+            double dz = z[j] - z[i];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0.0) {
+                continue;
+            }
+
+            double inv_r = 1.0 / sqrt(r2);
+            double inv_r3 = inv_r * inv_r * inv_r;
+            double si = mass[j] * inv_r3;
+            double sj = mass[i] * inv_r3;
+
+            sx += si * dx;
+            sy += si * dy;
+            sz += si * dz;
+
+            ax[j] -= sj * dx;
+            ay[j] -= sj * dy;
+            az[j] -= sj * dz;
+        }
+
+        ax[i] += sx;
+        ay[i] += sy;
+        az[i] += sz;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void gravity_tests_avx2(struct body_soa *soa, int begin, int end) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    int m = soa->n_massive;
+
+    __m256d zero = _mm256_setzero_pd();
+    __m256d one = _mm256_set1_pd(1.0);
+    __m256d g = _mm256_set1_pd(G);
+
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m256d xi = _mm256_loadu_pd(x + i);
+        __m256d yi = _mm256_loadu_pd(y + i);
+        __m256d zi = _mm256_loadu_pd(z + i);
+
+        __m256d ax = zero;
+        __m256d ay = zero;
+        __m256d az = zero;
+        for (int j = 0; j < m; ++j) {
+            __m256d dx = _mm256_sub_pd(_mm256_set1_pd(x[j]), xi);
+            __m256d dy = _mm256_sub_pd(_mm256_set1_pd(y[j]), yi);
+            __m256d dz = _mm256_sub_pd(_mm256_set1_pd(z[j]), zi);
+
+            __m256d r2 = _mm256_mul_pd(dx, dx);
+            r2 = _mm256_fmadd_pd(dy, dy, r2);
+            r2 = _mm256_fmadd_pd(dz, dz, r2);
+
+            __m256d inv_r = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+            __m256d s = _mm256_mul_pd(_mm256_mul_pd(inv_r, inv_r), inv_r);
+            s = _mm256_mul_pd(s, _mm256_set1_pd(mass[j]));
+            s = _mm256_andnot_pd(_mm256_cmp_pd(r2, zero, _CMP_EQ_OQ), s);
+
+            ax = _mm256_fmadd_pd(s, dx, ax);
+            ay = _mm256_fmadd_pd(s, dy, ay);
+            az = _mm256_fmadd_pd(s, dz, az);
+        }
+
+        _mm256_storeu_pd(soa->ax + i, _mm256_mul_pd(g, ax));
+        _mm256_storeu_pd(soa->ay + i, _mm256_mul_pd(g, ay));
+        _mm256_storeu_pd(soa->az + i, _mm256_mul_pd(g, az));
+    }
+
+    gravity_tests_scalar(soa, i, end);
+}
+
+__attribute__((target("avx512f")))
+static void gravity_rows_avx512(struct body_soa *soa, int begin, int end) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    int n = soa->n_massive;
+
+    __m512d zero = _mm512_setzero_pd();
+    __m512d one = _mm512_set1_pd(1.0);
+
+    for (int i = begin; i < end; ++i) {
+        __m512d xi = _mm512_set1_pd(x[i]);
+        __m512d yi = _mm512_set1_pd(y[i]);
+        __m512d zi = _mm512_set1_pd(z[i]);
+
+        __m512d ax = zero;
+        __m512d ay = zero;
+        __m512d az = zero;
+        for (int j = 0; j < n; j += 8) {
+            // The tail is handled with masked loads rather than a scalar loop
+            __mmask8 lanes = n - j >= 8 ? 0xFF : (__mmask8) ((1U << (n - j)) - 1U);
+
+            __m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, x + j), xi);
+            __m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, y + j), yi);
+            __m512d dz = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, z + j), zi);
+
+            __m512d r2 = _mm512_mul_pd(dx, dx);
+            r2 = _mm512_fmadd_pd(dy, dy, r2);
+            r2 = _mm512_fmadd_pd(dz, dz, r2);
+
+            __mmask8 live = lanes & _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ);
+            __m512d inv_r = _mm512_maskz_div_pd(live, one, _mm512_sqrt_pd(r2));
+            __m512d s = _mm512_mul_pd(_mm512_mul_pd(inv_r, inv_r), inv_r);
+            s = _mm512_mul_pd(s, _mm512_maskz_loadu_pd(lanes, mass + j));
+
+            ax = _mm512_fmadd_pd(s, dx, ax);
+            ay = _mm512_fmadd_pd(s, dy, ay);
+            az = _mm512_fmadd_pd(s, dz, az);
+        }
+
+        soa->ax[i] = G * _mm512_reduce_add_pd(ax);
+        soa->ay[i] = G * _mm512_reduce_add_pd(ay);
+        soa->az[i] = G * _mm512_reduce_add_pd(az);
+    }
+}
+__attribute__((target("avx512f")))
+static void gravity_pairs_avx512(struct body_soa *soa) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    double *ax = soa->ax;
+    double *ay = soa->ay;
+    double *az = soa->az;
+    int n = soa->n_massive;
+
+    __m512d zero = _mm512_setzero_pd();
+    __m512d one = _mm512_set1_pd(1.0);
+
+    for (int i = 0; i < n; ++i) {
+        __m512d xi = _mm512_set1_pd(x[i]);
+        __m512d yi = _mm512_set1_pd(y[i]);
+        __m512d zi = _mm512_set1_pd(z[i]);
+        __m512d mi = _mm512_set1_pd(mass[i]);
+
+        __m512d axi = zero;
+        __m512d ayi = zero;
+        __m512d azi = zero;
+        for (int j = i + 1; j < n; j += 8) {
+            __mmask8 lanes = n - j >= 8 ? 0xFF : (__mmask8) ((1U << (n - j)) - 1U);
+
+            __m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, x + j), xi);
+            __m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, y + j), yi);
+            __m512d dz = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, z + j), zi);
+
+            __m512d r2 = _mm512_mul_pd(dx, dx);
+            r2 = _mm512_fmadd_pd(dy, dy, r2);
+            r2 = _mm512_fmadd_pd(dz, dz, r2);
+
+            __mmask8 live = lanes & _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ);
+            __m512d inv_r = _mm512_maskz_div_pd(live, one, _mm512_sqrt_pd(r2));
+            __m512d inv_r3 = _mm512_mul_pd(_mm512_mul_pd(inv_r, inv_r), inv_r);
+
+            __m512d si = _mm512_mul_pd(inv_r3, _mm512_maskz_loadu_pd(lanes, mass + j));
+            __m512d sj = _mm512_mul_pd(inv_r3, mi);
+
+            axi = _mm512_fmadd_pd(si, dx, axi);
+            ayi = _mm512_fmadd_pd(si, dy, ayi);
+            azi = _mm512_fmadd_pd(si, dz, azi);
+
+            _mm512_mask_storeu_pd(ax + j, lanes, _mm512_fnmadd_pd(sj, dx, _mm512_maskz_loadu_pd(lanes, ax + j)));
+            _mm512_mask_storeu_pd(ay + j, lanes, _mm512_fnmadd_pd(sj, dy, _mm512_maskz_loadu_pd(lanes, ay + j)));
+            _mm512_mask_storeu_pd(az + j, lanes, _mm512_fnmadd_pd(sj, dz, _mm512_maskz_loadu_pd(lanes, az + j)));
+        }
+
+        ax[i] += _mm512_reduce_add_pd(axi);
+        ay[i] += _mm512_reduce_add_pd(ayi);
+        az[i] += _mm512_reduce_add_pd(azi);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gravity_tests_avx512(struct body_soa *soa, int begin, int end) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    int m = soa->n_massive;
+
+    __m512d zero = _mm512_setzero_pd();
+    __m512d one = _mm512_set1_pd(1.0);
+    __m512d g = _mm512_set1_pd(G);
+
+    for (int i = begin; i < end; i += 8) {
+        __mmask8 lanes = end - i >= 8 ? 0xFF : (__mmask8) ((1U << (end - i)) - 1U);
+
+        __m512d xi = _mm512_maskz_loadu_pd(lanes, x + i);
+        __m512d yi = _mm512_maskz_loadu_pd(lanes, y + i);
+        __m512d zi = _mm512_maskz_loadu_pd(lanes, z + i);
+
+        __m512d ax = zero;
+        __m512d ay = zero;
+        __m512d az = zero;
+        for (int j = 0; j < m; ++j) {
+            __m512d dx = _mm512_sub_pd(_mm512_set1_pd(x[j]), xi);
+            __m512d dy = _mm512_sub_pd(_mm512_set1_pd(y[j]), yi);
+            __m512d dz = _mm512_sub_pd(_mm512_set1_pd(z[j]), zi);
+
+            __m512d r2 = _mm512_mul_pd(dx, dx);
+            r2 = _mm512_fmadd_pd(dy, dy, r2);
+            r2 = _mm512_fmadd_pd(dz, dz, r2);
+
+            __mmask8 live = lanes & _mm512_cmp_pd_mask(r2, zero, _CMP_NEQ_OQ);
+            __m512d inv_r = _mm512_maskz_div_pd(live, one, _mm512_sqrt_pd(r2));
+            __m512d s = _mm512_mul_pd(_mm512_mul_pd(inv_r, inv_r), inv_r);
+            s = _mm512_mul_pd(s, _mm512_set1_pd(mass[j]));
+
+            ax = _mm512_fmadd_pd(s, dx, ax);
+            ay = _mm512_fmadd_pd(s, dy, ay);
+            az = _mm512_fmadd_pd(s, dz, az);
+        }
+
+        _mm512_mask_storeu_pd(soa->ax + i, lanes, _mm512_mul_pd(g, ax));
+        _mm512_mask_storeu_pd(soa->ay + i, lanes, _mm512_mul_pd(g, ay));
+        _mm512_mask_storeu_pd(soa->az + i, lanes, _mm512_mul_pd(g, az));
+    }
+}
+#endif
+
+static int kernel_supported(enum gravity_kernel kernel) {
+    switch (kernel) {
+        case KERNEL_SCALAR:
+            return 1;
+#ifdef ORBITAL_X86_SIMD
+        case KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return 0;
+    }
+}
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static enum gravity_kernel cur_kernel = KERNEL_SCALAR;
+static gravity_rows_fn cur_rows = gravity_rows_scalar;
+static gravity_pairs_fn cur_pairs = gravity_pairs_scalar;
+static gravity_rows_fn cur_tests = gravity_tests_scalar;
+
+static int apply_gravity_kernel(enum gravity_kernel kernel) {
+    if (!kernel_supported(kernel)) {
+        return 0;
+    }
+
+    switch (kernel) {
+#ifdef ORBITAL_X86_SIMD
+        case KERNEL_AVX512:
+            cur_rows = gravity_rows_avx512;
+            cur_pairs = gravity_pairs_avx512;
+            cur_tests = gravity_tests_avx512;
+            break;
+        case KERNEL_AVX2:
+            cur_rows = gravity_rows_avx2;
+            cur_pairs = gravity_pairs_avx2;
+            cur_tests = gravity_tests_avx2;
+            break;
+#endif
+        default:
+            cur_rows = gravity_rows_scalar;
+            cur_pairs = gravity_pairs_scalar;
+            cur_tests = gravity_tests_scalar;
+            break;
+    }
+
+    cur_kernel = kernel;
+    return 1;
+}
+
+static void select_best_kernel() {
+    if (!apply_gravity_kernel(KERNEL_AVX512) && !apply_gravity_kernel(KERNEL_AVX2)) {
+        apply_gravity_kernel(KERNEL_SCALAR);
+    }
+}
+
+static void select_gravity_kernel() {
+    pthread_once(&kernel_once, select_best_kernel);
+}
+
+int set_gravity_kernel(enum gravity_kernel kernel) {
+    // Picks the default first so that it can never replace this choice later
+    select_gravity_kernel();
+    return apply_gravity_kernel(kernel);
+}
+
+enum gravity_kernel get_gravity_kernel() {
+    select_gravity_kernel();
+    return cur_kernel;
+}
+
+const char *gravity_kernel_name(enum gravity_kernel kernel) {
+    switch (kernel) {
+        case KERNEL_AVX2:
+            return "avx2";
+        case KERNEL_AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+    }
+}
+
+void compute_gravity(struct body_soa *soa) {
+    int m = soa->n_massive;
+    for (int i = 0; i < m; ++i) {
+        soa->ax[i] = 0.0;
+        soa->ay[i] = 0.0;
+        soa->az[i] = 0.0;
+    }
+
+    cur_pairs(soa);
+
+    for (int i = 0; i < m; ++i) {
+        soa->ax[i] *= G;
+        soa->ay[i] *= G;
+        soa->az[i] *= G;
+    }
+
+    cur_tests(soa, m, soa->n);
+}
+
+void compute_gravity_rows(struct body_soa *soa, int begin, int end) {
+    int m = soa->n_massive;
+    if (begin < m) {
+        cur_rows(soa, begin, end < m ? end : m);
+    }
+    if (end > m) {
+        cur_tests(soa, begin > m ? begin : m, end);
+    }
+}
+
+/*
+ * Acceleration and its time derivative (jerk) for an arbitrary
+ * list of rows, as needed by the Hermite integrator. Only the
+ * rows due for a force update are listed, so unlike the other
+ * kernels this one gathers its targets and stays scalar.
+ */
+void compute_gravity_jerk(struct body_soa *soa, const int *rows, int begin, int end,
+                          double *jx, double *jy, double *jz) {
+    const double *mass = soa->mass;
+    const double *x = soa->x;
+    const double *y = soa->y;
+    const double *z = soa->z;
+    const double *vx = soa->vx;
+    const double *vy = soa->vy;
+    const double *vz = soa->vz;
+    int m = soa->n_massive;
+
+    for (int k = begin; k < end; ++k) {
+        int i = rows[k];
+
+        double ax = 0.0;
+        double ay = 0.0;
+        double az = 0.0;
+        double jxi = 0.0;
+        double jyi = 0.0;
+        double jzi = 0.0;
+        for (int j = 0; j < m; ++j) {
+            double dx = x[j] - x[i];
+            double dy = y[j] - y[i];
+            double dz = z[j] - z[i];
+            double r2 = dx * dx + dy * dy + dz * dz;
+            if (r2 == 0.0) {
+                continue;
+            }
+
+            double dvx = vx[j] - vx[i];
+            double dvy = vy[j] - vy[i];
+            double dvz = vz[j] - vz[i];
+
+            double inv_r2 = 1.0 / r2;
+            double s = mass[j] * inv_r2 * sqrt(inv_r2);
+            double rv = 3.0 * (dx * dvx + dy * dvy + dz * dvz) * inv_r2;
+
+            ax += s * dx;
+            ay += s * dy;
+            az += s * dz;
+
+            jxi += s * (dvx - rv * dx);
+            jyi += s * (dvy - rv * dy);
+            jzi += s * (dvz - rv * dz);
+        }
+
+        soa->ax[i] = G * ax;
+        soa->ay[i] = G * ay;
+        soa->az[i] = G * az;
+        jx[i] = G * jxi;
+        jy[i] = G * jyi;
+        jz[i] = G * jzi;
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef ORBITAL_GRAVITY_H
+#define ORBITAL_GRAVITY_H
+
+// CODATA 2018 value for G
+extern const double G;
+
+enum gravity_kernel {
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+};
+
+/*
+ * Structure-of-arrays copy of the body state so that the
+ * pairwise kernel can stream over contiguous doubles instead
+ * of striding over struct body. The kernels only read the
+ * positions and masses and write the a* arrays; velocities
+ * and the external acceleration (F_net_ext / mass) are there
+ * for the integrators.
+ *
+ * Only [0, n_massive) act as sources. The bodies after them
+ * are test particles with zero mass: they feel the sources but
+ * are never summed over, so they cost O(N·M) rather than
+ * O(N²).
+ */
+struct body_soa {
+    int n;
+    int n_massive;
+    int cap;
+
+    double *mass;
+    double *x;
+    double *y;
+    double *z;
+
+    double *vx;
+    double *vy;
+    double *vz;
+
+    double *ax;
+    double *ay;
+    double *az;
+
+    double *ex;
+    double *ey;
+    double *ez;
+};
+
+int init_body_soa(int cap, struct body_soa *out);
+
+void destroy_body_soa(struct body_soa *soa);
+
+enum gravity_kernel get_gravity_kernel();
+
+int set_gravity_kernel(enum gravity_kernel kernel);
+
+const char *gravity_kernel_name(enum gravity_kernel kernel);
+
+void compute_gravity(struct body_soa *soa);
+
+void compute_gravity_rows(struct body_soa *soa, int begin, int end);
+
+void compute_gravity_jerk(struct body_soa *soa, const int *rows, int begin, int end,
+                          double *jx, double *jy, double *jz);
+
+#endif // ORBITAL_GRAVITY_H
@@ -0,0 +1,218 @@
+#include "input_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LINE 4096
+
+static const char *const COMMAND_NAMES[] = {"thrust", "reset", "warp"};
+static const char *const DIRECTION_NAMES[] = {"idle", "left", "right", "up", "down"};
+static const int N_COMMANDS = sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]);
+static const int N_DIRECTIONS = sizeof(DIRECTION_NAMES) / sizeof(DIRECTION_NAMES[0]);
+
+int open_input_log(const char *path, const char *scenario, int n_bodies, const char *integrator,
+                   const char *resume, double tick_sec, struct input_recorder *out) {
+    out->file = fopen(path, "w");
+    if (!out->file) {
+        fprintf(stderr, "Failed to open input log '%s'\n", path);
+        return 0;
+    }
+
+    fprintf(out->file, "# orbital input log\n");
+    fprintf(out->file, "scenario %s %d\n", scenario, n_bodies);
+    fprintf(out->file, "integrator %s\n", integrator);
+    fprintf(out->file, "tick %.17g\n", tick_sec);
+    if (resume) {
+        fprintf(out->file, "resume %s\n", resume);
+    }
+
+    return 1;
+}
+
+void record_command(struct input_recorder *rec, long tick, const struct sim_command *cmd) {
+    fprintf(rec->file, "command %ld %s %s %.17g\n", tick, COMMAND_NAMES[cmd->type], DIRECTION_NAMES[cmd->dir],
+            cmd->value);
+}
+
+void record_cut_short(struct input_recorder *rec, long tick, int substeps) {
+    fprintf(rec->file, "substeps %ld %d\n", tick, substeps);
+}
+
+int close_input_log(struct input_recorder *rec, long n_ticks) {
+    fprintf(rec->file, "end %ld\n", n_ticks);
+    int ok = !ferror(rec->file);
+    ok &= fclose(rec->file) == 0;
+    rec->file = NULL;
+    if (!ok) {
+        fprintf(stderr, "Failed to write the input log\n");
+    }
+
+    return ok;
+}
+
+static int find_name(const char *const *names, int n, const char *name) {
+    for (int i = 0; i < n; ++i) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int add_event(struct input_log *log, const struct input_event *event) {
+    if (log->n_events == log->cap) {
+        int cap = log->cap ? 2 * log->cap : 64;
+        struct input_event *events = realloc(log->events, cap * sizeof(struct input_event));
+        if (!events) {
+            return 0;
+        }
+        log->events = events;
+        log->cap = cap;
+    }
+
+    log->events[log->n_events++] = *event;
+    return 1;
+}
+
+static int parse_line(char *line, struct input_log *log) {
+    char key[32];
+    char a[MAX_LINE];
+    char b[32];
+    int n_read;
+    struct input_event event = {0};
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (sscanf(line, "%31s%n", key, &n_read) != 1 || key[0] == '#') {
+        return 1;
+    }
+
+    char *rest = line + n_read;
+    if (strcmp(key, "scenario") == 0) {
+        if (sscanf(rest, "%4095s %d", a, &log->n_bodies) != 2) {
+            return 0;
+        }
+        free(log->scenario);
+        log->scenario = strdup(a);
+        return log->scenario != NULL;
+    } else if (strcmp(key, "integrator") == 0) {
+        if (sscanf(rest, "%4095s", a) != 1) {
+            return 0;
+        }
+        free(log->integrator);
+        log->integrator = strdup(a);
+        return log->integrator != NULL;
+    } else if (strcmp(key, "resume") == 0) {
+        if (sscanf(rest, "%4095s", a) != 1) {
+            return 0;
+        }
+        free(log->resume);
+        log->resume = strdup(a);
+        return log->resume != NULL;
+    } else if (strcmp(key, "tick") == 0) {
+        return sscanf(rest, "%lf", &log->tick_sec) == 1 && log->tick_sec > 0.0;
+    } else if (strcmp(key, "end") == 0) {
+        return sscanf(rest, "%ld", &log->n_ticks) == 1;
+    } else if (strcmp(key, "command") == 0) {
+        if (sscanf(rest, "%ld %31s %31s %lf", &event.tick, a, b, &event.cmd.value) != 4) {
+            return 0;
+        }
+        int type = find_name(COMMAND_NAMES, N_COMMANDS, a);
+        int dir = find_name(DIRECTION_NAMES, N_DIRECTIONS, b);
+        if (type < 0 || dir < 0) {
+            return 0;
+        }
+        event.type = EVENT_COMMAND;
+        event.cmd.type = type;
+        event.cmd.dir = dir;
+    } else if (strcmp(key, "substeps") == 0) {
+        if (sscanf(rest, "%ld %d", &event.tick, &event.substeps) != 2 || event.substeps < 0) {
+            return 0;
+        }
+        event.type = EVENT_SUBSTEPS;
+    } else {
+        return 0;
+    }
+
+    // Events are replayed in file order, which the recorder writes by tick
+    if (event.tick < 0 || (log->n_events > 0 && event.tick < log->events[log->n_events - 1].tick)) {
+        return 0;
+    }
+
+    return add_event(log, &event);
+}
+
+int load_input_log(const char *path, struct input_log *out) {
+    struct input_log log = {NULL, 0, NULL, NULL, 0.0, -1, 0, 0, NULL};
+    *out = log;
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open input log '%s'\n", path);
+        return 0;
+    }
+
+    char line[MAX_LINE];
+    long line_no = 0;
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_no++;
+        ok = parse_line(line, out);
+    }
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "%s:%ld: invalid input log entry\n", path, line_no);
+    } else if (!out->scenario || !out->integrator || out->tick_sec <= 0.0 || out->n_ticks < 0) {
+        // No end line means the session did not shut down cleanly
+        fprintf(stderr, "%s: incomplete input log\n", path);
+        ok = 0;
+    }
+
+    if (!ok) {
+        destroy_input_log(out);
+    }
+    return ok;
+}
+
+void destroy_input_log(struct input_log *log) {
+    free(log->scenario);
+    free(log->integrator);
+    free(log->resume);
+    free(log->events);
+    log->scenario = NULL;
+    log->integrator = NULL;
+    log->resume = NULL;
+    log->events = NULL;
+    log->n_events = 0;
+    log->cap = 0;
+}
+
+int replay_input_log(const struct input_log *log, struct simulation *sim,
+                     int (*on_tick)(void *arg, const struct simulation *sim), void *arg) {
+    int next = 0;
+    for (long tick = 0; tick < log->n_ticks; ++tick) {
+        while (next < log->n_events && log->events[next].tick == tick &&
+               log->events[next].type == EVENT_COMMAND) {
+            apply_command(sim, &log->events[next].cmd);
+            next++;
+        }
+
+        int max_done = sim->warp.max_substeps;
+        if (next < log->n_events && log->events[next].tick == tick) {
+            max_done = log->events[next].substeps;
+            next++;
+        }
+
+        if (!repeat_advance(sim, log->tick_sec, max_done)) {
+            fprintf(stderr, "Tick %ld failed\n", tick);
+            return 0;
+        }
+
+        if (on_tick && !on_tick(arg, sim)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
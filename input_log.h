@@ -0,0 +1,80 @@
+#ifndef ORBITAL_INPUT_LOG_H
+#define ORBITAL_INPUT_LOG_H
+
+#include <stdio.h>
+#include "simulation.h"
+
+enum input_event_type {
+    EVENT_COMMAND,
+    // The tick was cut short by the wall clock after substeps sub-steps
+    EVENT_SUBSTEPS
+};
+
+/*
+ * Something that happened at a tick, counted from the start
+ * of the session. Commands are applied before their tick runs.
+ */
+struct input_event {
+    long tick;
+    enum input_event_type type;
+    struct sim_command cmd;
+    int substeps;
+};
+
+struct input_recorder {
+    FILE *file;
+};
+
+/*
+ * A recorded session: how the viewer was started, then every
+ * command with the tick it was applied before, and every tick
+ * that the wall clock cut short. Replaying these ticks on the
+ * same start gives back the same states bit for bit.
+ */
+struct input_log {
+    char *scenario;
+    int n_bodies;
+    char *integrator;
+    // NULL unless the session was resumed from a snapshot
+    char *resume;
+    double tick_sec;
+    long n_ticks;
+
+    int n_events;
+    int cap;
+    struct input_event *events;
+};
+
+/*
+ * Log format, one entry per line:
+ *
+ *   scenario <name|file> <bodies>
+ *   integrator <name>
+ *   tick <seconds of real time per tick>
+ *   resume <snapshot>
+ *   command <tick> thrust|reset|warp idle|left|right|up|down <value>
+ *   substeps <tick> <count>
+ *   end <ticks>
+ */
+int open_input_log(const char *path, const char *scenario, int n_bodies, const char *integrator,
+                   const char *resume, double tick_sec, struct input_recorder *out);
+
+void record_command(struct input_recorder *rec, long tick, const struct sim_command *cmd);
+
+void record_cut_short(struct input_recorder *rec, long tick, int substeps);
+
+int close_input_log(struct input_recorder *rec, long n_ticks);
+
+int load_input_log(const char *path, struct input_log *out);
+
+void destroy_input_log(struct input_log *log);
+
+/*
+ * Runs every tick of log on sim as fast as possible, calling
+ * on_tick, when set, after each one. sim must start where the
+ * recorded session did.
+ */
+int replay_input_log(const struct input_log *log, struct simulation *sim,
+                     int (*on_tick)(void *arg, const struct simulation *sim), void *arg);
+
+#endif // ORBITAL_INPUT_LOG_H
@@ -0,0 +1,642 @@
+#include "integrator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const int BODY_BLOCK_SIZE = 4096;
+static const int RK_MAX_SUBSTEPS = 1000000;
+// Levels go down to 2^-BLOCK_MAX_LEVEL, so a close approach must not be left to run them all
+static const int BLOCK_MAX_PASSES = 1000000;
+static const int RK_SLOTS = 6 + 7 * 6;
+static const int ROW_BLOCK_SIZE = 64;
+// Aarseth's criterion needs snap and crackle, so the first step only goes by a / jerk
+static const double BLOCK_ETA_START = 0.01;
+
+struct pass_task {
+    struct body_soa *soa;
+    double h;
+};
+
+static void drift_task(void *arg, int begin, int end) {
+    struct pass_task *task = arg;
+    struct body_soa *soa = task->soa;
+    double h = task->h;
+
+    for (int i = begin; i < end; ++i) {
+        soa->x[i] += soa->vx[i] * h;
+        soa->y[i] += soa->vy[i] * h;
+        soa->z[i] += soa->vz[i] * h;
+    }
+}
+
+static void kick_task(void *arg, int begin, int end) {
+    struct pass_task *task = arg;
+    struct body_soa *soa = task->soa;
+    double h = task->h;
+
+    for (int i = begin; i < end; ++i) {
+        soa->vx[i] += (soa->ax[i] + soa->ex[i]) * h;
+        soa->vy[i] += (soa->ay[i] + soa->ey[i]) * h;
+        soa->vz[i] += (soa->az[i] + soa->ez[i]) * h;
+    }
+}
+
+static void drift(struct system_workspace *ws, double h) {
+    struct pass_task task = {&ws->soa, h};
+    run_parallel(ws->pool, ws->soa.n, BODY_BLOCK_SIZE, drift_task, &task);
+}
+
+static void kick(struct system_workspace *ws, double h) {
+    struct pass_task task = {&ws->soa, h};
+    run_parallel(ws->pool, ws->soa.n, BODY_BLOCK_SIZE, kick_task, &task);
+}
+
+static int step_euler(struct system_workspace *ws, double dt) {
+    if (!compute_accelerations(ws)) {
+        return 0;
+    }
+
+    kick(ws, dt);
+    drift(ws, dt);
+    return 1;
+}
+
+static int step_leapfrog(struct system_workspace *ws, double dt) {
+    drift(ws, dt / 2.0);
+    if (!compute_accelerations(ws)) {
+        return 0;
+    }
+
+    kick(ws, dt);
+    drift(ws, dt / 2.0);
+    return 1;
+}
+
+static int step_yoshida4(struct system_workspace *ws, double dt) {
+    double cbrt2 = cbrt(2.0);
+    double w1 = 1.0 / (2.0 - cbrt2);
+    double w0 = -cbrt2 / (2.0 - cbrt2);
+
+    double c[4] = {w1 / 2.0, (w0 + w1) / 2.0, (w0 + w1) / 2.0, w1 / 2.0};
+    double d[3] = {w1, w0, w1};
+
+    for (int k = 0; k < 3; ++k) {
+        drift(ws, c[k] * dt);
+        if (!compute_accelerations(ws)) {
+            return 0;
+        }
+        kick(ws, d[k] * dt);
+    }
+    drift(ws, c[3] * dt);
+
+    return 1;
+}
+
+// Dormand-Prince 5(4) tableau
+static const double DP_A[7][6] = {
+        {0.0},
+        {1.0 / 5.0},
+        {3.0 / 40.0, 9.0 / 40.0},
+        {44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0},
+        {19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0},
+        {9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0},
+        {35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0}
+};
+static const double DP_E[7] = {
+        35.0 / 384.0 - 5179.0 / 57600.0,
+        0.0,
+        500.0 / 1113.0 - 7571.0 / 16695.0,
+        125.0 / 192.0 - 393.0 / 640.0,
+        -2187.0 / 6784.0 + 92097.0 / 339200.0,
+        11.0 / 84.0 - 187.0 / 2100.0,
+        -1.0 / 40.0
+};
+
+/*
+ * RK state lives in ws->rk_buf as RK_SLOTS arrays of
+ * ws->rk_cap doubles: the 6 components of y0 followed by the
+ * 6 components of each of the 7 stage derivatives.
+ */
+static double *rk_slot(struct system_workspace *ws, int slot) {
+    return ws->rk_buf + (size_t) slot * ws->rk_cap;
+}
+
+static double *rk_k(struct system_workspace *ws, int stage, int comp) {
+    return rk_slot(ws, 6 + stage * 6 + comp);
+}
+
+static double **soa_state(struct body_soa *soa, double *out[6]) {
+    out[0] = soa->x;
+    out[1] = soa->y;
+    out[2] = soa->z;
+    out[3] = soa->vx;
+    out[4] = soa->vy;
+    out[5] = soa->vz;
+    return out;
+}
+
+struct rk_task {
+    struct system_workspace *ws;
+    double h;
+    int stage;
+};
+
+static void rk_stage_task(void *arg, int begin, int end) {
+    struct rk_task *task = arg;
+    struct system_workspace *ws = task->ws;
+    int stage = task->stage;
+
+    double *state[6];
+    soa_state(&ws->soa, state);
+    for (int comp = 0; comp < 6; ++comp) {
+        const double *y0 = rk_slot(ws, comp);
+        double *y = state[comp];
+
+        const double *k[7];
+        for (int j = 0; j < stage; ++j) {
+            k[j] = rk_k(ws, j, comp);
+        }
+
+        for (int i = begin; i < end; ++i) {
+            double sum = 0.0;
+            for (int j = 0; j < stage; ++j) {
+                sum += DP_A[stage][j] * k[j][i];
+            }
+            y[i] = y0[i] + task->h * sum;
+        }
+    }
+}
+
+static void rk_deriv_task(void *arg, int begin, int end) {
+    struct rk_task *task = arg;
+    struct system_workspace *ws = task->ws;
+    struct body_soa *soa = &ws->soa;
+    int stage = task->stage;
+
+    double *kx = rk_k(ws, stage, 0);
+    double *ky = rk_k(ws, stage, 1);
+    double *kz = rk_k(ws, stage, 2);
+    double *kvx = rk_k(ws, stage, 3);
+    double *kvy = rk_k(ws, stage, 4);
+    double *kvz = rk_k(ws, stage, 5);
+    for (int i = begin; i < end; ++i) {
+        kx[i] = soa->vx[i];
+        ky[i] = soa->vy[i];
+        kz[i] = soa->vz[i];
+        kvx[i] = soa->ax[i] + soa->ex[i];
+        kvy[i] = soa->ay[i] + soa->ey[i];
+        kvz[i] = soa->az[i] + soa->ez[i];
+    }
+}
+
+static int rk_eval(struct system_workspace *ws, int stage) {
+    if (!compute_accelerations(ws)) {
+        return 0;
+    }
+
+    struct rk_task task = {ws, 0.0, stage};
+    run_parallel(ws->pool, ws->soa.n, BODY_BLOCK_SIZE, rk_deriv_task, &task);
+    return 1;
+}
+
+static int reserve_rk(struct system_workspace *ws) {
+    if (ws->rk_buf && ws->rk_cap >= ws->soa.n) {
+        return 1;
+    }
+
+    int cap = ws->soa.cap;
+    double *buf = malloc((size_t) RK_SLOTS * (cap > 0 ? cap : 1) * sizeof(*buf));
+    if (!buf) {
+        return 0;
+    }
+
+    free(ws->rk_buf);
+    ws->rk_buf = buf;
+    ws->rk_cap = cap;
+    return 1;
+}
+
+static int step_rk45(struct system_workspace *ws, double dt) {
+    struct body_soa *soa = &ws->soa;
+    int n = soa->n;
+    if (!reserve_rk(ws)) {
+        return 0;
+    }
+
+    double *state[6];
+    soa_state(soa, state);
+
+    // Positions and velocities are scaled against the largest in the system
+    double max_pos = 0.0;
+    double max_vel = 0.0;
+    for (int comp = 0; comp < 6; ++comp) {
+        memcpy(rk_slot(ws, comp), state[comp], n * sizeof(double));
+        for (int i = 0; i < n; ++i) {
+            double v = fabs(state[comp][i]);
+            if (comp < 3) {
+                max_pos = fmax(max_pos, v);
+            } else {
+                max_vel = fmax(max_vel, v);
+            }
+        }
+    }
+
+    double tol = ws->rk_tolerance;
+    double scale[2] = {tol * (max_pos > 0.0 ? max_pos : 1.0), tol * (max_vel > 0.0 ? max_vel : 1.0)};
+
+    if (!rk_eval(ws, 0)) {
+        return 0;
+    }
+
+    double t = 0.0;
+    double h = ws->rk_h > 0.0 && ws->rk_h < dt ? ws->rk_h : dt;
+    for (int n_steps = 0; t < dt; ++n_steps) {
+        if (n_steps >= RK_MAX_SUBSTEPS) {
+            return 0;
+        }
+
+        int last = 0;
+        if (t + h >= dt) {
+            h = dt - t;
+            last = 1;
+        }
+
+        for (int stage = 1; stage < 7; ++stage) {
+            struct rk_task task = {ws, h, stage};
+            run_parallel(ws->pool, n, BODY_BLOCK_SIZE, rk_stage_task, &task);
+            if (!rk_eval(ws, stage)) {
+                return 0;
+            }
+        }
+
+        double err = 0.0;
+        for (int comp = 0; comp < 6; ++comp) {
+            double inv_scale = 1.0 / scale[comp / 3];
+
+            const double *k[7];
+            for (int j = 0; j < 7; ++j) {
+                k[j] = rk_k(ws, j, comp);
+            }
+
+            for (int i = 0; i < n; ++i) {
+                double e = 0.0;
+                for (int j = 0; j < 7; ++j) {
+                    e += DP_E[j] * k[j][i];
+                }
+                err = fmax(err, fabs(h * e) * inv_scale);
+            }
+        }
+
+        double factor = err > 0.0 ? 0.9 * pow(err, -0.2) : 5.0;
+        factor = fmin(5.0, fmax(0.2, factor));
+        if (err <= 1.0) {
+            t = last ? dt : t + h;
+
+            // FSAL: the last stage is the derivative at the accepted state
+            for (int comp = 0; comp < 6; ++comp) {
+                memcpy(rk_slot(ws, comp), state[comp], n * sizeof(double));
+                memcpy(rk_k(ws, 0, comp), rk_k(ws, 6, comp), n * sizeof(double));
+            }
+
+            if (!last) {
+                ws->rk_h = h * factor;
+            }
+        }
+        h *= factor;
+    }
+
+    return 1;
+}
+
+/*
+ * Block state lives in ws->blocks.buf as BLOCK_SLOTS arrays of
+ * ws->blocks.cap doubles. The a* arrays of the SoA hold the
+ * latest evaluation and x/v the state predicted to the current
+ * block time, so the jerk kernel reads the sources from there.
+ */
+enum block_slot {
+    SLOT_X0, SLOT_Y0, SLOT_Z0,
+    SLOT_VX0, SLOT_VY0, SLOT_VZ0,
+    SLOT_AX0, SLOT_AY0, SLOT_AZ0,
+    SLOT_JX0, SLOT_JY0, SLOT_JZ0,
+    SLOT_JX1, SLOT_JY1, SLOT_JZ1,
+    SLOT_MASS,
+    BLOCK_SLOTS
+};
+
+struct block_task {
+    struct system_workspace *ws;
+    const int *rows;
+    long long time;
+    double tick;
+};
+
+static double *block_slot(struct block_steps *blocks, int slot) {
+    return blocks->buf + (size_t) slot * blocks->cap;
+}
+
+static int reserve_blocks(struct system_workspace *ws) {
+    struct block_steps *blocks = &ws->blocks;
+    if (blocks->buf && blocks->cap >= ws->soa.n) {
+        return 1;
+    }
+
+    int cap = ws->soa.cap > 0 ? ws->soa.cap : 1;
+    double *buf = malloc((size_t) BLOCK_SLOTS * cap * sizeof(*buf));
+    long long *time = malloc(cap * sizeof(*time));
+    int *level = malloc(cap * sizeof(*level));
+    int *active = malloc(cap * sizeof(*active));
+    if (!buf || !time || !level || !active) {
+        free(buf);
+        free(time);
+        free(level);
+        free(active);
+        return 0;
+    }
+
+    free(blocks->buf);
+    free(blocks->time);
+    free(blocks->level);
+    free(blocks->active);
+    blocks->buf = buf;
+    blocks->time = time;
+    blocks->level = level;
+    blocks->active = active;
+    blocks->cap = cap;
+    blocks->valid = 0;
+    return 1;
+}
+
+// The last step's final evaluation still holds if no body was moved or changed mass since
+static int blocks_current(struct system_workspace *ws) {
+    struct block_steps *blocks = &ws->blocks;
+    struct body_soa *soa = &ws->soa;
+    if (!blocks->valid || blocks->n != soa->n) {
+        return 0;
+    }
+
+    double *state[6];
+    soa_state(soa, state);
+    size_t size = soa->n * sizeof(double);
+    for (int comp = 0; comp < 6; ++comp) {
+        if (memcmp(block_slot(blocks, SLOT_X0 + comp), state[comp], size) != 0) {
+            return 0;
+        }
+    }
+
+    return memcmp(block_slot(blocks, SLOT_MASS), soa->mass, size) == 0;
+}
+
+// Smallest level whose step dt / 2^level is no longer than h
+static int block_level(double h, double dt) {
+    double ratio = dt / h;
+    if (!(ratio > 1.0)) {
+        return 0;
+    }
+    if (ratio >= ldexp(1.0, BLOCK_MAX_LEVEL)) {
+        return BLOCK_MAX_LEVEL;
+    }
+
+    int exp;
+    double frac = frexp(ratio, &exp);
+    return frac == 0.5 ? exp - 1 : exp;
+}
+
+static long long block_ticks(int level) {
+    return 1LL << (BLOCK_MAX_LEVEL - level);
+}
+
+static void jerk_task(void *arg, int begin, int end) {
+    struct block_task *task = arg;
+    struct block_steps *blocks = &task->ws->blocks;
+    compute_gravity_jerk(&task->ws->soa, task->rows, begin, end, block_slot(blocks, SLOT_JX1),
+                         block_slot(blocks, SLOT_JY1), block_slot(blocks, SLOT_JZ1));
+}
+
+static void evaluate_rows(struct system_workspace *ws, const int *rows, int n_rows) {
+    struct block_task task = {ws, rows, 0, 0.0};
+    run_parallel(ws->pool, n_rows, ROW_BLOCK_SIZE, jerk_task, &task);
+    ws->n_force_evals++;
+    ws->n_force_rows += n_rows;
+}
+
+// Taylor-expands each body from its last correction to task->time; rows == NULL means [begin, end)
+static void predict_task(void *arg, int begin, int end) {
+    struct block_task *task = arg;
+    struct block_steps *blocks = &task->ws->blocks;
+    double *state[6];
+    soa_state(&task->ws->soa, state);
+    const double *ext[3] = {task->ws->soa.ex, task->ws->soa.ey, task->ws->soa.ez};
+
+    for (int k = begin; k < end; ++k) {
+        int i = task->rows ? task->rows[k] : k;
+        double h = (task->time - blocks->time[i]) * task->tick;
+        if (h == 0.0) {
+            continue;
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            double x0 = block_slot(blocks, SLOT_X0 + c)[i];
+            double v0 = block_slot(blocks, SLOT_VX0 + c)[i];
+            double a0 = block_slot(blocks, SLOT_AX0 + c)[i] + ext[c][i];
+            double j0 = block_slot(blocks, SLOT_JX0 + c)[i];
+
+            state[c][i] = x0 + h * (v0 + h * (a0 / 2.0 + h * j0 / 6.0));
+            state[c + 3][i] = v0 + h * (a0 + h * j0 / 2.0);
+        }
+    }
+}
+
+/*
+ * Hermite corrector for every due body, followed by Aarseth's
+ * step criterion from the snap and crackle that the two
+ * evaluations imply. A body may always halve its step, but only
+ * doubles it when the new step stays aligned to the block grid.
+ */
+static void correct_task(void *arg, int begin, int end) {
+    struct block_task *task = arg;
+    struct system_workspace *ws = task->ws;
+    struct block_steps *blocks = &ws->blocks;
+    struct body_soa *soa = &ws->soa;
+    double *state[6];
+    soa_state(soa, state);
+    const double *acl[3] = {soa->ax, soa->ay, soa->az};
+    const double *ext[3] = {soa->ex, soa->ey, soa->ez};
+
+    for (int k = begin; k < end; ++k) {
+        int i = task->rows[k];
+        int level = blocks->level[i];
+        double h = block_ticks(level) * task->tick;
+        double inv_h2 = 1.0 / (h * h);
+        double inv_h3 = inv_h2 / h;
+
+        double a1_sq = 0.0;
+        double j1_sq = 0.0;
+        double a2_sq = 0.0;
+        double a3_sq = 0.0;
+        for (int c = 0; c < 3; ++c) {
+            double *x0 = block_slot(blocks, SLOT_X0 + c) + i;
+            double *v0 = block_slot(blocks, SLOT_VX0 + c) + i;
+            double *a0 = block_slot(blocks, SLOT_AX0 + c) + i;
+            double *j0 = block_slot(blocks, SLOT_JX0 + c) + i;
+            double a1 = acl[c][i];
+            double j1 = block_slot(blocks, SLOT_JX1 + c)[i];
+
+            double da = *a0 - a1;
+            double v1 = *v0 + h * ((*a0 + a1) / 2.0 + ext[c][i]) + h * h * (*j0 - j1) / 12.0;
+            double x1 = *x0 + h * (*v0 + v1) / 2.0 + h * h * da / 12.0;
+
+            double a3 = (12.0 * da + 6.0 * h * (*j0 + j1)) * inv_h3;
+            double a2 = (-6.0 * da - h * (4.0 * *j0 + 2.0 * j1)) * inv_h2 + h * a3;
+            a1_sq += a1 * a1;
+            j1_sq += j1 * j1;
+            a2_sq += a2 * a2;
+            a3_sq += a3 * a3;
+
+            *x0 = x1;
+            *v0 = v1;
+            *a0 = a1;
+            *j0 = j1;
+            state[c][i] = x1;
+            state[c + 3][i] = v1;
+        }
+
+        long long time = blocks->time[i] + block_ticks(level);
+        blocks->time[i] = time;
+
+        double num = sqrt(a1_sq * a2_sq) + j1_sq;
+        double den = sqrt(j1_sq * a3_sq) + a2_sq;
+        int want = den > 0.0 ? block_level(sqrt(blocks->eta * num / den), blocks->dt) : 0;
+        if (want > level) {
+            blocks->level[i] = want;
+        } else if (want < level && time % block_ticks(level - 1) == 0) {
+            blocks->level[i] = level - 1;
+        }
+    }
+}
+
+static void start_blocks(struct system_workspace *ws, double dt) {
+    struct block_steps *blocks = &ws->blocks;
+    struct body_soa *soa = &ws->soa;
+    int n = soa->n;
+
+    if (!blocks_current(ws)) {
+        for (int i = 0; i < n; ++i) {
+            blocks->active[i] = i;
+        }
+        evaluate_rows(ws, blocks->active, n);
+
+        double *state[6];
+        soa_state(soa, state);
+        const double *acl[3] = {soa->ax, soa->ay, soa->az};
+        size_t size = n * sizeof(double);
+        for (int c = 0; c < 6; ++c) {
+            memcpy(block_slot(blocks, SLOT_X0 + c), state[c], size);
+        }
+        for (int c = 0; c < 3; ++c) {
+            memcpy(block_slot(blocks, SLOT_AX0 + c), acl[c], size);
+            memcpy(block_slot(blocks, SLOT_JX0 + c), block_slot(blocks, SLOT_JX1 + c), size);
+        }
+        memcpy(block_slot(blocks, SLOT_MASS), soa->mass, size);
+
+        blocks->valid = 0;
+    }
+
+    // Levels carry over from the last step as long as they mean the same step sizes
+    if (!blocks->valid || blocks->dt != dt) {
+        for (int i = 0; i < n; ++i) {
+            double a_sq = 0.0;
+            double j_sq = 0.0;
+            for (int c = 0; c < 3; ++c) {
+                double a = block_slot(blocks, SLOT_AX0 + c)[i];
+                double j = block_slot(blocks, SLOT_JX0 + c)[i];
+                a_sq += a * a;
+                j_sq += j * j;
+            }
+            blocks->level[i] = j_sq > 0.0 ? block_level(BLOCK_ETA_START * sqrt(a_sq / j_sq), dt) : 0;
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        blocks->time[i] = 0;
+    }
+    blocks->dt = dt;
+    blocks->n = n;
+}
+
+/*
+ * Each pass advances the block time to the earliest time a
+ * body is due and updates only the bodies due then. The others
+ * are merely predicted, and only the sources among them, since
+ * no one feels a test particle. Every step size divides dt, so
+ * the last pass brings every body to dt at once and leaves a
+ * full evaluation behind for the next step to start from.
+ */
+static int step_hermite(struct system_workspace *ws, double dt) {
+    struct block_steps *blocks = &ws->blocks;
+    int n = ws->soa.n;
+    if (!reserve_blocks(ws)) {
+        return 0;
+    }
+
+    start_blocks(ws, dt);
+
+    long long end = block_ticks(0);
+    double tick = ldexp(dt, -BLOCK_MAX_LEVEL);
+    long long time = 0;
+    for (int n_passes = 0; time < end; ++n_passes) {
+        if (n_passes >= BLOCK_MAX_PASSES) {
+            blocks->valid = 0;
+            return 0;
+        }
+
+        long long next = end;
+        for (int i = 0; i < n; ++i) {
+            long long due = blocks->time[i] + block_ticks(blocks->level[i]);
+            if (due < next) {
+                next = due;
+            }
+        }
+
+        int n_active = 0;
+        for (int i = 0; i < n; ++i) {
+            if (blocks->time[i] + block_ticks(blocks->level[i]) == next) {
+                blocks->active[n_active++] = i;
+            }
+        }
+
+        struct block_task task = {ws, NULL, next, tick};
+        run_parallel(ws->pool, ws->soa.n_massive, BODY_BLOCK_SIZE, predict_task, &task);
+        task.rows = blocks->active;
+        run_parallel(ws->pool, n_active, BODY_BLOCK_SIZE, predict_task, &task);
+
+        evaluate_rows(ws, blocks->active, n_active);
+        run_parallel(ws->pool, n_active, BODY_BLOCK_SIZE, correct_task, &task);
+        time = next;
+    }
+
+    blocks->valid = 1;
+    return 1;
+}
+
+const struct integrator INTEGRATOR_EULER = {"euler", step_euler};
+const struct integrator INTEGRATOR_LEAPFROG = {"leapfrog", step_leapfrog};
+const struct integrator INTEGRATOR_YOSHIDA4 = {"yoshida4", step_yoshida4};
+const struct integrator INTEGRATOR_RK45 = {"rk45", step_rk45};
+const struct integrator INTEGRATOR_HERMITE = {"hermite", step_hermite};
+
+const struct integrator *find_integrator(const char *name) {
+    const struct integrator *all[] = {
+            &INTEGRATOR_EULER, &INTEGRATOR_LEAPFROG, &INTEGRATOR_YOSHIDA4, &INTEGRATOR_RK45,
+            &INTEGRATOR_HERMITE
+    };
+
+    for (size_t i = 0; i < sizeof(all) / sizeof(*all); ++i) {
+        if (strcmp(all[i]->name, name) == 0) {
+            return all[i];
+        }
+    }
+
+    return NULL;
+}
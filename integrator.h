@@ -0,0 +1,34 @@
+#ifndef ORBITAL_INTEGRATOR_H
+#define ORBITAL_INTEGRATOR_H
+
+#include "system.h"
+
+/*
+ * An integrator advances the state loaded into ws->soa by dt
+ * and leaves the acceleration of the final force evaluation in
+ * the a* arrays. It may call compute_accelerations() as many
+ * times as it needs.
+ */
+struct integrator {
+    const char *name;
+    int (*step)(struct system_workspace *ws, double dt);
+};
+
+// Semi-implicit (symplectic) Euler, 1st order, 1 force evaluation
+extern const struct integrator INTEGRATOR_EULER;
+// Drift-kick-drift leapfrog/velocity Verlet, 2nd order, 1 force evaluation
+extern const struct integrator INTEGRATOR_LEAPFROG;
+// Yoshida composition of leapfrog, 4th order, 3 force evaluations
+extern const struct integrator INTEGRATOR_YOSHIDA4;
+// Dormand-Prince 5(4) with adaptive sub-steps, 6 force evaluations per sub-step
+extern const struct integrator INTEGRATOR_RK45;
+/*
+ * 4th order Hermite with individual power-of-two block steps
+ * of dt / 2^k, so each body is only re-evaluated as often as
+ * its own orbit needs. Always uses direct summation.
+ */
+extern const struct integrator INTEGRATOR_HERMITE;
+
+const struct integrator *find_integrator(const char *name);
+
+#endif // ORBITAL_INTEGRATOR_H
@@ -0,0 +1,239 @@
+#include "kepler.h"
+
+#include <math.h>
+
+static const double TWO_PI = 2.0 * M_PI;
+// Eccentricities this close to 1 are propagated with Barker's equation
+static const double PARABOLIC_TOLERANCE = 1e-9;
+// Below this e the periapsis direction is undefined and argp is pinned to 0
+static const double CIRCULAR_TOLERANCE = 1e-12;
+static const int MAX_NEWTON_ITERATIONS = 64;
+
+static double dot(struct vector a, struct vector b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static struct vector cross(struct vector a, struct vector b) {
+    struct vector result = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+    return result;
+}
+
+static struct vector scale(struct vector v, double s) {
+    struct vector result = {v.x * s, v.y * s, v.z * s};
+    return result;
+}
+
+static struct vector add_scaled(struct vector a, struct vector b, double s) {
+    struct vector result = {a.x + b.x * s, a.y + b.y * s, a.z + b.z * s};
+    return result;
+}
+
+static double wrap_angle(double angle) {
+    angle = fmod(angle, TWO_PI);
+    if (angle > M_PI) {
+        angle -= TWO_PI;
+    } else if (angle <= -M_PI) {
+        angle += TWO_PI;
+    }
+
+    return angle;
+}
+
+/*
+ * The orbit plane is spanned by the node direction and its
+ * in-plane perpendicular. Measuring every angle in that frame
+ * keeps equatorial and circular orbits well defined.
+ */
+static void plane_frame(double i, double raan, struct vector *node, struct vector *perp) {
+    struct vector h = {sin(i) * sin(raan), -sin(i) * cos(raan), cos(i)};
+    struct vector n = {cos(raan), sin(raan), 0.0};
+    *node = n;
+    *perp = cross(h, n);
+}
+
+int state_to_elements(double mu, struct vector r, struct vector v, struct orbital_elements *out) {
+    double r_mag = sqrt(dot(r, r));
+    double v2 = dot(v, v);
+    struct vector h = cross(r, v);
+    double h_mag = sqrt(dot(h, h));
+
+    // Radial trajectories have no orbit plane
+    if (r_mag == 0.0 || h_mag <= 1e-12 * r_mag * sqrt(v2)) {
+        return 0;
+    }
+
+    struct vector e_vec = scale(add_scaled(scale(r, v2 - mu / r_mag), v, -dot(r, v)), 1.0 / mu);
+    double e = sqrt(dot(e_vec, e_vec));
+
+    struct orbital_elements el;
+    el.mu = mu;
+    el.p = h_mag * h_mag / mu;
+    el.e = e;
+    el.a = fabs(e - 1.0) < PARABOLIC_TOLERANCE ? INFINITY : el.p / (1.0 - e * e);
+
+    double n_mag = sqrt(h.x * h.x + h.y * h.y);
+    el.i = atan2(n_mag, h.z);
+    el.raan = n_mag > 1e-12 * h_mag ? atan2(h.x, -h.y) : 0.0;
+
+    struct vector node;
+    struct vector perp;
+    plane_frame(el.i, el.raan, &node, &perp);
+
+    el.argp = e > CIRCULAR_TOLERANCE ? atan2(dot(e_vec, perp), dot(e_vec, node)) : 0.0;
+    el.nu = wrap_angle(atan2(dot(r, perp), dot(r, node)) - el.argp);
+
+    *out = el;
+    return 1;
+}
+
+void elements_to_state(const struct orbital_elements *el, struct vector *r, struct vector *v) {
+    struct vector node;
+    struct vector perp;
+    plane_frame(el->i, el->raan, &node, &perp);
+
+    double u = el->argp + el->nu;
+    struct vector radial = add_scaled(scale(node, cos(u)), perp, sin(u));
+    struct vector transverse = add_scaled(scale(node, -sin(u)), perp, cos(u));
+
+    double r_mag = el->p / (1.0 + el->e * cos(el->nu));
+    double v_scale = sqrt(el->mu / el->p);
+    *r = scale(radial, r_mag);
+    *v = add_scaled(scale(radial, v_scale * el->e * sin(el->nu)), transverse, v_scale * (1.0 + el->e * cos(el->nu)));
+}
+
+double orbital_period(const struct orbital_elements *el) {
+    if (el->e >= 1.0 || !isfinite(el->a)) {
+        return INFINITY;
+    }
+
+    return TWO_PI * sqrt(el->a * el->a * el->a / el->mu);
+}
+
+static int solve_elliptic(double e, double M, double *E_out) {
+    double E = e < 0.8 ? M + e * sin(M) : (M < 0.0 ? -M_PI : M_PI);
+    for (int it = 0; it < MAX_NEWTON_ITERATIONS; ++it) {
+        double dE = (E - e * sin(E) - M) / (1.0 - e * cos(E));
+        E -= dE;
+        if (fabs(dE) <= 1e-15 * (1.0 + fabs(E))) {
+            *E_out = E;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int solve_hyperbolic(double e, double M, double *H_out) {
+    double H = asinh(M / e);
+    for (int it = 0; it < MAX_NEWTON_ITERATIONS; ++it) {
+        double dH = (e * sinh(H) - H - M) / (e * cosh(H) - 1.0);
+        H -= dH;
+        if (fabs(dH) <= 1e-15 * (1.0 + fabs(H))) {
+            *H_out = H;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Advances the true anomaly by dt by solving Kepler's equation
+ * in the form that matches the conic: E - e sin E = M for
+ * ellipses, e sinh H - H = M for hyperbolas and Barker's
+ * equation near e == 1. The cost is independent of dt.
+ */
+int propagate_elements(struct orbital_elements *el, double dt) {
+    double e = el->e;
+    double nu = el->nu;
+
+    if (fabs(e - 1.0) < PARABOLIC_TOLERANCE) {
+        // D + D^3 / 3 grows linearly in time; its inverse is closed-form
+        double D = tan(0.5 * nu);
+        double W = D + D * D * D / 3.0 + 2.0 * sqrt(el->mu / (el->p * el->p * el->p)) * dt;
+        double A = 1.5 * fabs(W);
+        double B = cbrt(A + sqrt(A * A + 1.0));
+        D = copysign(B - 1.0 / B, W);
+        el->nu = 2.0 * atan(D);
+        return 1;
+    }
+
+    if (e < 1.0) {
+        double a = el->a;
+        double n = sqrt(el->mu / (a * a * a));
+        double root = sqrt(1.0 - e * e);
+
+        double E0 = atan2(root * sin(nu), e + cos(nu));
+        double M = E0 - e * sin(E0) + n * fmod(dt, TWO_PI / n);
+
+        double E;
+        if (!solve_elliptic(e, wrap_angle(M), &E)) {
+            return 0;
+        }
+        el->nu = atan2(root * sin(E), cos(E) - e);
+        return 1;
+    }
+
+    double a = -el->a;
+    double n = sqrt(el->mu / (a * a * a));
+    double root = sqrt(e * e - 1.0);
+
+    double H0 = asinh(root * sin(nu) / (1.0 + e * cos(nu)));
+    double M = e * sinh(H0) - H0 + n * dt;
+
+    double H;
+    if (!solve_hyperbolic(e, M, &H)) {
+        return 0;
+    }
+    el->nu = atan2(root * sinh(H), e - cosh(H));
+    return 1;
+}
+
+int propagate_kepler(double mu, struct vector *r, struct vector *v, double dt) {
+    struct orbital_elements el;
+    if (!state_to_elements(mu, *r, *v, &el) || !propagate_elements(&el, dt)) {
+        return 0;
+    }
+
+    elements_to_state(&el, r, v);
+    return 1;
+}
+
+/*
+ * Propagates an isolated pair exactly: the barycenter drifts
+ * in a straight line and the relative orbit is a conic. Returns
+ * 0 without touching the bodies if the orbit is degenerate, in
+ * which case the caller should integrate instead.
+ */
+int propagate_two_body(double dt, struct body *bodies) {
+    struct body *a = bodies;
+    struct body *b = bodies + 1;
+    double ma = gravitating_mass(a);
+    double mb = gravitating_mass(b);
+    double total = ma + mb;
+    if (total == 0.0) {
+        return 0;
+    }
+    double wa = ma / total;
+    double wb = mb / total;
+
+    struct vector r = add_scaled(b->pos, a->pos, -1.0);
+    struct vector v = add_scaled(b->vel, a->vel, -1.0);
+    if (!propagate_kepler(G * total, &r, &v, dt)) {
+        return 0;
+    }
+
+    struct vector cm_vel = add_scaled(scale(a->vel, wa), b->vel, wb);
+    struct vector cm_pos = add_scaled(add_scaled(scale(a->pos, wa), b->pos, wb), cm_vel, dt);
+
+    a->pos = add_scaled(cm_pos, r, -wb);
+    b->pos = add_scaled(cm_pos, r, wa);
+    a->vel = add_scaled(cm_vel, v, -wb);
+    b->vel = add_scaled(cm_vel, v, wa);
+
+    double r_mag = sqrt(dot(r, r));
+    double inv_r3 = G / (r_mag * r_mag * r_mag);
+    a->acl = scale(r, mb * inv_r3);
+    b->acl = scale(r, -ma * inv_r3);
+    return 1;
+}
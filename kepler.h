@@ -0,0 +1,37 @@
+#ifndef ORBITAL_KEPLER_H
+#define ORBITAL_KEPLER_H
+
+#include "system.h"
+
+/*
+ * Classical elements of a relative two-body orbit. p is used
+ * instead of the semi-major axis so that parabolic orbits can
+ * be represented; a is derived and infinite when e == 1. Angles
+ * are in radians. For equatorial orbits raan is 0 and argp is
+ * measured from +x; for circular orbits argp is 0 and nu is
+ * measured from the ascending node (or +x).
+ */
+struct orbital_elements {
+    double mu;
+    double p;
+    double e;
+    double a;
+    double i;
+    double raan;
+    double argp;
+    double nu;
+};
+
+int state_to_elements(double mu, struct vector r, struct vector v, struct orbital_elements *out);
+
+void elements_to_state(const struct orbital_elements *el, struct vector *r, struct vector *v);
+
+double orbital_period(const struct orbital_elements *el);
+
+int propagate_elements(struct orbital_elements *el, double dt);
+
+int propagate_kepler(double mu, struct vector *r, struct vector *v, double dt);
+
+int propagate_two_body(double dt, struct body *bodies);
+
+#endif // ORBITAL_KEPLER_H
@@ -1,46 +1,194 @@
 #include <SDL.h>
 #include <GL/glew.h>
-#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
 #include <cglm/cglm.h>
 #include "shader_util.h"
 #include "system.h"
-
+#include "integrator.h"
+#include "scenario.h"
+#include "scenario_file.h"
+#include "trail.h"
+#include "simulation.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
+#include "snapshot.h"
+#include "trajectory.h"
+#include "predictor.h"
+#include "profiler.h"
+#include "input_log.h"
+#include "pacer.h"
+
+// Vertices kept by each trail level
 #define POS_BUF_SIZE 1024
+#define INPUT_QUEUE_SIZE 64
+#define TRAIL_QUEUE_SIZE 4096
+// Above this many bodies they are drawn as point sprites instead of meshes
+#define POINT_SPRITE_MIN_BODIES 4096
+#define OVERLAY_ROWS 6
 
 static const double TWO_PI = 2.0 * M_PI;
 static const int CIRCLE_DIVISIONS = 100;
 static const long MS_PER_SEC = 1000;
 static const long NS_PER_MS = 1000000;
 static const long LOOP_DURATION_MS = 20;
+static const double TICK_SEC = 0.02;
+static const double WARP_STEP = 10.0;
+// Physics that falls further behind than this drops the time instead of catching up
+static const long MAX_CATCH_UP_TICKS = 5;
+static const long long CHECKPOINT_INTERVAL_SEC = 30;
 
-// IAU 2015 Earth radius
-static const double EARTH_RAD = 6378100.0;
 static const double SCALE = 0.15 / EARTH_RAD;
-// F9 Payload Guide
-static const double F9_2_THRUST = 981000;
-
-enum direction {
-    IDLE,
-    LEFT,
-    RIGHT,
-    UP,
-    DOWN
+static const int VIEW_PIXELS = 1000;
+static const double ZOOM_STEP = 2.0;
+static const double MIN_ZOOM = 1.0 / 64.0;
+static const double MAX_ZOOM = 64.0;
+// Metres the finest trail level may stray from the path; coarser levels are drawn while they stay sub-pixel
+static const double TRAIL_TOLERANCE = 500.0;
+static const double TRAIL_MAX_ERROR_PX = 0.5;
+// Frames are only drawn once something on screen has moved at least this far
+static const double MIN_VISIBLE_PX = 0.5;
+// Extent of the rocket mesh in clip space, to turn a change of heading into pixels
+static const double ROCKET_EXTENT = 0.02;
+static const float POINT_SIZE = 2.0F;
+static const float CONTROLLED_COLOR[] = {1.0F, 1.0F, 1.0F, 1.0F};
+static const float BODY_COLOR[] = {0.6F, 0.6F, 0.6F, 1.0F};
+
+// The overlay's bars span twice the frame budget, in clip space from its bottom-left corner
+static const float OVERLAY_X = -0.95F;
+static const float OVERLAY_Y = -0.95F;
+static const float OVERLAY_WIDTH = 0.6F;
+static const float OVERLAY_ROW_HEIGHT = 0.03F;
+static const float OVERLAY_ROW_GAP = 0.01F;
+static const float OVERLAY_COLORS[OVERLAY_ROWS][4] = {
+        {0.9F, 0.8F, 0.2F, 1.0F},
+        {0.3F, 0.7F, 1.0F, 1.0F},
+        {0.9F, 0.4F, 0.9F, 1.0F},
+        {1.0F, 0.5F, 0.2F, 1.0F},
+        {0.3F, 0.9F, 0.4F, 1.0F},
+        {0.9F, 0.9F, 0.9F, 1.0F}
+};
+
+enum render_phase {
+    PHASE_EVENTS,
+    PHASE_UPLOAD,
+    PHASE_RENDER,
+    PHASE_SWAP,
+    PHASE_SLEEP,
+    // Everything but the sleep, to compare against the budget
+    PHASE_FRAME,
+    N_RENDER_PHASES
+};
+
+static const char *const RENDER_PHASE_NAMES[] = {
+        "handle_events", "trail_upload", "render", "swap_window", "sleep", "frame"
+};
+
+enum physics_phase {
+    PHASE_STEP,
+    PHASE_PHYSICS_SLEEP,
+    N_PHYSICS_PHASES
 };
 
-static struct body *bodies;
+static const char *const PHYSICS_PHASE_NAMES[] = {"recompute_system", "sleep"};
+
+/*
+ * State published by the physics thread. wall_ns is the
+ * monotonic time that the state corresponds to, which lets
+ * the render thread interpolate between two snapshots.
+ */
+struct sim_state {
+    long long wall_ns;
+    double time;
+    int epoch;
+    enum direction dir;
+    int controlled;
+    int n_bodies;
+    struct body bodies[];
+};
+
+struct trail_point {
+    int epoch;
+    struct vector pos;
+};
+
+/*
+ * GPU copy of one trail level. It is only brought up to date
+ * while the level is drawn, and generation tells it when the
+ * trail was cleared under it.
+ */
+struct trail_mirror {
+    struct gl_shader_wrapper shader;
+    int generation;
+    long n_uploaded;
+};
+
+static const char *scenario_name = "leo";
+static int n_scenario_bodies = 2;
+static const char *resume_path = NULL;
+static const char *checkpoint_path = NULL;
+static struct snapshot_writer checkpoints;
+static const char *trajectory_path = NULL;
+static struct trajectory_writer trajectory;
+static const char *input_log_path = NULL;
+static struct input_recorder input_log;
+// Ticks run by the physics thread, which commands in the input log are indexed by
+static long n_ticks = 0;
+static struct scenario scenario;
+static struct simulation sim;
+static struct system_workspace workspace;
+static struct thread_pool pool;
+static int n_threads = 1;
+static const struct integrator *integrator = &INTEGRATOR_EULER;
 
 static struct gl_shader_wrapper circle_shader;
 static struct gl_shader_wrapper rocket_shader;
+static struct gl_shader_wrapper point_shader;
+static struct gl_instance *instances;
+static int use_point_sprites = 0;
 static struct gl_shader_wrapper flame_shader;
-static struct gl_shader_wrapper path_shader;
-
-static enum direction cur_dir = IDLE;
-
-static int pos_buf_idx = 0;
-static struct vector pos_buf[POS_BUF_SIZE];
+static struct trail_mirror trail_mirrors[TRAIL_LEVELS];
+static struct gl_shader_wrapper predict_shader;
+
+static struct spsc_queue input_queue;
+static struct spsc_queue trail_queue;
+static struct triple_buffer state_buffer;
+static atomic_int physics_running;
+
+static size_t snapshot_size;
+static struct sim_state *prev_state;
+static struct sim_state *cur_state;
+
+static struct trail trail;
+static int trail_epoch = 0;
+static struct trail_span trail_spans_drawn[TRAIL_LEVELS];
+static int n_trail_spans = 0;
+static double zoom = 1.0;
+
+static int use_vsync = 0;
+static struct pacer frame_pacer;
+static struct pacer tick_pacer;
+// Set by anything that changes the picture other than bodies moving
+static int scene_dirty = 1;
+static struct gl_instance *drawn_instances;
+static enum direction drawn_dir = IDLE;
+static long n_frames = 0;
+static long n_drawn_frames = 0;
+
+static struct predictor predictor;
+static float predict_buf[2 * PREDICTION_POINTS];
+
+static const char *trace_path = NULL;
+static struct trace_file trace;
+static struct profiler render_prof;
+static struct profiler physics_prof;
+static long n_late_frames = 0;
+static int show_overlay = 0;
+static struct gl_shader_wrapper overlay_bars[OVERLAY_ROWS];
+static struct gl_shader_wrapper overlay_marks;
 
 static int init_circle(struct gl_shader_wrapper *wrapper) {
-    if (!bind_shader("./shaders/vs-fixed.glsl", "./shaders/fs-fixed.glsl", wrapper)) {
+    if (!bind_shader("./shaders/vs-transform.glsl", "./shaders/fs-fixed.glsl", wrapper)) {
         return 0;
     }
 
@@ -63,14 +211,13 @@ static int init_circle(struct gl_shader_wrapper *wrapper) {
     buffer_data_2f(wrapper, n_points, len, arr);
     free(arr);
 
-    GLint in_color = glGetUniformLocation(wrapper->prog, "in_color");
-    glUniform4f(in_color, 0.0F, 0.4F, 1.0F, 1.0F);
+    set_shader_color(wrapper, 0.0F, 0.4F, 1.0F, 1.0F);
 
     return 1;
 }
 
-static int init_rocket(struct gl_shader_wrapper *wrapper) {
-    if (!bind_shader("./shaders/vs-transform.glsl", "./shaders/fs-fixed.glsl", wrapper)) {
+static int init_rocket(struct gl_shader_wrapper *wrapper, int n_instances) {
+    if (!bind_shader("./shaders/vs-instanced.glsl", "./shaders/fs-instanced.glsl", wrapper)) {
         return 0;
     }
 
@@ -100,10 +247,15 @@ static int init_rocket(struct gl_shader_wrapper *wrapper) {
 
     buffer_data_2f(wrapper, n_points, len, arr);
 
-    GLint in_color = glGetUniformLocation(wrapper->prog, "in_color");
-    glUniform4f(in_color, 1.0, 1.0, 1.0, 1.0);
+    return init_instance_buffer(wrapper, INSTANCE_MESH, n_instances);
+}
 
-    return 1;
+static int init_points(struct gl_shader_wrapper *wrapper, int n_instances) {
+    if (!bind_shader("./shaders/vs-points.glsl", "./shaders/fs-point.glsl", wrapper)) {
+        return 0;
+    }
+
+    return init_instance_buffer(wrapper, INSTANCE_POINTS, n_instances);
 }
 
 static int init_flame(struct gl_shader_wrapper *wrapper) {
@@ -126,19 +278,31 @@ static int init_flame(struct gl_shader_wrapper *wrapper) {
 
     buffer_data_2f(wrapper, n_points, len, arr);
 
-    GLint in_color = glGetUniformLocation(wrapper->prog, "in_color");
-    glUniform4f(in_color, 1.0, 0.0, 0.0, 1.0);
+    set_shader_color(wrapper, 1.0, 0.0, 0.0, 1.0);
 
     return 1;
 }
 
 static int init_path(struct gl_shader_wrapper *wrapper) {
-    if (!bind_shader("./shaders/vs-fixed.glsl", "./shaders/fs-fixed.glsl", wrapper)) {
+    if (!bind_shader("./shaders/vs-transform.glsl", "./shaders/fs-fixed.glsl", wrapper)) {
+        return 0;
+    }
+
+    if (!init_stream_buffer(wrapper, POS_BUF_SIZE)) {
+        return 0;
+    }
+
+    set_shader_color(wrapper, 1.0, 1.0, 1.0, 1.0);
+
+    return 1;
+}
+
+static int init_prediction(struct gl_shader_wrapper *wrapper) {
+    if (!bind_shader("./shaders/vs-transform.glsl", "./shaders/fs-fixed.glsl", wrapper)) {
         return 0;
     }
 
-    GLint in_color = glGetUniformLocation(wrapper->prog, "in_color");
-    glUniform4f(in_color, 1.0, 1.0, 1.0, 1.0);
+    set_shader_color(wrapper, 0.2F, 0.8F, 0.3F, 1.0F);
 
     return 1;
 }
@@ -164,9 +328,55 @@ static int init_opengl(SDL_Window *win) {
         return 0;
     }
 
+    // Pacing is done by the frame loop unless vsync was asked for
+    if (SDL_GL_SetSwapInterval(use_vsync) != 0) {
+        fprintf(stderr, "Failed to %s vsync: %s\n", use_vsync ? "enable" : "disable", SDL_GetError());
+        use_vsync = 0;
+    }
+
+    return 1;
+}
+
+static int init_overlay() {
+    for (int i = 0; i < OVERLAY_ROWS; ++i) {
+        if (!bind_shader("./shaders/vs-fixed.glsl", "./shaders/fs-fixed.glsl", overlay_bars + i)) {
+            return 0;
+        }
+        const float *c = OVERLAY_COLORS[i];
+        set_shader_color(overlay_bars + i, c[0], c[1], c[2], c[3]);
+    }
+
+    if (!bind_shader("./shaders/vs-fixed.glsl", "./shaders/fs-fixed.glsl", &overlay_marks)) {
+        return 0;
+    }
+    set_shader_color(&overlay_marks, 1.0F, 1.0F, 1.0F, 1.0F);
+
     return 1;
 }
 
+/*
+ * Trail, prediction and planet vertices stay in unzoomed clip
+ * space and are scaled by their transform, so zooming uploads
+ * nothing. Bodies are placed on the CPU every frame anyway and
+ * keep their size on screen.
+ */
+static void set_zoom(double value) {
+    zoom = value < MIN_ZOOM ? MIN_ZOOM : value > MAX_ZOOM ? MAX_ZOOM : value;
+
+    scene_dirty = 1;
+
+    mat4 view;
+    glm_mat4_identity(view);
+    vec3 scale = {(float) zoom, (float) zoom, 1.0F};
+    glm_scale(view, scale);
+
+    set_shader_transform(&circle_shader, (float *) view);
+    set_shader_transform(&predict_shader, (float *) view);
+    for (int k = 0; k < TRAIL_LEVELS; ++k) {
+        set_shader_transform(&trail_mirrors[k].shader, (float *) view);
+    }
+}
+
 static int init_graphics() {
     SDL_ShowCursor(SDL_DISABLE);
 
@@ -178,7 +388,21 @@ static int init_graphics() {
         return 0;
     }
 
-    if (!init_rocket(&rocket_shader)) {
+    // Every body except the planet at index 0 is an instance
+    int n_instances = scenario.n_bodies - 1;
+    instances = malloc(n_instances * sizeof(*instances));
+    drawn_instances = calloc(n_instances, sizeof(*drawn_instances));
+    if (n_instances > 0 && (!instances || !drawn_instances)) {
+        fprintf(stderr, "Failed to allocate instances\n");
+        return 0;
+    }
+
+    use_point_sprites = scenario.n_bodies >= POINT_SPRITE_MIN_BODIES;
+    if (use_point_sprites) {
+        if (!init_points(&point_shader, n_instances)) {
+            return 0;
+        }
+    } else if (!init_rocket(&rocket_shader, n_instances)) {
         return 0;
     }
 
@@ -186,62 +410,301 @@ static int init_graphics() {
         return 0;
     }
     
-    if (!init_path(&path_shader)) {
+    for (int k = 0; k < TRAIL_LEVELS; ++k) {
+        if (!init_path(&trail_mirrors[k].shader)) {
+            return 0;
+        }
+        trail_mirrors[k].generation = -1;
+    }
+
+    if (!init_prediction(&predict_shader)) {
         return 0;
     }
 
+    if (!init_overlay()) {
+        return 0;
+    }
+
+    set_zoom(zoom);
     return 1;
 }
 
 static void destroy_graphics() {
     destroy_shader(&circle_shader);
-    destroy_shader(&rocket_shader);
+    if (use_point_sprites) {
+        destroy_shader(&point_shader);
+    } else {
+        destroy_shader(&rocket_shader);
+    }
+    free(instances);
+    free(drawn_instances);
     destroy_shader(&flame_shader);
-    destroy_shader(&path_shader);
+    for (int k = 0; k < TRAIL_LEVELS; ++k) {
+        destroy_shader(&trail_mirrors[k].shader);
+    }
+    destroy_shader(&predict_shader);
+    for (int i = 0; i < OVERLAY_ROWS; ++i) {
+        destroy_shader(overlay_bars + i);
+    }
+    destroy_shader(&overlay_marks);
 }
 
-static void reset_system() {
-    struct body *earth = bodies;
-    struct vector zero = {0.0F, 0.0F, 0.0F};
-    earth->F_net_ext = zero;
-    earth->pos = zero;
-    earth->vel = zero;
-    earth->acl = zero;
+static int init_profiling() {
+    struct trace_file *shared = NULL;
+    if (trace_path) {
+        if (!open_trace(trace_path, &trace)) {
+            return 0;
+        }
+        shared = &trace;
+    }
 
-    struct body *rocket = bodies + 1;
-    rocket->F_net_ext = zero;
-    struct vector rocket_pos = {EARTH_RAD + 1000000.0, 0.0, 0.0};
-    rocket->pos = rocket_pos;
-    struct vector rocket_v = {0.0, 7200.0, 0.0};
-    rocket->vel = rocket_v;
-    rocket->acl = zero;
+    return init_profiler(1, "render", N_RENDER_PHASES, RENDER_PHASE_NAMES, shared, &render_prof) &&
+           init_profiler(2, "physics", N_PHYSICS_PHASES, PHYSICS_PHASE_NAMES, shared, &physics_prof);
+}
 
-    pos_buf_idx = 0;
-    path_shader.n_points = 0;
+static void destroy_profiling() {
+    printf("Render thread, last %d frames (%ld over the %.1f ms budget, %ld of %ld drawn, %ld deadlines missed):\n",
+           PROFILER_WINDOW, n_late_frames, (double) frame_pacer.period_ns / NS_PER_MS, n_drawn_frames, n_frames,
+           frame_pacer.n_missed);
+    print_profile(&render_prof, stdout);
+    printf("Physics thread, last %d ticks (%ld deadlines missed):\n", PROFILER_WINDOW, tick_pacer.n_missed);
+    print_profile(&physics_prof, stdout);
+
+    destroy_profiler(&render_prof);
+    destroy_profiler(&physics_prof);
+    if (trace_path) {
+        close_trace(&trace);
+    }
 }
 
-static void init_system() {
-    bodies = malloc(2 * sizeof(struct body));
+static int init_system() {
+    if (!init_thread_pool(n_threads, &pool)) {
+        return 0;
+    }
+
+    // Snapshots hold no burns, so a resumed file scenario is loaded for its schedule
+    if (is_builtin_scenario(scenario_name)) {
+        if (!resume_path && !init_scenario(scenario_name, n_scenario_bodies, &scenario)) {
+            return 0;
+        }
+    } else if (!load_scenario_file(scenario_name, &pool, &scenario)) {
+        return 0;
+    }
+
+    struct snapshot snap = {0};
+    if (resume_path) {
+        struct burn_schedule burns = scenario.burns;
+        init_burn_schedule(&scenario.burns);
+        destroy_scenario(&scenario);
+
+        if (!load_snapshot(resume_path, &snap)) {
+            return 0;
+        }
+
+        int ok = init_scenario_snapshot(&snap, &scenario);
+        close_snapshot(&snap);
+        if (!ok) {
+            return 0;
+        }
+        destroy_burn_schedule(&scenario.burns);
+        scenario.burns = burns;
+    }
+
+    if (!init_workspace(scenario.n_bodies, &workspace)) {
+        fprintf(stderr, "Failed to allocate the system\n");
+        return 0;
+    }
 
-    // IAU 1976 value for Earth mass
-    add_body(5972200000000000000000000.0, bodies);
+    if (!init_trail(POS_BUF_SIZE, TRAIL_TOLERANCE, &trail)) {
+        fprintf(stderr, "Failed to allocate the trail\n");
+        return 0;
+    }
 
-    // https://www.spaceflightinsider.com/hangar/falcon-9/
-    // F9 2nd stage mass
-    add_body(96570.0, bodies + 1);
+    workspace.pool = &pool;
+    workspace.integrator = integrator;
 
-    reset_system();
+    if (!init_simulation(scenario.n_bodies, scenario.bodies, &workspace, TICK_SEC, &sim)) {
+        return 0;
+    }
+    sim.burns = &scenario.burns;
+    // Resetting returns to the resumed state rather than the scenario's
+    sim.time = snap.time;
+    sim.initial_time = snap.time;
+    sim.step = snap.step;
+
+    if (!init_predictor(sim.n_bodies, integrator, &predictor)) {
+        return 0;
+    }
+
+    if (trajectory_path) {
+        size_t len = strlen(trajectory_path);
+        int is_csv = len > 4 && strcmp(trajectory_path + len - 4, ".csv") == 0;
+        if (!open_trajectory(trajectory_path, is_csv ? TRAJECTORY_CSV : TRAJECTORY_BINARY, 1, sim.n_bodies,
+                             &trajectory)) {
+            return 0;
+        }
+    }
+
+    if (checkpoint_path && !open_snapshot_writer(checkpoint_path, sim.n_bodies, &checkpoints)) {
+        return 0;
+    }
+
+    if (input_log_path && !open_input_log(input_log_path, scenario_name, n_scenario_bodies, integrator->name,
+                                          resume_path, TICK_SEC, &input_log)) {
+        return 0;
+    }
+
+    snapshot_size = sizeof(struct sim_state) + sim.n_bodies * sizeof(struct body);
+    prev_state = calloc(1, snapshot_size);
+    cur_state = calloc(1, snapshot_size);
+    if (!prev_state || !cur_state ||
+        !init_spsc_queue(INPUT_QUEUE_SIZE, sizeof(struct sim_command), &input_queue) ||
+        !init_spsc_queue(TRAIL_QUEUE_SIZE, sizeof(struct trail_point), &trail_queue) ||
+        !init_triple_buffer(snapshot_size, &state_buffer)) {
+        fprintf(stderr, "Failed to allocate the state handoff\n");
+        return 0;
+    }
+
+    return 1;
 }
 
 static void destroy_system() {
-    free(bodies);
+    if (trajectory_path) {
+        close_trajectory(&trajectory);
+    }
+    if (input_log_path) {
+        close_input_log(&input_log, n_ticks);
+    }
+
+    destroy_triple_buffer(&state_buffer);
+    destroy_spsc_queue(&trail_queue);
+    destroy_spsc_queue(&input_queue);
+    free(prev_state);
+    free(cur_state);
+
+    destroy_predictor(&predictor);
+    destroy_simulation(&sim);
+    destroy_thread_pool(&pool);
+    destroy_workspace(&workspace);
+    destroy_scenario(&scenario);
+    destroy_trail(&trail);
 }
 
-static void set_transform(const struct gl_shader_wrapper *wrapper, const mat4 *transform) {
-    GLint transform_loc = glGetUniformLocation(wrapper->prog, "transform");
+static void publish_state(long long wall_ns) {
+    struct sim_state *state = tb_write_slot(&state_buffer);
+    state->wall_ns = wall_ns;
+    state->time = sim.time;
+    state->epoch = sim.epoch;
+    state->dir = sim.dir;
+    state->controlled = sim.controlled;
+    state->n_bodies = sim.n_bodies;
+    memcpy(state->bodies, sim.bodies, sim.n_bodies * sizeof(struct body));
+
+    tb_publish(&state_buffer);
+}
+
+/*
+ * Fixed-timestep loop: real time accumulates and is consumed
+ * in LOOP_DURATION_MS ticks, each advancing the simulation by
+ * the tick times the current time warp, so the simulation rate
+ * does not depend on the frame rate.
+ */
+static int run_physics(void *arg) {
+    long long tick_ns = LOOP_DURATION_MS * NS_PER_MS;
+    long long last = pacer_now_ns();
+    long long accumulator = 0;
+    long long next_checkpoint = last + CHECKPOINT_INTERVAL_SEC * MS_PER_SEC * NS_PER_MS;
+    int seeded_epoch = -1;
+    enum direction seeded_dir = IDLE;
+    int seeded_thrusting = 0;
+
+    init_pacer(tick_ns, &tick_pacer);
+    publish_state(last);
+    while (atomic_load(&physics_running)) {
+        int changed = 0;
+
+        struct sim_command cmd;
+        while (spsc_pop(&input_queue, &cmd)) {
+            apply_command(&sim, &cmd);
+            if (input_log_path) {
+                record_command(&input_log, n_ticks, &cmd);
+            }
+            changed = 1;
+
+            if (cmd.type == CMD_WARP) {
+                printf("Time warp %gx\n", sim.warp.requested);
+            }
+        }
+
+        long long now = pacer_now_ns();
+        accumulator += now - last;
+        last = now;
+        if (accumulator > MAX_CATCH_UP_TICKS * tick_ns) {
+            accumulator = MAX_CATCH_UP_TICKS * tick_ns;
+        }
+
+        while (accumulator >= tick_ns) {
+            // Sub-steps may use at most one tick of wall time or the physics would fall behind
+            long long step_begin = pacer_now_ns();
+            if (!advance_simulation(&sim, TICK_SEC, TICK_SEC)) {
+                fprintf(stderr, "Failed to step the simulation\n");
+                // The render loop stops with the physics rather than showing a frozen state
+                atomic_store(&physics_running, 0);
+                return 1;
+            }
+            profile_mark(&physics_prof, PHASE_STEP, step_begin);
+            if (input_log_path && sim.warp.cut_short) {
+                record_cut_short(&input_log, n_ticks, sim.warp.substeps);
+            }
+            n_ticks++;
+            accumulator -= tick_ns;
+            changed = 1;
+
+            if (trajectory_path) {
+                record_trajectory(&trajectory, sim.step, sim.time, sim.n_bodies, sim.bodies);
+            }
+
+            // The trail is drawn from the render thread; drop points rather than block
+            struct trail_point point = {sim.epoch, sim.bodies[sim.controlled].pos};
+            spsc_push(&trail_queue, &point);
+        }
+
+        if (changed) {
+            publish_state(now - accumulator);
+
+            // A coasting prediction stays valid until the thrust changes
+            int thrusting = is_thrusting(&sim);
+            if (sim.epoch != seeded_epoch || sim.dir != seeded_dir || thrusting || seeded_thrusting) {
+                seed_predictor(&predictor, sim.epoch, sim.time, sim.controlled, sim.n_bodies, sim.bodies);
+                seeded_epoch = sim.epoch;
+                seeded_dir = sim.dir;
+                seeded_thrusting = thrusting;
+            } else {
+                set_predictor_time(&predictor, sim.time);
+            }
+        }
 
-    glUseProgram(wrapper->prog);
-    glUniformMatrix4fv(transform_loc, 1, GL_FALSE, (float *) *transform);
+        // Saved from the writer's thread, so the fsync never delays a tick
+        if (checkpoint_path && now >= next_checkpoint) {
+            if (!submit_snapshot(&checkpoints, sim.time, sim.step, sim.bodies)) {
+                fprintf(stderr, "Failed to checkpoint to '%s'\n", checkpoint_path);
+            }
+            next_checkpoint = now + CHECKPOINT_INTERVAL_SEC * MS_PER_SEC * NS_PER_MS;
+        }
+
+        long long sleep_begin = pacer_now_ns();
+        wait_pacer(&tick_pacer);
+        profile_mark(&physics_prof, PHASE_PHYSICS_SLEEP, sleep_begin);
+    }
+
+    return 0;
+}
+
+static void send_command(enum sim_command_type type, enum direction dir, double value) {
+    struct sim_command cmd = {type, dir, value};
+    if (!spsc_push(&input_queue, &cmd)) {
+        fprintf(stderr, "Dropped input, the physics thread is not keeping up\n");
+    }
 }
 
 static void handle_key_event(const SDL_Event *ev, int press_down) {
@@ -249,23 +712,43 @@ static void handle_key_event(const SDL_Event *ev, int press_down) {
     SDL_Keysym key_info = key_ev.keysym;
     SDL_Scancode sc = key_info.scancode;
 
+    if (key_ev.repeat) {
+        return;
+    }
+
     if (press_down) {
         switch (sc) {
             case SDL_SCANCODE_LEFT:
-                cur_dir = LEFT;
+                send_command(CMD_THRUST, LEFT, 0.0);
                 break;
             case SDL_SCANCODE_UP:
-                cur_dir = UP;
+                send_command(CMD_THRUST, UP, 0.0);
                 break;
             case SDL_SCANCODE_RIGHT:
-                cur_dir = RIGHT;
+                send_command(CMD_THRUST, RIGHT, 0.0);
                 break;
             case SDL_SCANCODE_DOWN:
-                cur_dir = DOWN;
+                send_command(CMD_THRUST, DOWN, 0.0);
                 break;
             case SDL_SCANCODE_R:
                 printf("Reset the system\n");
-                reset_system();
+                send_command(CMD_RESET, IDLE, 0.0);
+                break;
+            case SDL_SCANCODE_PERIOD:
+                send_command(CMD_WARP, IDLE, WARP_STEP);
+                break;
+            case SDL_SCANCODE_COMMA:
+                send_command(CMD_WARP, IDLE, 1.0 / WARP_STEP);
+                break;
+            case SDL_SCANCODE_P:
+                show_overlay = !show_overlay;
+                scene_dirty = 1;
+                break;
+            case SDL_SCANCODE_EQUALS:
+                set_zoom(zoom * ZOOM_STEP);
+                break;
+            case SDL_SCANCODE_MINUS:
+                set_zoom(zoom / ZOOM_STEP);
                 break;
             default:
                 break;
@@ -275,13 +758,9 @@ static void handle_key_event(const SDL_Event *ev, int press_down) {
             case SDL_SCANCODE_LEFT:
             case SDL_SCANCODE_UP:
             case SDL_SCANCODE_RIGHT:
-            case SDL_SCANCODE_DOWN: {
-                cur_dir = IDLE;
-
-                struct vector zero = {0.0F, 0.0F, 0.0F};
-                bodies[1].F_net_ext = zero;
+            case SDL_SCANCODE_DOWN:
+                send_command(CMD_THRUST, IDLE, 0.0);
                 break;
-            }
             default:
                 break;
         }
@@ -289,7 +768,7 @@ static void handle_key_event(const SDL_Event *ev, int press_down) {
 }
 
 static void resized(int w, int h) {
-    glViewport(0, 0, 1000, 1000);
+    glViewport(0, 0, VIEW_PIXELS, VIEW_PIXELS);
 }
 
 static void handle_window_event(SDL_Event *ev) {
@@ -301,6 +780,9 @@ static void handle_window_event(SDL_Event *ev) {
         printf("New window size: %dx%d\n", w, h);
 
         resized(w, h);
+        scene_dirty = 1;
+    } else if (type == SDL_WINDOWEVENT_EXPOSED) {
+        scene_dirty = 1;
     }
 }
 
@@ -327,114 +809,209 @@ static void handle_events(int *close) {
     }
 }
 
-static double mag(struct vector v) {
-    return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
-}
+static void sync_state() {
+    int fresh;
+    const struct sim_state *latest = tb_read(&state_buffer, &fresh);
+    if (!fresh) {
+        return;
+    }
+
+    struct sim_state *swap = prev_state;
+    prev_state = cur_state;
+    cur_state = swap;
+    memcpy(cur_state, latest, snapshot_size);
+
+    // Never interpolate across a reset
+    if (prev_state->n_bodies == 0 || prev_state->epoch != cur_state->epoch) {
+        memcpy(prev_state, cur_state, snapshot_size);
+    }
 
-static struct vector cross(struct vector a, struct vector b) {
-    struct vector result = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
-    return result;
+    if (cur_state->epoch > trail_epoch) {
+        clear_trail(&trail);
+        trail_epoch = cur_state->epoch;
+        scene_dirty = 1;
+    }
 }
 
-static void update() {
-    struct body *rocket = bodies + 1;
-
-    switch (cur_dir) {
-        case LEFT: {
-            struct vector vel = rocket->vel;
-            struct vector axis = {0.0, 0.0, 1.0};
-            struct vector cx = cross(vel, axis);
-            double cx_mag = mag(cx);
-            
-            struct vector thrust = {-F9_2_THRUST * cx.x / cx_mag, -F9_2_THRUST * cx.y / cx_mag, -F9_2_THRUST * cx.z / cx_mag};
-            rocket->F_net_ext = thrust;
+static void update_trail() {
+    struct trail_point point;
+    while (spsc_pop(&trail_queue, &point)) {
+        if (point.epoch < trail_epoch) {
+            continue;
+        }
 
-            break;
+        if (point.epoch > trail_epoch) {
+            clear_trail(&trail);
+            trail_epoch = point.epoch;
         }
-        case UP: {
-            struct vector vel = rocket->vel;
-            double v = mag(vel);
 
-            struct vector thrust = {F9_2_THRUST * vel.x / v, F9_2_THRUST * vel.y / v, F9_2_THRUST * vel.z / v};
-            rocket->F_net_ext = thrust;
+        push_trail(&trail, point.pos);
+    }
+}
 
-            break;
-        }
-        case RIGHT: {
-            struct vector vel = rocket->vel;
-            struct vector axis = {0.0, 0.0, 1.0};
-            struct vector cx = cross(vel, axis);
-            double cx_mag = mag(cx);
+/*
+ * Appended vertices are streamed as they come, along with the
+ * newest one uploaded last time, which may have moved since. A
+ * mirror that fell a whole ring behind, or missed a clear, is
+ * uploaded again in full.
+ */
+static void sync_trail_mirror(int k) {
+    struct trail_mirror *mirror = trail_mirrors + k;
+    const struct trail_level *level = trail.levels + k;
+
+    long first = level->n_appended - level->count;
+    if (mirror->generation == trail.generation && mirror->n_uploaded - 1 > first) {
+        first = mirror->n_uploaded - 1;
+    }
 
-            struct vector thrust = {F9_2_THRUST * cx.x / cx_mag, F9_2_THRUST * cx.y / cx_mag, F9_2_THRUST * cx.z / cx_mag};
-            rocket->F_net_ext = thrust;
+    for (long i = first; i < level->n_appended; ++i) {
+        int slot = (int) (i % level->cap);
+        const struct vector *pos = level->points + slot;
+        stream_point_2f(&mirror->shader, slot, (float) (SCALE * pos->x), (float) (SCALE * pos->y));
+    }
 
-            break;
-        }
-        case DOWN: {
-            struct vector vel = rocket->vel;
-            double v = mag(vel);
+    mirror->generation = trail.generation;
+    mirror->n_uploaded = level->n_appended;
+}
 
-            struct vector thrust = {-F9_2_THRUST * vel.x / v, -F9_2_THRUST * vel.y / v, -F9_2_THRUST * vel.z / v};
-            rocket->F_net_ext = thrust;
+// Only the levels drawn at the current zoom are uploaded
+static void upload_trail() {
+    double metres_per_px = 2.0 / (VIEW_PIXELS * SCALE * zoom);
+    int finest = trail_level_for(&trail, TRAIL_MAX_ERROR_PX * metres_per_px);
 
-            break;
-        }
-        default:
-            break;
+    n_trail_spans = trail_spans(&trail, finest, trail_spans_drawn);
+    for (int i = 0; i < n_trail_spans; ++i) {
+        sync_trail_mirror(trail_spans_drawn[i].level);
+    }
+}
+
+static void update_prediction() {
+    int fresh;
+    const struct prediction *prediction = read_prediction(&predictor, &fresh);
+    if (!fresh) {
+        return;
     }
 
-    recompute_system(5, 2, bodies);
-    
-    int idx = pos_buf_idx;
-    pos_buf[idx] = rocket->pos;
+    for (int i = 0; i < prediction->n_points; ++i) {
+        predict_buf[2 * i] = (float) (SCALE * prediction->pos[i].x);
+        predict_buf[2 * i + 1] = (float) (SCALE * prediction->pos[i].y);
+    }
+    buffer_data_2f(&predict_shader, prediction->n_points, 2 * prediction->n_points * sizeof(float), predict_buf);
+    scene_dirty = 1;
+}
 
-    if (pos_buf_idx < POS_BUF_SIZE - 1) {
-        pos_buf_idx++;
-    } else {
-        memmove(pos_buf, pos_buf + 1, (POS_BUF_SIZE - 1) * sizeof(*pos_buf));
+static void update() {
+    sync_state();
+    update_trail();
+    upload_trail();
+    update_prediction();
+}
+
+/*
+ * Renders one tick behind the physics so that there are
+ * normally two snapshots to interpolate between.
+ */
+static double interpolation_alpha() {
+    long long span = cur_state->wall_ns - prev_state->wall_ns;
+    if (span <= 0) {
+        return 1.0;
     }
 
-    int n_pos = idx + 1;
-    int len = 2 * n_pos * sizeof(float);
-    float *points = malloc(len);
-    for (int pos_idx = 0, points_idx = 0; pos_idx < n_pos; ++pos_idx, points_idx += 2) {
-        struct vector pos = pos_buf[pos_idx];
-        points[points_idx] = SCALE * pos.x;
-        points[points_idx + 1] = SCALE * pos.y;
+    long long target = pacer_now_ns() - LOOP_DURATION_MS * NS_PER_MS;
+    double alpha = (double) (target - prev_state->wall_ns) / span;
+    return alpha < 0.0 ? 0.0 : alpha > 1.0 ? 1.0 : alpha;
+}
+
+static struct body interpolate_body(int idx, double alpha) {
+    struct body a = prev_state->bodies[idx];
+    struct body b = cur_state->bodies[idx];
+
+    b.pos.x = a.pos.x + (b.pos.x - a.pos.x) * alpha;
+    b.pos.y = a.pos.y + (b.pos.y - a.pos.y) * alpha;
+    b.pos.z = a.pos.z + (b.pos.z - a.pos.z) * alpha;
+    b.vel.x = a.vel.x + (b.vel.x - a.vel.x) * alpha;
+    b.vel.y = a.vel.y + (b.vel.y - a.vel.y) * alpha;
+    b.vel.z = a.vel.z + (b.vel.z - a.vel.z) * alpha;
+    return b;
+}
+
+/*
+ * Places every body for this frame and returns how far, in
+ * pixels, the one that moved most has gone since the last
+ * frame that was drawn.
+ */
+static double place_instances() {
+    double alpha = interpolation_alpha();
+    double moved = 0.0;
+    for (int i = 1; i < cur_state->n_bodies; ++i) {
+        struct body body = interpolate_body(i, alpha);
+        int controlled = i == cur_state->controlled;
+
+        // Noses point along the velocity
+        struct gl_instance *instance = instances + i - 1;
+        instance->x = (float) (SCALE * zoom * body.pos.x);
+        instance->y = (float) (SCALE * zoom * body.pos.y);
+        instance->angle = (float) atan2(-body.vel.x, body.vel.y);
+        instance->size = use_point_sprites ? (controlled ? 2.0F : 1.0F) * POINT_SIZE : 1.0F;
+        memcpy(instance->color, controlled ? CONTROLLED_COLOR : BODY_COLOR, sizeof(instance->color));
+
+        const struct gl_instance *drawn = drawn_instances + i - 1;
+        double turn = fabs(remainder(instance->angle - drawn->angle, TWO_PI)) * ROCKET_EXTENT;
+        double shift = fmax(fabs(instance->x - drawn->x), fabs(instance->y - drawn->y));
+        moved = fmax(moved, fmax(shift, turn));
     }
 
-    buffer_data_2f(&path_shader, n_pos, len, points);
-    free(points);
+    return moved * VIEW_PIXELS / 2.0;
+}
+
+/*
+ * Drawing and swapping are skipped while the picture would
+ * come out the same, which on an idle display is most frames.
+ */
+static int scene_changed() {
+    if (cur_state->n_bodies == 0) {
+        return scene_dirty;
+    }
+
+    double moved = place_instances();
+    return scene_dirty || show_overlay || cur_state->dir != drawn_dir || moved >= MIN_VISIBLE_PX;
 }
 
 static void render() {
     glClear(GL_COLOR_BUFFER_BIT);
+    scene_dirty = 0;
+    if (cur_state->n_bodies == 0) {
+        return;
+    }
 
     draw_shader_arrays(&circle_shader, GL_TRIANGLE_FAN);
-    draw_shader_arrays(&path_shader, GL_LINE_STRIP);
-
-    mat4 rocket_transform;
-    glm_mat4_identity(rocket_transform);
+    for (int i = 0; i < n_trail_spans; ++i) {
+        const struct trail_span *span = trail_spans_drawn + i;
+        draw_ring_strip(&trail_mirrors[span->level].shader, span->first, span->count);
+    }
+    draw_shader_arrays(&predict_shader, GL_LINE_STRIP);
 
-    struct body rocket = bodies[1];
-    vec3 rocket_translation = {SCALE * rocket.pos.x, SCALE * rocket.pos.y, SCALE * rocket.pos.z};
-    glm_translate(rocket_transform, rocket_translation);
+    int n_instances = cur_state->n_bodies - 1;
+    memcpy(drawn_instances, instances, n_instances * sizeof(*instances));
+    drawn_dir = cur_state->dir;
 
-    vec3 zero_v_rot = {0.0F, 1.0F, 0.0F};
-    vec3 vel = {rocket.vel.x, rocket.vel.y, rocket.vel.z};
-    float angle = glm_vec3_angle(zero_v_rot, vel);
-    if (zero_v_rot[0] < vel[0]) {
-        angle = -angle;
+    struct gl_shader_wrapper *body_shader = use_point_sprites ? &point_shader : &rocket_shader;
+    if (update_instances(body_shader, cur_state->n_bodies - 1, instances)) {
+        draw_instances(body_shader, GL_POLYGON);
     }
 
-    vec3 rot_axis = {0.0F, 0.0F, 1.0F};
-    glm_rotate(rocket_transform, angle, rot_axis);
+    enum direction cur_dir = cur_state->dir;
+    if (cur_state->controlled && cur_dir != IDLE) {
+        const struct gl_instance rocket = instances[cur_state->controlled - 1];
+        mat4 rocket_transform;
+        glm_mat4_identity(rocket_transform);
+
+        vec3 rocket_translation = {rocket.x, rocket.y, 0.0F};
+        glm_translate(rocket_transform, rocket_translation);
 
-    set_transform(&rocket_shader, &rocket_transform);
-    draw_shader_arrays(&rocket_shader, GL_POLYGON);
+        vec3 rot_axis = {0.0F, 0.0F, 1.0F};
+        glm_rotate(rocket_transform, rocket.angle, rot_axis);
 
-    if (cur_dir != IDLE) {
         mat4 flame_transform;
         glm_mat4_copy(rocket_transform, flame_transform);
 
@@ -461,41 +1038,184 @@ static void render() {
                 break;
         }
 
-        set_transform(&flame_shader, &flame_transform);
+        set_shader_transform(&flame_shader, (float *) flame_transform);
         draw_shader_arrays(&flame_shader, GL_TRIANGLES);
     }
 }
 
+static void overlay_bar(int row, long long ns, float *quad) {
+    float x1 = OVERLAY_X + OVERLAY_WIDTH * (float) ns / (2.0F * LOOP_DURATION_MS * NS_PER_MS);
+    if (x1 > OVERLAY_X + OVERLAY_WIDTH) {
+        x1 = OVERLAY_X + OVERLAY_WIDTH;
+    }
+    float y0 = OVERLAY_Y + row * (OVERLAY_ROW_HEIGHT + OVERLAY_ROW_GAP);
+    float y1 = y0 + OVERLAY_ROW_HEIGHT;
+
+    float corners[] = {
+            OVERLAY_X, y0, x1, y0, x1, y1,
+            OVERLAY_X, y0, x1, y1, OVERLAY_X, y1
+    };
+    memcpy(quad, corners, sizeof(corners));
+}
+
+/*
+ * One bar per phase, as long as its p99 over the last
+ * PROFILER_WINDOW samples, with a white tick at the p50. The
+ * vertical line is the frame budget. The physics thread's
+ * figures are read through the atomics it republishes.
+ */
+static void render_overlay() {
+    const struct profile_phase *rows[OVERLAY_ROWS] = {
+            render_prof.phases + PHASE_EVENTS, render_prof.phases + PHASE_UPLOAD,
+            render_prof.phases + PHASE_RENDER, render_prof.phases + PHASE_SWAP,
+            physics_prof.phases + PHASE_STEP, render_prof.phases + PHASE_FRAME
+    };
+
+    float marks[4 * (OVERLAY_ROWS + 1)];
+    for (int i = 0; i < OVERLAY_ROWS; ++i) {
+        long long p50 = atomic_load_explicit(&rows[i]->p50_ns, memory_order_relaxed);
+        long long p99 = atomic_load_explicit(&rows[i]->p99_ns, memory_order_relaxed);
+
+        float quad[12];
+        overlay_bar(i, p99, quad);
+        buffer_data_2f(overlay_bars + i, 6, sizeof(quad), quad);
+        draw_shader_arrays(overlay_bars + i, GL_TRIANGLES);
+
+        overlay_bar(i, p50, quad);
+        float *mark = marks + 4 * i;
+        mark[0] = quad[2];
+        mark[1] = quad[3];
+        mark[2] = quad[4];
+        mark[3] = quad[5];
+    }
+
+    float *deadline = marks + 4 * OVERLAY_ROWS;
+    deadline[0] = OVERLAY_X + OVERLAY_WIDTH / 2.0F;
+    deadline[1] = OVERLAY_Y - OVERLAY_ROW_GAP;
+    deadline[2] = deadline[0];
+    deadline[3] = OVERLAY_Y + OVERLAY_ROWS * (OVERLAY_ROW_HEIGHT + OVERLAY_ROW_GAP);
+
+    buffer_data_2f(&overlay_marks, 2 * (OVERLAY_ROWS + 1), sizeof(marks), marks);
+    draw_shader_arrays(&overlay_marks, GL_LINES);
+}
+
+/*
+ * Every phase of the frame is timed on the monotonic clock,
+ * one clock read per phase boundary. Frames start on absolute
+ * deadlines one period apart. With vsync the swap itself waits
+ * for the display, so the next frame starts straight away and
+ * the deadlines, which only pace skipped frames, follow the
+ * swaps.
+ */
 static void run_process_loop(SDL_Window *win) {
+    long long period_ns = LOOP_DURATION_MS * NS_PER_MS;
+    SDL_DisplayMode mode;
+    if (use_vsync && SDL_GetWindowDisplayMode(win, &mode) == 0 && mode.refresh_rate > 0) {
+        period_ns = MS_PER_SEC * NS_PER_MS / mode.refresh_rate;
+    }
+    init_pacer(period_ns, &frame_pacer);
+
     while (1) {
-        struct timespec begin;
-        clock_gettime(CLOCK_REALTIME, &begin);
+        long long begin = pacer_now_ns();
 
         int close = 0;
         handle_events(&close);
+        long long t = profile_mark(&render_prof, PHASE_EVENTS, begin);
 
-        if (close) {
+        if (close || !atomic_load(&physics_running)) {
             break;
         }
 
         update();
-        render();
-        SDL_GL_SwapWindow(win);
+        t = profile_mark(&render_prof, PHASE_UPLOAD, t);
+
+        n_frames++;
+        int drawn = scene_changed();
+        if (drawn) {
+            render();
+            if (show_overlay) {
+                render_overlay();
+            }
+            t = profile_mark(&render_prof, PHASE_RENDER, t);
 
-        struct timespec end;
-        clock_gettime(CLOCK_REALTIME, &end);
+            SDL_GL_SwapWindow(win);
+            t = profile_mark(&render_prof, PHASE_SWAP, t);
+            n_drawn_frames++;
+        }
 
-        long elapsed = ((end.tv_sec - begin.tv_sec) * MS_PER_SEC) +
-                       ((end.tv_nsec - begin.tv_nsec) / NS_PER_MS);
-        long delay = LOOP_DURATION_MS - elapsed;
-        if (delay <= 0) {
+        long long elapsed = t - begin;
+        profile_record(&render_prof, PHASE_FRAME, begin, t);
+        if (elapsed > period_ns) {
+            n_late_frames++;
+        }
+
+        if (drawn && use_vsync) {
+            align_pacer(&frame_pacer, t);
             continue;
         }
-        SDL_Delay(delay);
+        wait_pacer(&frame_pacer);
+        profile_mark(&render_prof, PHASE_SLEEP, t);
     }
 }
 
-int main() {
+static int parse_args(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:i:s:n:r:c:T:P:L:V")) != -1) {
+        switch (opt) {
+            case 't':
+                n_threads = atoi(optarg);
+                if (n_threads < 1) {
+                    fprintf(stderr, "Thread count must be at least 1\n");
+                    return 0;
+                }
+                break;
+            case 'i':
+                integrator = find_integrator(optarg);
+                if (!integrator) {
+                    fprintf(stderr, "Unknown integrator '%s'\n", optarg);
+                    return 0;
+                }
+                break;
+            case 's':
+                scenario_name = optarg;
+                break;
+            case 'n':
+                n_scenario_bodies = atoi(optarg);
+                break;
+            case 'r':
+                resume_path = optarg;
+                break;
+            case 'c':
+                checkpoint_path = optarg;
+                break;
+            case 'T':
+                trajectory_path = optarg;
+                break;
+            case 'P':
+                trace_path = optarg;
+                break;
+            case 'L':
+                input_log_path = optarg;
+                break;
+            case 'V':
+                use_vsync = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t threads] [-i euler|leapfrog|yoshida4|rk45|hermite] [-s leo|debris|constellation|file]\n"
+                                "          [-n bodies] [-r resume.snap] [-c checkpoint.snap] [-T trajectory.bin|.csv]\n"
+                                "          [-P trace.json] [-L input.log] [-V]\n", argv[0]);
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (!parse_args(argc, argv)) {
+        return EXIT_FAILURE;
+    }
+
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
         return EXIT_FAILURE;
@@ -518,22 +1238,50 @@ int main() {
     }
     printf("Initialized OpenGL\n");
 
+    if (!init_profiling()) {
+        return EXIT_FAILURE;
+    }
+
+    // The instance buffers are sized by the scenario
+    if (!init_system()) {
+        return EXIT_FAILURE;
+    }
+    printf("Initialized system\n");
+
     if (!init_graphics()) {
         return EXIT_FAILURE;
     }
     printf("Initialized graphics\n");
 
-    init_system();
-    printf("Initialized system\n");
+    atomic_store(&physics_running, 1);
+    SDL_Thread *physics = SDL_CreateThread(run_physics, "physics", NULL);
+    if (!physics) {
+        fprintf(stderr, "Failed to start the physics thread: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
 
     resized(initial_w, initial_h);
     run_process_loop(win);
 
+    atomic_store(&physics_running, 0);
+    int physics_status;
+    SDL_WaitThread(physics, &physics_status);
+
+    // A failed step may have left the bodies half-advanced, so the last good checkpoint is kept
+    int checkpointed = 1;
+    if (checkpoint_path) {
+        if (physics_status == 0) {
+            submit_snapshot(&checkpoints, sim.time, sim.step, sim.bodies);
+        }
+        checkpointed = close_snapshot_writer(&checkpoints);
+    }
+
     destroy_system();
     destroy_graphics();
+    destroy_profiling();
 
     SDL_DestroyWindow(win);
     SDL_Quit();
 
-    return EXIT_SUCCESS;
+    return physics_status == 0 && checkpointed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
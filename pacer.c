@@ -0,0 +1,43 @@
+#include "pacer.h"
+
+#include <time.h>
+#include <errno.h>
+
+static const long long NS_PER_SEC = 1000000000LL;
+
+long long pacer_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+void init_pacer(long long period_ns, struct pacer *out) {
+    struct pacer pacer = {period_ns, 0, 0};
+    *out = pacer;
+
+    align_pacer(out, pacer_now_ns());
+}
+
+void align_pacer(struct pacer *pacer, long long at_ns) {
+    pacer->next_ns = at_ns + pacer->period_ns;
+}
+
+long long wait_pacer(struct pacer *pacer) {
+    long long deadline = pacer->next_ns;
+    long long now = pacer_now_ns();
+    if (now >= deadline) {
+        long long behind = (now - deadline) / pacer->period_ns + 1;
+        pacer->n_missed += behind;
+        pacer->next_ns += behind * pacer->period_ns;
+        return now;
+    }
+
+    struct timespec ts = {deadline / NS_PER_SEC, deadline % NS_PER_SEC};
+    int ec;
+    do {
+        ec = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    } while (ec == EINTR);
+
+    pacer->next_ns += pacer->period_ns;
+    return pacer_now_ns();
+}
@@ -0,0 +1,32 @@
+#ifndef ORBITAL_PACER_H
+#define ORBITAL_PACER_H
+
+/*
+ * Deadlines on CLOCK_MONOTONIC, period_ns apart. Each one is
+ * the previous deadline plus the period rather than the wake
+ * time plus the period, so sleeping late never shifts the
+ * schedule. Deadlines already missed are skipped, not run back
+ * to back.
+ */
+struct pacer {
+    long long period_ns;
+    long long next_ns;
+    // Deadlines that had already passed when a wait began
+    long n_missed;
+};
+
+// CLOCK_MONOTONIC in nanoseconds, the clock every timer in the program reads
+long long pacer_now_ns();
+
+void init_pacer(long long period_ns, struct pacer *out);
+
+// Moves the schedule so that the next deadline is one period after at_ns, e.g. a vblank
+void align_pacer(struct pacer *pacer, long long at_ns);
+
+/*
+ * Sleeps until the next deadline with an absolute
+ * clock_nanosleep and returns the time it woke at.
+ */
+long long wait_pacer(struct pacer *pacer);
+
+#endif // ORBITAL_PACER_H
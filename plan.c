@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include "system.h"
+#include "integrator.h"
+#include "scenario.h"
+#include "scenario_file.h"
+#include "planner.h"
+
+static const double NS_PER_SEC = 1000000000.0;
+static const double DEG_TO_RAD = 3.141592653589793 / 180.0;
+
+struct plan_cli {
+    const char *scenario;
+    const char *out_path;
+    int n_threads;
+    struct plan_target target;
+    struct plan_opts plan;
+};
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -a target_sma [-e target_ecc] [-I target_inc_deg] [-s leo|file] [-b body]\n"
+                    "          [-c candidates] [-g iterations] [-H horizon_sec] [-d dt] [-i integrator]\n"
+                    "          [-f thrust] [-t threads] [-o plan.txt]\n", prog);
+}
+
+static int parse_args(int argc, char **argv, struct plan_cli *cli) {
+    int opt;
+    while ((opt = getopt(argc, argv, "a:e:I:s:b:c:g:H:d:i:f:t:o:")) != -1) {
+        switch (opt) {
+            case 'a':
+                cli->target.a = atof(optarg);
+                break;
+            case 'e':
+                cli->target.e = atof(optarg);
+                break;
+            case 'I':
+                cli->target.inclination = atof(optarg) * DEG_TO_RAD;
+                break;
+            case 's':
+                cli->scenario = optarg;
+                break;
+            case 'b':
+                cli->plan.body = atoi(optarg);
+                break;
+            case 'c':
+                cli->plan.n_candidates = atoi(optarg);
+                break;
+            case 'g':
+                cli->plan.n_iterations = atoi(optarg);
+                break;
+            case 'H':
+                cli->plan.horizon = atof(optarg);
+                break;
+            case 'd':
+                cli->plan.dt = atof(optarg);
+                break;
+            case 'i':
+                cli->plan.integrator = find_integrator(optarg);
+                if (!cli->plan.integrator) {
+                    fprintf(stderr, "Unknown integrator '%s'\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'f':
+                cli->plan.thrust = atof(optarg);
+                break;
+            case 't':
+                cli->n_threads = atoi(optarg);
+                break;
+            case 'o':
+                cli->out_path = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return 0;
+        }
+    }
+
+    if (cli->target.a <= 0.0 || cli->n_threads < 1) {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Plans a two-burn transfer of one body to a target orbit and
+ * writes the scenario together with the burns, so that running
+ * the viewer or orbital_batch on the output flies the plan.
+ */
+int main(int argc, char **argv) {
+    struct plan_cli cli = {
+            "leo", "plan.txt", 1,
+            {0.0, 0.0, -1.0},
+            {0, 0.0, 0.0, 0.0, 0.0, 0, 0, 0.0, NULL}
+    };
+    init_plan_opts(&cli.plan);
+    if (!parse_args(argc, argv, &cli)) {
+        return EXIT_FAILURE;
+    }
+
+    struct thread_pool pool;
+    if (!init_thread_pool(cli.n_threads, &pool)) {
+        fprintf(stderr, "Failed to start the thread pool\n");
+        return EXIT_FAILURE;
+    }
+
+    struct scenario scenario;
+    if (is_builtin_scenario(cli.scenario) ? !init_scenario(cli.scenario, 2, &scenario)
+                                          : !load_scenario_file(cli.scenario, &pool, &scenario)) {
+        return EXIT_FAILURE;
+    }
+
+    // The plan replaces any burns the scenario came with
+    destroy_burn_schedule(&scenario.burns);
+    init_burn_schedule(&scenario.burns);
+
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    struct plan_stats stats;
+    int ok = plan_maneuver(&pool, &cli.plan, &cli.target, scenario.n_bodies, scenario.bodies, &scenario.burns,
+                           &stats);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double wall = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / NS_PER_SEC;
+
+    if (ok) {
+        printf("iterations=%d evaluated=%ld pruned=%ld cached_coast_steps=%ld wall=%.3fs threads=%d\n",
+               stats.n_iterations, stats.n_evaluated, stats.n_pruned, stats.n_cached_steps, wall, cli.n_threads);
+        printf("error=%.3e delta_v=%.3fm/s\n", stats.error, stats.delta_v);
+        for (int k = 0; k < scenario.burns.n_burns; ++k) {
+            const struct burn *burn = scenario.burns.burns + k;
+            printf("burn body=%d start=%.3fs duration=%.3fs prograde=%.1fN normal=%.1fN radial=%.1fN\n",
+                   burn->body, burn->start, burn->duration, burn->force.x, burn->force.y, burn->force.z);
+        }
+
+        ok = save_scenario_file(cli.out_path, &scenario);
+    }
+
+    destroy_scenario(&scenario);
+    destroy_thread_pool(&pool);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
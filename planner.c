@@ -0,0 +1,495 @@
+#include "planner.h"
+
+#include "kepler.h"
+#include "scenario.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const double TWO_PI = 6.283185307179586;
+static const double MIN_ALTITUDE = 100000.0;
+// Delta-v, relative to the starting orbital speed, only breaks ties between equally accurate plans
+static const double FUEL_WEIGHT = 0.001;
+// Added to the error of orbits that escape or dip below min_periapsis so they still rank
+static const double INVALID_ERROR = 10.0;
+// Burn 2 itself moves the body, so the reach bound only counts half the gap
+static const double REACH_MARGIN = 0.5;
+static const double ELITE_FRACTION = 0.1;
+static const double SMOOTHING = 0.7;
+
+enum plan_param {
+    P_START,
+    P_DURATION1,
+    P_PITCH1,
+    P_YAW1,
+    P_COAST,
+    P_DURATION2,
+    P_PITCH2,
+    P_YAW2,
+    N_PARAMS
+};
+
+struct candidate {
+    double p[N_PARAMS];
+    double cost;
+    double error;
+    double delta_v;
+    int pruned;
+};
+
+/*
+ * Test particles other than the planned body neither pull on it
+ * nor feel it, so candidates only carry body 0, the massive
+ * bodies and the planned body, which is body in that reduced
+ * system.
+ *
+ * The coast of the unburnt system from time 0 is simulated
+ * once, on the dt grid up to the horizon, so a candidate starts
+ * from the cached state at its first burn and no candidate
+ * repeats the shared prefix. Each candidate has its own state
+ * and workspace, so candidates run in parallel without locks.
+ */
+struct planner {
+    const struct plan_opts *opts;
+    const struct plan_target *target;
+    int n_bodies;
+    int body;
+    double mu;
+    double mass;
+    double speed;
+    double horizon;
+
+    long n_coast;
+    struct body *coast;
+
+    struct candidate *candidates;
+    struct body *scratch;
+    struct system_workspace *ws;
+    int n_ws;
+
+    // Candidates bound to cost at least this much are dropped without finishing them
+    double threshold;
+};
+
+void init_plan_opts(struct plan_opts *out) {
+    out->body = 1;
+    out->thrust = F9_2_THRUST;
+    out->dt = 5.0;
+    out->horizon = 0.0;
+    out->min_periapsis = EARTH_RAD + MIN_ALTITUDE;
+    out->n_candidates = 256;
+    out->n_iterations = 40;
+    out->tolerance = 1e-4;
+    out->integrator = &INTEGRATOR_YOSHIDA4;
+}
+
+// splitmix64, so every run samples the same candidates
+static double next_uniform(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return ((z >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static double next_gaussian(unsigned long long *state) {
+    double u = next_uniform(state);
+    double v = next_uniform(state);
+    return sqrt(-2.0 * log(u)) * cos(TWO_PI * v);
+}
+
+static int osculating(const struct planner *pl, const struct body *bodies, struct orbital_elements *out) {
+    const struct body *body = bodies + pl->body;
+    struct vector r = {body->pos.x - bodies->pos.x, body->pos.y - bodies->pos.y, body->pos.z - bodies->pos.z};
+    struct vector v = {body->vel.x - bodies->vel.x, body->vel.y - bodies->vel.y, body->vel.z - bodies->vel.z};
+    return state_to_elements(pl->mu, r, v, out);
+}
+
+// Periapsis and apoapsis errors relative to the target's semi-major axis
+static double orbit_error(const struct planner *pl, const struct orbital_elements *el) {
+    const struct plan_target *target = pl->target;
+    if (el->e >= 1.0) {
+        return INVALID_ERROR + el->e;
+    }
+
+    double rp = el->p / (1.0 + el->e);
+    double ra = el->p / (1.0 - el->e);
+    double error = (fabs(rp - target->a * (1.0 - target->e)) + fabs(ra - target->a * (1.0 + target->e))) / target->a;
+    if (target->inclination >= 0.0) {
+        error += fabs(el->i - target->inclination);
+    }
+    if (rp < pl->opts->min_periapsis) {
+        error += INVALID_ERROR;
+    }
+
+    return error;
+}
+
+/*
+ * Burn 2 starts somewhere on the orbit left by burn 1, and the
+ * final orbit passes through that point, so a target entirely
+ * above or below the intermediate orbit cannot be met closer
+ * than the gap between them.
+ */
+static double reach_bound(const struct planner *pl, const struct orbital_elements *mid) {
+    if (mid->e >= 1.0) {
+        return 0.0;
+    }
+
+    const struct plan_target *target = pl->target;
+    double rp = mid->p / (1.0 + mid->e);
+    double ra = mid->p / (1.0 - mid->e);
+    double gap = fmax(0.0, fmax(rp - target->a * (1.0 + target->e), target->a * (1.0 - target->e) - ra));
+    return REACH_MARGIN * gap / target->a;
+}
+
+static void make_burns(const struct planner *pl, const double *p, int body, struct burn burns[2]) {
+    double start[2] = {p[P_START], p[P_START] + p[P_DURATION1] + p[P_COAST]};
+    const double *params[2] = {p + P_DURATION1, p + P_DURATION2};
+
+    for (int k = 0; k < 2; ++k) {
+        double duration = params[k][0];
+        double pitch = params[k][1];
+        double yaw = params[k][2];
+        double f = pl->opts->thrust;
+        struct burn burn = {
+                body, BURN_ORBIT, start[k], duration,
+                {f * cos(yaw) * cos(pitch), f * sin(yaw), f * cos(yaw) * sin(pitch)}
+        };
+        burns[k] = burn;
+    }
+}
+
+// Steps with the burns applied until the step that contains until has been taken
+static int step_until(const struct planner *pl, struct system_workspace *ws, struct burn_schedule *schedule,
+                      struct body *bodies, long *step, double until) {
+    double dt = pl->opts->dt;
+    while (*step * dt < until) {
+        apply_burns(schedule, *step * dt, dt, pl->n_bodies, bodies);
+        if (!recompute_system(ws, dt, pl->n_bodies, bodies)) {
+            return 0;
+        }
+        (*step)++;
+    }
+
+    return 1;
+}
+
+// A coasting two-body system jumps straight to the end analytically
+static int coast_steps(const struct planner *pl, struct system_workspace *ws, struct burn_schedule *schedule,
+                       struct body *bodies, long *step, long n_steps) {
+    double dt = pl->opts->dt;
+    if (n_steps <= 0) {
+        return 1;
+    }
+
+    apply_burns(schedule, *step * dt, n_steps * dt, pl->n_bodies, bodies);
+    if (is_analytic_coast(pl->n_bodies, bodies)) {
+        *step += n_steps;
+        return advance_system(ws, n_steps * dt, pl->n_bodies, bodies);
+    }
+
+    return step_until(pl, ws, schedule, bodies, step, (*step + n_steps) * dt);
+}
+
+static void evaluate_candidate(struct planner *pl, int c) {
+    struct candidate *cand = pl->candidates + c;
+    double dt = pl->opts->dt;
+    int n = pl->n_bodies;
+
+    cand->delta_v = (cand->p[P_DURATION1] + cand->p[P_DURATION2]) * pl->opts->thrust / pl->mass;
+    double fuel = FUEL_WEIGHT * cand->delta_v / pl->speed;
+    cand->error = INFINITY;
+    cand->cost = INFINITY;
+    cand->pruned = 1;
+    if (fuel >= pl->threshold) {
+        return;
+    }
+
+    struct burn burns[2];
+    make_burns(pl, cand->p, pl->body, burns);
+    struct burn_schedule schedule = {2, 2, burns, 0, 0.0};
+
+    long step = (long) (burns[0].start / dt);
+    if (step > pl->n_coast) {
+        step = pl->n_coast;
+    }
+
+    struct body *bodies = pl->scratch + (size_t) c * n;
+    struct system_workspace *ws = pl->ws + c;
+    memcpy(bodies, pl->coast + (size_t) step * n, n * sizeof(struct body));
+
+    struct orbital_elements el;
+    if (!step_until(pl, ws, &schedule, bodies, &step, burns[0].start + burns[0].duration) ||
+        !osculating(pl, bodies, &el) || reach_bound(pl, &el) + fuel >= pl->threshold) {
+        return;
+    }
+
+    long n_coast = (long) floor(burns[1].start / dt) - step;
+    if (!coast_steps(pl, ws, &schedule, bodies, &step, n_coast) ||
+        !step_until(pl, ws, &schedule, bodies, &step, burns[1].start + burns[1].duration) ||
+        !osculating(pl, bodies, &el)) {
+        return;
+    }
+
+    cand->error = orbit_error(pl, &el);
+    cand->cost = cand->error + fuel;
+    cand->pruned = 0;
+}
+
+static void evaluate_task(void *arg, int begin, int end) {
+    struct planner *pl = arg;
+    for (int c = begin; c < end; ++c) {
+        evaluate_candidate(pl, c);
+    }
+}
+
+static int compare_candidates(const void *a, const void *b) {
+    const struct candidate *x = a;
+    const struct candidate *y = b;
+    if (x->cost != y->cost) {
+        return x->cost < y->cost ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Centred on a Hohmann transfer from the current radius to the
+ * target's semi-major axis, started anywhere within the horizon.
+ */
+static void seed_search(const struct planner *pl, double r0, double *mean, double *sigma) {
+    double a_t = pl->target->a;
+    double a_tr = (r0 + a_t) / 2.0;
+    double dv1 = sqrt(pl->mu * (2.0 / r0 - 1.0 / a_tr)) - pl->speed;
+    double dv2 = sqrt(pl->mu / a_t) - sqrt(pl->mu * (2.0 / a_t - 1.0 / a_tr));
+    double accel = pl->opts->thrust / pl->mass;
+    double dt = pl->opts->dt;
+    double yaw_sigma = pl->target->inclination >= 0.0 ? 0.5 : 0.0;
+
+    double d1 = fabs(dv1) / accel;
+    double d2 = fabs(dv2) / accel;
+    double coast = fmax(0.0, M_PI * sqrt(a_tr * a_tr * a_tr / pl->mu) - (d1 + d2) / 2.0);
+
+    double means[N_PARAMS] = {
+            pl->horizon / 2.0, d1, dv1 < 0.0 ? M_PI : 0.0, 0.0, coast, d2, dv2 < 0.0 ? M_PI : 0.0, 0.0
+    };
+    double sigmas[N_PARAMS] = {
+            pl->horizon / 2.0, 0.3 * d1 + dt, 0.3, yaw_sigma, 0.2 * coast + dt, 0.3 * d2 + dt, 0.3, yaw_sigma
+    };
+    memcpy(mean, means, sizeof(means));
+    memcpy(sigma, sigmas, sizeof(sigmas));
+}
+
+static void sample_candidate(const struct planner *pl, const double *mean, const double *sigma,
+                             unsigned long long *seed, struct candidate *out) {
+    for (int i = 0; i < N_PARAMS; ++i) {
+        out->p[i] = mean[i] + sigma[i] * next_gaussian(seed);
+    }
+
+    out->p[P_START] = fmin(fmax(out->p[P_START], 0.0), pl->horizon);
+    out->p[P_DURATION1] = fmax(out->p[P_DURATION1], 0.0);
+    out->p[P_COAST] = fmax(out->p[P_COAST], 0.0);
+    out->p[P_DURATION2] = fmax(out->p[P_DURATION2], 0.0);
+}
+
+// Moves the search distribution towards the mean and spread of the n_elite best candidates
+static void refit(const struct candidate *elite, int n_elite, double *mean, double *sigma) {
+    for (int i = 0; i < N_PARAMS; ++i) {
+        double sum = 0.0;
+        for (int k = 0; k < n_elite; ++k) {
+            sum += elite[k].p[i];
+        }
+        double m = sum / n_elite;
+
+        double sum_sq = 0.0;
+        for (int k = 0; k < n_elite; ++k) {
+            sum_sq += (elite[k].p[i] - m) * (elite[k].p[i] - m);
+        }
+
+        mean[i] = SMOOTHING * m + (1.0 - SMOOTHING) * mean[i];
+        sigma[i] = SMOOTHING * sqrt(sum_sq / n_elite) + (1.0 - SMOOTHING) * sigma[i];
+    }
+}
+
+static void destroy_planner(struct planner *pl) {
+    for (int c = 0; c < pl->n_ws; ++c) {
+        destroy_workspace(pl->ws + c);
+    }
+
+    free(pl->coast);
+    free(pl->candidates);
+    free(pl->scratch);
+    free(pl->ws);
+}
+
+static int init_planner(const struct plan_opts *opts, const struct plan_target *target, int n_bodies,
+                        const struct body *bodies, struct planner *out) {
+    struct planner pl = {
+            opts, target, 0, 0,
+            0.0, 0.0, 0.0, 0.0,
+            0, NULL,
+            NULL, NULL, NULL, 0,
+            INFINITY
+    };
+    *out = pl;
+
+    if (opts->body < 1 || opts->body >= n_bodies || opts->dt <= 0.0 || opts->thrust <= 0.0 ||
+        opts->n_candidates < 2 || target->a <= 0.0 || target->e < 0.0 || target->e >= 1.0) {
+        fprintf(stderr, "Invalid maneuver planning parameters\n");
+        return 0;
+    }
+
+    const struct body *body = bodies + opts->body;
+    out->mu = G * (gravitating_mass(bodies) + gravitating_mass(body));
+    out->mass = body->mass;
+
+    out->coast = malloc(n_bodies * sizeof(struct body));
+    if (!out->coast) {
+        fprintf(stderr, "Failed to allocate the planner\n");
+        return 0;
+    }
+    for (int i = 0; i < n_bodies; ++i) {
+        if (i == 0 || i == opts->body || !(bodies[i].flags & BODY_TEST_PARTICLE)) {
+            if (i == opts->body) {
+                out->body = out->n_bodies;
+            }
+            out->coast[out->n_bodies++] = bodies[i];
+        }
+    }
+    n_bodies = out->n_bodies;
+    bodies = out->coast;
+
+    struct orbital_elements el;
+    if (!osculating(out, bodies, &el) || el.e >= 1.0) {
+        fprintf(stderr, "The planned body must start on a closed orbit about body 0\n");
+        destroy_planner(out);
+        return 0;
+    }
+    struct vector v = {body->vel.x - bodies->vel.x, body->vel.y - bodies->vel.y, body->vel.z - bodies->vel.z};
+    out->speed = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+    out->horizon = opts->horizon > 0.0 ? opts->horizon : orbital_period(&el);
+    out->n_coast = (long) ceil(out->horizon / opts->dt);
+
+    int n_candidates = opts->n_candidates;
+    struct body *coast = realloc(out->coast, (out->n_coast + 1) * n_bodies * sizeof(struct body));
+    if (coast) {
+        out->coast = coast;
+    }
+    out->candidates = malloc(n_candidates * sizeof(struct candidate));
+    out->scratch = malloc((size_t) n_candidates * n_bodies * sizeof(struct body));
+    out->ws = malloc(n_candidates * sizeof(struct system_workspace));
+    if (!coast || !out->candidates || !out->scratch || !out->ws) {
+        fprintf(stderr, "Failed to allocate the planner\n");
+        destroy_planner(out);
+        return 0;
+    }
+
+    for (; out->n_ws < n_candidates; ++out->n_ws) {
+        if (!init_workspace(n_bodies, out->ws + out->n_ws)) {
+            fprintf(stderr, "Failed to allocate the planner\n");
+            destroy_planner(out);
+            return 0;
+        }
+        out->ws[out->n_ws].integrator = opts->integrator;
+    }
+
+    // The shared prefix, with every external force off
+    struct body *state = out->coast;
+    for (int i = 0; i < n_bodies; ++i) {
+        struct vector zero = {0.0, 0.0, 0.0};
+        state[i].F_net_ext = zero;
+    }
+    for (long k = 1; k <= out->n_coast; ++k) {
+        struct body *next = state + n_bodies;
+        memcpy(next, state, n_bodies * sizeof(struct body));
+        if (!advance_system(out->ws, opts->dt, n_bodies, next)) {
+            fprintf(stderr, "Failed to propagate the initial coast\n");
+            destroy_planner(out);
+            return 0;
+        }
+        state = next;
+    }
+
+    return 1;
+}
+
+int plan_maneuver(struct thread_pool *pool, const struct plan_opts *opts, const struct plan_target *target,
+                  int n_bodies, const struct body *bodies, struct burn_schedule *out, struct plan_stats *stats) {
+    struct plan_stats none = {0, 0, 0, 0, INFINITY, 0.0};
+    *stats = none;
+
+    struct planner pl;
+    if (!init_planner(opts, target, n_bodies, bodies, &pl)) {
+        return 0;
+    }
+
+    const struct body *body = bodies + opts->body;
+    struct vector r = {body->pos.x - bodies->pos.x, body->pos.y - bodies->pos.y, body->pos.z - bodies->pos.z};
+    double mean[N_PARAMS];
+    double sigma[N_PARAMS];
+    seed_search(&pl, sqrt(r.x * r.x + r.y * r.y + r.z * r.z), mean, sigma);
+
+    int n_candidates = opts->n_candidates;
+    int n_elite = (int) (ELITE_FRACTION * n_candidates);
+    if (n_elite < 2) {
+        n_elite = 2;
+    }
+
+    struct candidate best = {{0.0}, INFINITY, INFINITY, 0.0, 1};
+    unsigned long long seed = 1;
+    pl.threshold = INFINITY;
+    while (stats->n_iterations < opts->n_iterations && !(best.error < opts->tolerance)) {
+        // Sampled serially so that the candidates do not depend on the thread count
+        for (int c = 0; c < n_candidates; ++c) {
+            if (c == 0 && !best.pruned) {
+                pl.candidates[c] = best;
+            } else {
+                sample_candidate(&pl, mean, sigma, &seed, pl.candidates + c);
+            }
+        }
+
+        run_parallel(pool, n_candidates, 1, evaluate_task, &pl);
+
+        int n_valid = 0;
+        for (int c = 0; c < n_candidates; ++c) {
+            const struct candidate *cand = pl.candidates + c;
+            if (cand->pruned) {
+                stats->n_pruned++;
+                continue;
+            }
+
+            n_valid++;
+            stats->n_evaluated++;
+            stats->n_cached_steps += (long) (cand->p[P_START] / opts->dt);
+        }
+
+        qsort(pl.candidates, n_candidates, sizeof(struct candidate), compare_candidates);
+        if (pl.candidates[0].cost < best.cost) {
+            best = pl.candidates[0];
+        }
+        if (n_valid >= n_elite) {
+            refit(pl.candidates, n_elite, mean, sigma);
+            pl.threshold = pl.candidates[n_elite - 1].cost;
+        }
+
+        stats->n_iterations++;
+    }
+
+    int ok = !best.pruned;
+    if (ok) {
+        struct burn burns[2];
+        make_burns(&pl, best.p, opts->body, burns);
+        ok = add_burn(out, burns) && add_burn(out, burns + 1);
+        sort_burns(out);
+        stats->error = best.error;
+        stats->delta_v = best.delta_v;
+    } else {
+        fprintf(stderr, "No candidate maneuver completed\n");
+    }
+
+    destroy_planner(&pl);
+    return ok;
+}
@@ -0,0 +1,54 @@
+#ifndef ORBITAL_PLANNER_H
+#define ORBITAL_PLANNER_H
+
+#include "system.h"
+#include "burn.h"
+#include "integrator.h"
+#include "thread_pool.h"
+
+/*
+ * Orbit to reach about body 0, with a negative inclination
+ * (radians) leaving the orbital plane free.
+ */
+struct plan_target {
+    double a;
+    double e;
+    double inclination;
+};
+
+struct plan_opts {
+    int body;
+    double thrust;
+    double dt;
+    // Latest start of the first burn, 0 for one period of the current orbit
+    double horizon;
+    double min_periapsis;
+    int n_candidates;
+    int n_iterations;
+    double tolerance;
+    const struct integrator *integrator;
+};
+
+struct plan_stats {
+    int n_iterations;
+    long n_evaluated;
+    long n_pruned;
+    // Steps of the initial coast taken from the cache instead of simulated
+    long n_cached_steps;
+    double error;
+    double delta_v;
+};
+
+void init_plan_opts(struct plan_opts *out);
+
+/*
+ * Searches for two burns of opts->body that reach target,
+ * trading orbit error against delta-v, and appends them to out.
+ * Each iteration samples opts->n_candidates burn pairs around
+ * the best so far and propagates them in parallel on pool. The
+ * result only depends on the inputs, not on the thread count.
+ */
+int plan_maneuver(struct thread_pool *pool, const struct plan_opts *opts, const struct plan_target *target,
+                  int n_bodies, const struct body *bodies, struct burn_schedule *out, struct plan_stats *stats);
+
+#endif // ORBITAL_PLANNER_H
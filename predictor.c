@@ -0,0 +1,254 @@
+#include "predictor.h"
+
+#include "integrator.h"
+#include "kepler.h"
+#include "timewarp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Open or unbound paths are predicted this far ahead
+static const double DEFAULT_HORIZON = 7200.0;
+static const double STEP_ETA = 0.005;
+// Points extended between checks for a new seed
+static const int EXTEND_BATCH = 64;
+static const long IDLE_SLEEP_NS = 2000000;
+
+struct predictor_seed {
+    int epoch;
+    double time;
+    int controlled;
+    int n_bodies;
+    struct body bodies[PREDICTOR_MAX_BODIES];
+};
+
+/*
+ * Bound orbits are drawn for exactly one period so the path
+ * closes on itself; anything else gets a fixed horizon.
+ */
+static double predict_horizon(const struct body *primary, const struct body *body) {
+    struct vector r = {body->pos.x - primary->pos.x, body->pos.y - primary->pos.y, body->pos.z - primary->pos.z};
+    struct vector v = {body->vel.x - primary->vel.x, body->vel.y - primary->vel.y, body->vel.z - primary->vel.z};
+
+    struct orbital_elements el;
+    double mu = G * (gravitating_mass(primary) + gravitating_mass(body));
+    if (mu == 0.0 || !state_to_elements(mu, r, v, &el)) {
+        return DEFAULT_HORIZON;
+    }
+
+    double period = orbital_period(&el);
+    return isfinite(period) ? period : DEFAULT_HORIZON;
+}
+
+static int propagate(struct predictor *pred, double dt) {
+    int n_substeps = 1;
+    if (!is_analytic_coast(pred->n_bodies, pred->bodies)) {
+        double budget = step_budget(STEP_ETA, pred->n_bodies, pred->bodies);
+        n_substeps = (int) ceil(dt / budget);
+        if (n_substeps < 1) {
+            n_substeps = 1;
+        }
+    }
+
+    for (int i = 0; i < n_substeps; ++i) {
+        if (!advance_system(&pred->ws, dt / n_substeps, pred->n_bodies, pred->bodies)) {
+            return 0;
+        }
+    }
+
+    pred->t_end += dt;
+    return 1;
+}
+
+static void push_point(struct predictor *pred) {
+    int slot = (pred->head + pred->count) % PREDICTION_POINTS;
+    pred->ring_time[slot] = pred->t_end;
+    pred->ring_pos[slot] = pred->bodies[pred->controlled].pos;
+    pred->count++;
+}
+
+static void restart(struct predictor *pred, const struct predictor_seed *seed) {
+    struct vector zero = {0.0, 0.0, 0.0};
+
+    pred->n_bodies = seed->n_bodies;
+    pred->controlled = seed->controlled;
+    pred->epoch = seed->epoch;
+    memcpy(pred->bodies, seed->bodies, seed->n_bodies * sizeof(struct body));
+    for (int i = 0; i < pred->n_bodies; ++i) {
+        pred->bodies[i].F_net_ext = zero;
+    }
+
+    pred->horizon = predict_horizon(pred->bodies, pred->bodies + pred->controlled);
+    pred->spacing = pred->horizon / (PREDICTION_POINTS - 1);
+    pred->t_end = seed->time;
+    pred->head = 0;
+    pred->count = 0;
+    push_point(pred);
+    pred->seeded = 1;
+}
+
+static void publish(struct predictor *pred) {
+    struct prediction *out = tb_write_slot(&pred->output);
+    out->epoch = pred->epoch;
+    out->n_points = pred->count;
+    for (int i = 0; i < pred->count; ++i) {
+        int slot = (pred->head + i) % PREDICTION_POINTS;
+        out->time[i] = pred->ring_time[slot];
+        out->pos[i] = pred->ring_pos[slot];
+    }
+
+    tb_publish(&pred->output);
+}
+
+/*
+ * Keeps one point at or behind the current time so the path
+ * starts at the body, and fills the rest of the ring ahead of
+ * it. Falling further behind than the whole path (at high time
+ * warp) propagates straight to the current time, in one step
+ * for an analytic coast.
+ */
+static void *run_predictor(void *arg) {
+    struct predictor *pred = arg;
+
+    while (!atomic_load(&pred->stop)) {
+        int changed = 0;
+
+        int fresh;
+        const struct predictor_seed *seed = tb_read(&pred->seeds, &fresh);
+        if (fresh) {
+            restart(pred, seed);
+            changed = 1;
+        }
+
+        if (pred->seeded) {
+            double now = atomic_load(&pred->now);
+            while (pred->count > 1 && pred->ring_time[(pred->head + 1) % PREDICTION_POINTS] <= now) {
+                pred->head = (pred->head + 1) % PREDICTION_POINTS;
+                pred->count--;
+                changed = 1;
+            }
+
+            if (pred->count == 1 && pred->t_end < now) {
+                // Catch up in slices so a new seed or stop is never kept waiting
+                double behind = now - pred->t_end;
+                double slice = is_analytic_coast(pred->n_bodies, pred->bodies) ? behind : EXTEND_BATCH * pred->spacing;
+                if (!propagate(pred, behind < slice ? behind : slice)) {
+                    pred->seeded = 0;
+                    continue;
+                }
+                pred->count = 0;
+                push_point(pred);
+                changed = 1;
+            }
+
+            for (int i = 0; i < EXTEND_BATCH && pred->count < PREDICTION_POINTS; ++i) {
+                if (!propagate(pred, pred->spacing)) {
+                    pred->seeded = 0;
+                    break;
+                }
+                push_point(pred);
+                changed = 1;
+            }
+        }
+
+        if (changed) {
+            publish(pred);
+        } else {
+            struct timespec ts = {0, IDLE_SLEEP_NS};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+static void free_buffers(struct predictor *pred) {
+    destroy_triple_buffer(&pred->seeds);
+    destroy_triple_buffer(&pred->output);
+    destroy_workspace(&pred->ws);
+    free(pred->bodies);
+    pred->bodies = NULL;
+}
+
+int init_predictor(int n_bodies, const struct integrator *integrator, struct predictor *out) {
+    int cap = n_bodies < PREDICTOR_MAX_BODIES ? n_bodies : PREDICTOR_MAX_BODIES;
+
+    out->bodies = malloc(PREDICTOR_MAX_BODIES * sizeof(struct body));
+    if (!out->bodies || !init_workspace(cap, &out->ws)) {
+        fprintf(stderr, "Failed to allocate the predictor\n");
+        free(out->bodies);
+        out->bodies = NULL;
+        return 0;
+    }
+
+    // A triple buffer that fails to allocate leaves its slots NULL, so both are freed either way
+    int ok = init_triple_buffer(sizeof(struct predictor_seed), &out->seeds);
+    ok &= init_triple_buffer(sizeof(struct prediction), &out->output);
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate the predictor\n");
+        free_buffers(out);
+        return 0;
+    }
+    out->ws.integrator = integrator;
+
+    atomic_init(&out->now, 0.0);
+    atomic_init(&out->stop, 0);
+    out->n_bodies = 0;
+    out->controlled = 0;
+    out->epoch = 0;
+    out->seeded = 0;
+    out->head = 0;
+    out->count = 0;
+
+    if (pthread_create(&out->thread, NULL, run_predictor, out) != 0) {
+        fprintf(stderr, "Failed to start the predictor\n");
+        free_buffers(out);
+        return 0;
+    }
+
+    return 1;
+}
+
+void destroy_predictor(struct predictor *pred) {
+    atomic_store(&pred->stop, 1);
+    pthread_join(pred->thread, NULL);
+
+    free_buffers(pred);
+}
+
+/*
+ * Called whenever the external forces change. Beyond
+ * PREDICTOR_MAX_BODIES only the primary at index 0 and the
+ * controlled body are kept.
+ */
+void seed_predictor(struct predictor *pred, int epoch, double time, int controlled, int n_bodies,
+                    const struct body *bodies) {
+    struct predictor_seed *seed = tb_write_slot(&pred->seeds);
+    seed->epoch = epoch;
+    seed->time = time;
+
+    if (n_bodies <= PREDICTOR_MAX_BODIES) {
+        seed->controlled = controlled;
+        seed->n_bodies = n_bodies;
+        memcpy(seed->bodies, bodies, n_bodies * sizeof(struct body));
+    } else {
+        seed->controlled = 1;
+        seed->n_bodies = 2;
+        seed->bodies[0] = bodies[0];
+        seed->bodies[1] = bodies[controlled];
+    }
+
+    atomic_store(&pred->now, time);
+    tb_publish(&pred->seeds);
+}
+
+void set_predictor_time(struct predictor *pred, double time) {
+    atomic_store(&pred->now, time);
+}
+
+const struct prediction *read_prediction(struct predictor *pred, int *fresh) {
+    return tb_read(&pred->output, fresh);
+}
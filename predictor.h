@@ -0,0 +1,65 @@
+#ifndef ORBITAL_PREDICTOR_H
+#define ORBITAL_PREDICTOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "system.h"
+#include "triple_buffer.h"
+
+#define PREDICTION_POINTS 1024
+// Larger systems are predicted as just the primary and the controlled body
+#define PREDICTOR_MAX_BODIES 64
+
+/*
+ * The controlled body's coasting path from about the current
+ * time forward, oldest point first.
+ */
+struct prediction {
+    int epoch;
+    int n_points;
+    double time[PREDICTION_POINTS];
+    struct vector pos[PREDICTION_POINTS];
+};
+
+/*
+ * Propagates a private copy of the system on its own thread,
+ * with all external forces removed. While no new seed arrives
+ * the existing path stays valid, so it is only trimmed behind
+ * the current time and extended ahead of it. A seed restarts it
+ * from scratch.
+ */
+struct predictor {
+    struct triple_buffer seeds;
+    struct triple_buffer output;
+    _Atomic double now;
+    atomic_int stop;
+    pthread_t thread;
+
+    // Owned by the predictor thread
+    struct system_workspace ws;
+    int n_bodies;
+    int controlled;
+    struct body *bodies;
+    int epoch;
+    int seeded;
+    double t_end;
+    double horizon;
+    double spacing;
+    int head;
+    int count;
+    double ring_time[PREDICTION_POINTS];
+    struct vector ring_pos[PREDICTION_POINTS];
+};
+
+int init_predictor(int n_bodies, const struct integrator *integrator, struct predictor *out);
+
+void destroy_predictor(struct predictor *pred);
+
+void seed_predictor(struct predictor *pred, int epoch, double time, int controlled, int n_bodies,
+                    const struct body *bodies);
+
+void set_predictor_time(struct predictor *pred, double time);
+
+const struct prediction *read_prediction(struct predictor *pred, int *fresh);
+
+#endif // ORBITAL_PREDICTOR_H
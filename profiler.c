@@ -0,0 +1,168 @@
+#include "profiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "pacer.h"
+
+static const double NS_PER_US = 1000.0;
+
+/*
+ * Values below 8 ns get a bucket each; above that every power
+ * of two is split into 8 linear sub-buckets, for a relative
+ * resolution of 12.5% or better.
+ */
+static int bucket_of(long long ns) {
+    if (ns < 8) {
+        return ns < 0 ? 0 : (int) ns;
+    }
+
+    int msb = 63 - __builtin_clzll((unsigned long long) ns);
+    int bucket = (msb - 2) * 8 + (int) ((ns >> (msb - 3)) & 7);
+    return bucket < PROFILER_BUCKETS ? bucket : PROFILER_BUCKETS - 1;
+}
+
+// Midpoint of the values that fall into bucket
+static long long bucket_value(int bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+
+    int msb = bucket / 8 + 2;
+    long long width = 1LL << (msb - 3);
+    long long lower = (8LL + bucket % 8) * width;
+    return lower + width / 2;
+}
+
+int open_trace(const char *path, struct trace_file *out) {
+    out->file = fopen(path, "w");
+    if (!out->file) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", path);
+        return 0;
+    }
+
+    out->origin_ns = pacer_now_ns();
+    atomic_init(&out->n_events, 0);
+    fputs("[\n", out->file);
+    return 1;
+}
+
+int close_trace(struct trace_file *trace) {
+    fputs("\n]\n", trace->file);
+    int ok = fclose(trace->file) == 0;
+    if (!ok) {
+        fprintf(stderr, "Failed to write the trace\n");
+    }
+
+    trace->file = NULL;
+    return ok;
+}
+
+// stdio locks the stream per call, so events from different threads never interleave
+static void trace_event(struct trace_file *trace, const char *event) {
+    int first = atomic_fetch_add(&trace->n_events, 1) == 0;
+    fprintf(trace->file, "%s%s", first ? "" : ",\n", event);
+}
+
+int init_profiler(int tid, const char *thread_name, int n_phases, const char *const *names,
+                  struct trace_file *trace, struct profiler *out) {
+    out->tid = tid;
+    out->n_phases = n_phases;
+    out->trace = trace;
+    out->phases = calloc(n_phases, sizeof(struct profile_phase));
+    if (!out->phases) {
+        fprintf(stderr, "Failed to allocate the profiler\n");
+        return 0;
+    }
+
+    for (int i = 0; i < n_phases; ++i) {
+        out->phases[i].name = names[i];
+        atomic_init(&out->phases[i].p50_ns, 0);
+        atomic_init(&out->phases[i].p99_ns, 0);
+    }
+
+    if (trace) {
+        char event[256];
+        snprintf(event, sizeof(event),
+                 "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                 tid, thread_name);
+        trace_event(trace, event);
+    }
+
+    return 1;
+}
+
+void destroy_profiler(struct profiler *prof) {
+    free(prof->phases);
+    prof->phases = NULL;
+    prof->n_phases = 0;
+}
+
+long long phase_percentile(const struct profile_phase *phase, double q) {
+    if (phase->count == 0) {
+        return 0;
+    }
+
+    // Smallest bucket with at least q of the window at or below it
+    int rank = (int) (q * (phase->count - 1)) + 1;
+    int seen = 0;
+    for (int b = 0; b < PROFILER_BUCKETS; ++b) {
+        seen += phase->hist[b];
+        if (seen >= rank) {
+            return bucket_value(b);
+        }
+    }
+
+    return bucket_value(PROFILER_BUCKETS - 1);
+}
+
+void profile_record(struct profiler *prof, int phase_idx, long long begin_ns, long long end_ns) {
+    struct profile_phase *phase = prof->phases + phase_idx;
+    long long ns = end_ns - begin_ns;
+
+    if (phase->count == PROFILER_WINDOW) {
+        phase->hist[bucket_of(phase->ring[phase->head])]--;
+    } else {
+        phase->count++;
+    }
+    phase->ring[phase->head] = ns;
+    phase->head = (phase->head + 1) % PROFILER_WINDOW;
+    phase->hist[bucket_of(ns)]++;
+    phase->n_samples++;
+
+    atomic_store_explicit(&phase->p50_ns, phase_percentile(phase, 0.50), memory_order_relaxed);
+    atomic_store_explicit(&phase->p99_ns, phase_percentile(phase, 0.99), memory_order_relaxed);
+
+    if (prof->trace) {
+        char event[256];
+        snprintf(event, sizeof(event),
+                 "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                 phase->name, prof->tid, (begin_ns - prof->trace->origin_ns) / NS_PER_US, ns / NS_PER_US);
+        trace_event(prof->trace, event);
+    }
+}
+
+long long profile_mark(struct profiler *prof, int phase, long long begin_ns) {
+    long long now = pacer_now_ns();
+    profile_record(prof, phase, begin_ns, now);
+    return now;
+}
+
+void print_profile(const struct profiler *prof, FILE *out) {
+    for (int i = 0; i < prof->n_phases; ++i) {
+        const struct profile_phase *phase = prof->phases + i;
+        if (phase->n_samples == 0) {
+            continue;
+        }
+
+        long long max = 0;
+        for (int k = 0; k < phase->count; ++k) {
+            if (phase->ring[k] > max) {
+                max = phase->ring[k];
+            }
+        }
+
+        fprintf(out, "%-18s p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  max %8.3f ms  (%ld samples)\n",
+                phase->name, phase_percentile(phase, 0.50) / 1e6, phase_percentile(phase, 0.90) / 1e6,
+                phase_percentile(phase, 0.99) / 1e6, max / 1e6, phase->n_samples);
+    }
+}
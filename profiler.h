@@ -0,0 +1,73 @@
+#ifndef ORBITAL_PROFILER_H
+#define ORBITAL_PROFILER_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+// Samples per phase that the percentiles are taken over
+#define PROFILER_WINDOW 512
+// 8 logarithmic buckets per power of two up to about a minute
+#define PROFILER_BUCKETS 280
+
+/*
+ * Chrome trace-format event log shared by every profiler.
+ * Events are appended as they are recorded and the file can
+ * be opened in chrome://tracing or Perfetto.
+ */
+struct trace_file {
+    FILE *file;
+    long long origin_ns;
+    atomic_int n_events;
+};
+
+/*
+ * The last PROFILER_WINDOW durations of one phase, both as a
+ * ring and as a histogram kept in step with it, so that a new
+ * sample costs O(1) plus a bucket scan. p50 and p99 are
+ * republished after every sample for other threads to read.
+ */
+struct profile_phase {
+    const char *name;
+    long long ring[PROFILER_WINDOW];
+    int head;
+    int count;
+    int hist[PROFILER_BUCKETS];
+    long n_samples;
+
+    atomic_llong p50_ns;
+    atomic_llong p99_ns;
+};
+
+/*
+ * Per-thread set of phases. Only the owning thread records
+ * into it.
+ */
+struct profiler {
+    int tid;
+    int n_phases;
+    struct profile_phase *phases;
+    struct trace_file *trace;
+};
+
+int open_trace(const char *path, struct trace_file *out);
+
+int close_trace(struct trace_file *trace);
+
+int init_profiler(int tid, const char *thread_name, int n_phases, const char *const *names,
+                  struct trace_file *trace, struct profiler *out);
+
+void destroy_profiler(struct profiler *prof);
+
+/*
+ * Records phase as running from begin_ns until now and returns
+ * now, so consecutive phases share one clock read each.
+ */
+long long profile_mark(struct profiler *prof, int phase, long long begin_ns);
+
+void profile_record(struct profiler *prof, int phase, long long begin_ns, long long end_ns);
+
+long long phase_percentile(const struct profile_phase *phase, double q);
+
+void print_profile(const struct profiler *prof, FILE *out);
+
+#endif // ORBITAL_PROFILER_H
@@ -0,0 +1,160 @@
+#include "scenario.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const double TWO_PI = 2.0 * M_PI;
+static const double DEBRIS_MIN_ALT = 300000.0;
+static const double DEBRIS_MAX_ALT = 2000000.0;
+static const double MOON_MASS = 7.342e22;
+static const double MOON_DISTANCE = 384400000.0;
+
+void reset_leo(struct body *bodies) {
+    struct body *earth = bodies;
+    struct vector zero = {0.0, 0.0, 0.0};
+    earth->F_net_ext = zero;
+    earth->pos = zero;
+    earth->vel = zero;
+    earth->acl = zero;
+
+    struct body *rocket = bodies + 1;
+    rocket->F_net_ext = zero;
+    struct vector rocket_pos = {EARTH_RAD + 1000000.0, 0.0, 0.0};
+    rocket->pos = rocket_pos;
+    struct vector rocket_v = {0.0, 7200.0, 0.0};
+    rocket->vel = rocket_v;
+    rocket->acl = zero;
+}
+
+// Fixed-seed LCG so that every run sees the same cloud
+static double next_uniform(unsigned long long *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double) (*state >> 11) / (double) (1ULL << 53);
+}
+
+/*
+ * Circular orbits between DEBRIS_MIN_ALT and DEBRIS_MAX_ALT
+ * with random inclination, node and phase for the bodies from
+ * first onwards.
+ */
+static void init_debris(int first, int n_bodies, struct body *bodies) {
+    unsigned long long seed = 1;
+    double mu = G * EARTH_MASS;
+
+    for (int i = first; i < n_bodies; ++i) {
+        double r = EARTH_RAD + DEBRIS_MIN_ALT + (DEBRIS_MAX_ALT - DEBRIS_MIN_ALT) * next_uniform(&seed);
+        double inc = acos(1.0 - 2.0 * next_uniform(&seed));
+        double node = TWO_PI * next_uniform(&seed);
+        double phase = TWO_PI * next_uniform(&seed);
+        double v = sqrt(mu / r);
+
+        // Position and velocity in the orbital plane, rotated by inclination and node
+        double px = r * cos(phase);
+        double py = r * sin(phase);
+        double vx = -v * sin(phase);
+        double vy = v * cos(phase);
+
+        add_body(1.0 + 999.0 * next_uniform(&seed), bodies + i);
+
+        struct vector pos = {
+                px * cos(node) - py * cos(inc) * sin(node),
+                px * sin(node) + py * cos(inc) * cos(node),
+                py * sin(inc)
+        };
+        struct vector vel = {
+                vx * cos(node) - vy * cos(inc) * sin(node),
+                vx * sin(node) + vy * cos(inc) * cos(node),
+                vy * sin(inc)
+        };
+        bodies[i].pos = pos;
+        bodies[i].vel = vel;
+    }
+}
+
+static void init_moon(struct body *moon) {
+    add_body(MOON_MASS, moon);
+
+    struct vector pos = {MOON_DISTANCE, 0.0, 0.0};
+    struct vector vel = {0.0, sqrt(G * (EARTH_MASS + MOON_MASS) / MOON_DISTANCE), 0.0};
+    moon->pos = pos;
+    moon->vel = vel;
+}
+
+int is_builtin_scenario(const char *name) {
+    return strcmp(name, "leo") == 0 || strcmp(name, "debris") == 0 || strcmp(name, "constellation") == 0;
+}
+
+/*
+ * "leo" is the Earth and F9 upper stage used by the viewer;
+ * n_bodies is ignored. "debris" is the Earth surrounded by
+ * n_bodies - 1 pieces of debris. "constellation" is the Earth
+ * and Moon followed by n_bodies - 2 satellites. The stage and
+ * the satellites are test particles.
+ */
+int init_scenario(const char *name, int n_bodies, struct scenario *out) {
+    if (!is_builtin_scenario(name)) {
+        fprintf(stderr, "Unknown scenario '%s'\n", name);
+        return 0;
+    }
+
+    int is_leo = strcmp(name, "leo") == 0;
+    int is_constellation = strcmp(name, "constellation") == 0;
+
+    if (is_leo) {
+        n_bodies = 2;
+    } else if (n_bodies < 1) {
+        n_bodies = 1;
+    }
+
+    struct body *bodies = malloc(n_bodies * sizeof(*bodies));
+    if (!bodies) {
+        fprintf(stderr, "Failed to allocate %d bodies\n", n_bodies);
+        return 0;
+    }
+
+    add_body(EARTH_MASS, bodies);
+    if (is_leo) {
+        add_body(F9_2_MASS, bodies + 1);
+        bodies[1].flags = BODY_TEST_PARTICLE;
+        reset_leo(bodies);
+    } else if (is_constellation) {
+        if (n_bodies > 1) {
+            init_moon(bodies + 1);
+        }
+        init_debris(2, n_bodies, bodies);
+        for (int i = 2; i < n_bodies; ++i) {
+            bodies[i].flags = BODY_TEST_PARTICLE;
+        }
+    } else {
+        init_debris(1, n_bodies, bodies);
+    }
+
+    out->n_bodies = n_bodies;
+    out->bodies = bodies;
+    init_burn_schedule(&out->burns);
+    return 1;
+}
+
+int init_scenario_snapshot(const struct snapshot *snap, struct scenario *out) {
+    size_t len = snap->n_bodies * sizeof(struct body);
+    struct body *bodies = malloc(len);
+    if (!bodies) {
+        fprintf(stderr, "Failed to allocate %d bodies\n", snap->n_bodies);
+        return 0;
+    }
+
+    memcpy(bodies, snap->bodies, len);
+    out->n_bodies = snap->n_bodies;
+    out->bodies = bodies;
+    init_burn_schedule(&out->burns);
+    return 1;
+}
+
+void destroy_scenario(struct scenario *scenario) {
+    free(scenario->bodies);
+    scenario->bodies = NULL;
+    scenario->n_bodies = 0;
+    destroy_burn_schedule(&scenario->burns);
+}
@@ -0,0 +1,34 @@
+#ifndef ORBITAL_SCENARIO_H
+#define ORBITAL_SCENARIO_H
+
+#include "system.h"
+#include "snapshot.h"
+#include "burn.h"
+
+// IAU 2015 Earth radius
+static const double EARTH_RAD = 6378100.0;
+// IAU 1976 value for Earth mass
+static const double EARTH_MASS = 5972200000000000000000000.0;
+// https://www.spaceflightinsider.com/hangar/falcon-9/
+// F9 2nd stage mass
+static const double F9_2_MASS = 96570.0;
+// F9 Payload Guide
+static const double F9_2_THRUST = 981000;
+
+struct scenario {
+    int n_bodies;
+    struct body *bodies;
+    struct burn_schedule burns;
+};
+
+int is_builtin_scenario(const char *name);
+
+int init_scenario(const char *name, int n_bodies, struct scenario *out);
+
+int init_scenario_snapshot(const struct snapshot *snap, struct scenario *out);
+
+void reset_leo(struct body *bodies);
+
+void destroy_scenario(struct scenario *scenario);
+
+#endif // ORBITAL_SCENARIO_H
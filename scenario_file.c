@@ -0,0 +1,642 @@
+#include "scenario_file.h"
+
+#include "kepler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAX_LINE 1024
+#define MAX_ERROR 128
+
+// Several chunks per thread so that one dense chunk does not hold up the rest
+static const int CHUNKS_PER_THREAD = 4;
+static const size_t MIN_CHUNK_SIZE = 1 << 16;
+static const int ORBIT_BLOCK_SIZE = 4096;
+static const double DEG = M_PI / 180.0;
+
+enum line_kind {
+    LINE_OTHER,
+    LINE_BODY,
+    LINE_ORBIT,
+    LINE_BURN
+};
+
+// Orbital elements held until every primary's mass is known
+struct orbit_line {
+    int index;
+    int primary;
+    long line;
+    struct orbital_elements el;
+};
+
+/*
+ * A run of whole lines. The first pass counts what each chunk
+ * declares, so the second can parse every chunk straight into
+ * its own slice of the output arrays.
+ */
+struct chunk {
+    const char *begin;
+    const char *end;
+
+    long n_lines;
+    int n_bodies;
+    int n_orbits;
+    int n_burns;
+
+    long first_line;
+    int first_body;
+    int first_orbit;
+    int first_burn;
+
+    long error_line;
+    char error[MAX_ERROR];
+};
+
+struct parse_task {
+    struct chunk *chunks;
+    int n_bodies;
+    struct body *bodies;
+    struct orbit_line *orbits;
+    struct burn *burns;
+};
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// A comment ends the word too, as parse_task cuts each line at the '#'
+static int starts_word(const char *p, const char *end, const char *word) {
+    size_t len = strlen(word);
+    return (size_t) (end - p) >= len && memcmp(p, word, len) == 0 &&
+           (p + len == end || is_space(p[len]) || p[len] == '#');
+}
+
+static enum line_kind classify(const char *p, const char *end) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+
+    if (starts_word(p, end, "body")) {
+        return LINE_BODY;
+    } else if (starts_word(p, end, "orbit")) {
+        return LINE_ORBIT;
+    } else if (starts_word(p, end, "burn")) {
+        return LINE_BURN;
+    }
+
+    return LINE_OTHER;
+}
+
+static const char *line_end(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+static void count_task(void *arg, int begin, int end) {
+    struct parse_task *task = arg;
+
+    for (int c = begin; c < end; ++c) {
+        struct chunk *chunk = task->chunks + c;
+        for (const char *p = chunk->begin; p < chunk->end;) {
+            const char *eol = line_end(p, chunk->end);
+            switch (classify(p, eol)) {
+                case LINE_BODY:
+                    chunk->n_bodies++;
+                    break;
+                case LINE_ORBIT:
+                    chunk->n_bodies++;
+                    chunk->n_orbits++;
+                    break;
+                case LINE_BURN:
+                    chunk->n_burns++;
+                    break;
+                default:
+                    break;
+            }
+
+            chunk->n_lines++;
+            p = eol + (eol < chunk->end);
+        }
+    }
+}
+
+static char *next_word(char **p) {
+    char *s = *p;
+    while (is_space(*s)) {
+        s++;
+    }
+    if (*s == '\0') {
+        *p = s;
+        return NULL;
+    }
+
+    char *word = s;
+    while (*s && !is_space(*s)) {
+        s++;
+    }
+    if (*s) {
+        *s++ = '\0';
+    }
+
+    *p = s;
+    return word;
+}
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/*
+ * Clinger's fast path: a decimal whose digits form an integer
+ * below 2^53, scaled by at most 10^22, converts exactly with
+ * a single multiply or divide because both operands are exact
+ * doubles. That covers nearly every number in practice at a
+ * fraction of the cost of strtod, which handles the rest, so
+ * the result is always correctly rounded.
+ */
+static double parse_number(const char *s, char **end) {
+    static const double POW10[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *p = s;
+    while (is_space(*p)) {
+        p++;
+    }
+
+    int negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int n_digits = 0;
+    int exp10 = 0;
+    const char *digits = p;
+    for (; is_digit(*p); ++p) {
+        mantissa = mantissa * 10 + (*p - '0');
+        n_digits += mantissa != 0;
+    }
+    if (*p == '.') {
+        for (++p; is_digit(*p); ++p) {
+            mantissa = mantissa * 10 + (*p - '0');
+            n_digits += mantissa != 0;
+            exp10--;
+        }
+    }
+
+    int has_digits = p - digits > (*digits == '.' ? 1 : 0);
+    if (has_digits && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int exp_negative = *q == '-';
+        if (*q == '-' || *q == '+') {
+            q++;
+        }
+
+        int exp = 0;
+        const char *exp_digits = q;
+        for (; is_digit(*q) && exp < 10000; ++q) {
+            exp = exp * 10 + (*q - '0');
+        }
+        if (q > exp_digits) {
+            exp10 += exp_negative ? -exp : exp;
+            p = q;
+        }
+    }
+
+    if (!has_digits || n_digits > 19 || mantissa > (1ULL << 53) || exp10 < -22 || exp10 > 22 ||
+        (*p && !is_space(*p))) {
+        return strtod(s, end);
+    }
+
+    double value = (double) mantissa;
+    value = exp10 < 0 ? value / POW10[-exp10] : value * POW10[exp10];
+    *end = (char *) p;
+    return negative ? -value : value;
+}
+
+static int next_double(char **p, double *out) {
+    char *end;
+    double value = parse_number(*p, &end);
+    if (end == *p || (*end && !is_space(*end)) || !isfinite(value)) {
+        return 0;
+    }
+
+    *p = end;
+    *out = value;
+    return 1;
+}
+
+static int next_index(char **p, int *out) {
+    char *end;
+    long value = strtol(*p, &end, 10);
+    if (end == *p || (*end && !is_space(*end)) || value < 0 || value > INT32_MAX) {
+        return 0;
+    }
+
+    *p = end;
+    *out = (int) value;
+    return 1;
+}
+
+static int next_doubles(char **p, int n, double *out) {
+    for (int i = 0; i < n; ++i) {
+        if (!next_double(p, out + i)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// An optional trailing "test" and nothing else
+static int parse_flags(char **p, int *flags) {
+    char *word = next_word(p);
+    *flags = 0;
+    if (!word) {
+        return 1;
+    }
+
+    if (strcmp(word, "test") != 0) {
+        return 0;
+    }
+    *flags = BODY_TEST_PARTICLE;
+    return next_word(p) == NULL;
+}
+
+static int is_end(char **p) {
+    return next_word(p) == NULL;
+}
+
+static const char *parse_body(char *p, struct body *out) {
+    double v[7];
+    int flags;
+    if (!next_doubles(&p, 7, v) || !parse_flags(&p, &flags)) {
+        return "expected body <mass> <x> <y> <z> <vx> <vy> <vz> [test]";
+    }
+    if (v[0] <= 0.0) {
+        return "mass must be positive";
+    }
+
+    add_body(v[0], out);
+    out->flags = flags;
+    struct vector pos = {v[1], v[2], v[3]};
+    struct vector vel = {v[4], v[5], v[6]};
+    out->pos = pos;
+    out->vel = vel;
+    return NULL;
+}
+
+static const char *parse_orbit(char *p, int index, struct body *out, struct orbit_line *orbit) {
+    double mass;
+    int primary;
+    double v[6];
+    int flags;
+    if (!next_double(&p, &mass) || !next_index(&p, &primary) || !next_doubles(&p, 6, v) ||
+        !parse_flags(&p, &flags)) {
+        return "expected orbit <mass> <primary> <a> <e> <i> <raan> <argp> <nu> [test]";
+    }
+    if (mass <= 0.0) {
+        return "mass must be positive";
+    }
+    if (primary >= index) {
+        return "primary must be an earlier body";
+    }
+
+    double a = v[0];
+    double e = v[1];
+    double nu = v[5] * DEG;
+    if (e < 0.0 || a * (1.0 - e * e) <= 0.0) {
+        return "a and e do not describe an ellipse or hyperbola";
+    }
+    if (1.0 + e * cos(nu) <= 0.0) {
+        return "true anomaly is beyond the asymptote";
+    }
+
+    add_body(mass, out);
+    out->flags = flags;
+
+    orbit->index = index;
+    orbit->primary = primary;
+    orbit->el.mu = 0.0;
+    orbit->el.p = a * (1.0 - e * e);
+    orbit->el.e = e;
+    orbit->el.a = a;
+    orbit->el.i = v[2] * DEG;
+    orbit->el.raan = v[3] * DEG;
+    orbit->el.argp = v[4] * DEG;
+    orbit->el.nu = nu;
+    return NULL;
+}
+
+static const char *parse_burn(char *p, int n_bodies, struct burn *out) {
+    int body;
+    double v[2];
+    char *frame;
+    double f[3];
+    if (!next_index(&p, &body) || !next_doubles(&p, 2, v) || !(frame = next_word(&p)) ||
+        !next_doubles(&p, 3, f) || !is_end(&p)) {
+        return "expected burn <body> <start> <duration> inertial|orbit <f1> <f2> <f3>";
+    }
+    if (body >= n_bodies) {
+        return "burn on a body that does not exist";
+    }
+    if (v[1] <= 0.0) {
+        return "duration must be positive";
+    }
+
+    if (strcmp(frame, "inertial") == 0) {
+        out->frame = BURN_INERTIAL;
+    } else if (strcmp(frame, "orbit") == 0) {
+        out->frame = BURN_ORBIT;
+    } else {
+        return "frame must be inertial or orbit";
+    }
+
+    out->body = body;
+    out->start = v[0];
+    out->duration = v[1];
+    struct vector force = {f[0], f[1], f[2]};
+    out->force = force;
+    return NULL;
+}
+
+static void set_error(struct chunk *chunk, long line, const char *error) {
+    if (chunk->error_line == 0) {
+        chunk->error_line = line;
+        snprintf(chunk->error, sizeof(chunk->error), "%s", error);
+    }
+}
+
+/*
+ * Each line is copied into a stack buffer, cut at any comment,
+ * so the number parsers see a terminated string without the
+ * mapping ever being written or anything being allocated.
+ */
+static void parse_task(void *arg, int begin, int end) {
+    struct parse_task *task = arg;
+
+    char buf[MAX_LINE];
+    for (int c = begin; c < end; ++c) {
+        struct chunk *chunk = task->chunks + c;
+        long line = chunk->first_line;
+        int body = chunk->first_body;
+        int orbit = chunk->first_orbit;
+        int burn = chunk->first_burn;
+
+        for (const char *p = chunk->begin; p < chunk->end && chunk->error_line == 0; line++) {
+            const char *eol = line_end(p, chunk->end);
+            size_t len = eol - p;
+            const char *hash = memchr(p, '#', len);
+            if (hash) {
+                len = hash - p;
+            }
+            if (len >= MAX_LINE) {
+                set_error(chunk, line, "line too long");
+                break;
+            }
+
+            memcpy(buf, p, len);
+            buf[len] = '\0';
+            p = eol + (eol < chunk->end);
+
+            char *cursor = buf;
+            char *word = next_word(&cursor);
+            const char *error = NULL;
+            if (!word) {
+                continue;
+            } else if (strcmp(word, "body") == 0) {
+                error = parse_body(cursor, task->bodies + body++);
+            } else if (strcmp(word, "orbit") == 0) {
+                error = parse_orbit(cursor, body, task->bodies + body, task->orbits + orbit);
+                if (!error) {
+                    task->orbits[orbit].line = line;
+                    body++;
+                    orbit++;
+                }
+            } else if (strcmp(word, "burn") == 0) {
+                error = parse_burn(cursor, task->n_bodies, task->burns + burn++);
+            } else {
+                error = "unknown keyword";
+            }
+
+            if (error) {
+                set_error(chunk, line, error);
+            }
+        }
+    }
+}
+
+static double orbit_mu(const struct parse_task *task, const struct orbit_line *orbit) {
+    return G * (gravitating_mass(task->bodies + orbit->primary) + gravitating_mass(task->bodies + orbit->index));
+}
+
+// State relative to the primary; the primary's own state is added afterwards in order
+static void orbit_task(void *arg, int begin, int end) {
+    struct parse_task *task = arg;
+
+    for (int k = begin; k < end; ++k) {
+        struct orbit_line *orbit = task->orbits + k;
+        orbit->el.mu = orbit_mu(task, orbit);
+        if (orbit->el.mu == 0.0) {
+            continue;
+        }
+
+        struct body *body = task->bodies + orbit->index;
+        elements_to_state(&orbit->el, &body->pos, &body->vel);
+    }
+}
+
+static int parse_text(const char *path, const char *text, size_t len, struct thread_pool *pool,
+                      struct scenario *out) {
+    int n_chunks = (pool ? pool->n_threads : 1) * CHUNKS_PER_THREAD;
+    if ((size_t) n_chunks > len / MIN_CHUNK_SIZE) {
+        n_chunks = len / MIN_CHUNK_SIZE > 0 ? (int) (len / MIN_CHUNK_SIZE) : 1;
+    }
+
+    struct chunk *chunks = calloc(n_chunks, sizeof(*chunks));
+    if (!chunks) {
+        fprintf(stderr, "Failed to allocate the parser\n");
+        return 0;
+    }
+
+    // Split at evenly spaced offsets, each moved forward to the start of a line
+    const char *end = text + len;
+    const char *p = text;
+    for (int c = 0; c < n_chunks; ++c) {
+        const char *stop = c == n_chunks - 1 ? end : text + (size_t) (c + 1) * (len / n_chunks);
+        if (stop < p) {
+            stop = p;
+        }
+        if (stop < end && stop > text && stop[-1] != '\n') {
+            const char *nl = memchr(stop, '\n', end - stop);
+            stop = nl ? nl + 1 : end;
+        }
+
+        chunks[c].begin = p;
+        chunks[c].end = stop;
+        p = stop;
+    }
+
+    struct parse_task task = {chunks, 0, NULL, NULL, NULL};
+    run_parallel(pool, n_chunks, 1, count_task, &task);
+
+    long n_lines = 0;
+    long n_bodies = 0;
+    long n_orbits = 0;
+    long n_burns = 0;
+    for (int c = 0; c < n_chunks; ++c) {
+        chunks[c].first_line = n_lines + 1;
+        chunks[c].first_body = (int) n_bodies;
+        chunks[c].first_orbit = (int) n_orbits;
+        chunks[c].first_burn = (int) n_burns;
+        n_lines += chunks[c].n_lines;
+        n_bodies += chunks[c].n_bodies;
+        n_orbits += chunks[c].n_orbits;
+        n_burns += chunks[c].n_burns;
+    }
+
+    if (n_bodies == 0 || n_bodies > INT32_MAX || n_burns > INT32_MAX) {
+        fprintf(stderr, "'%s' has %s bodies\n", path, n_bodies == 0 ? "no" : "too many");
+        free(chunks);
+        return 0;
+    }
+
+    task.n_bodies = (int) n_bodies;
+    task.bodies = malloc(n_bodies * sizeof(struct body));
+    task.orbits = malloc((n_orbits ? n_orbits : 1) * sizeof(struct orbit_line));
+    task.burns = malloc((n_burns ? n_burns : 1) * sizeof(struct burn));
+    int ok = task.bodies && task.orbits && task.burns;
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate %ld bodies\n", n_bodies);
+    }
+
+    if (ok) {
+        run_parallel(pool, n_chunks, 1, parse_task, &task);
+        for (int c = 0; c < n_chunks && ok; ++c) {
+            if (chunks[c].error_line) {
+                fprintf(stderr, "%s:%ld: %s\n", path, chunks[c].error_line, chunks[c].error);
+                ok = 0;
+            }
+        }
+    }
+
+    if (ok) {
+        run_parallel(pool, (int) n_orbits, ORBIT_BLOCK_SIZE, orbit_task, &task);
+
+        // Primaries come first, so they are already absolute by the time they are added
+        for (long k = 0; k < n_orbits && ok; ++k) {
+            const struct orbit_line *orbit = task.orbits + k;
+            if (orbit->el.mu == 0.0) {
+                fprintf(stderr, "%s:%ld: orbit around a test particle\n", path, orbit->line);
+                ok = 0;
+                break;
+            }
+
+            struct body *body = task.bodies + orbit->index;
+            const struct body *primary = task.bodies + orbit->primary;
+            body->pos.x += primary->pos.x;
+            body->pos.y += primary->pos.y;
+            body->pos.z += primary->pos.z;
+            body->vel.x += primary->vel.x;
+            body->vel.y += primary->vel.y;
+            body->vel.z += primary->vel.z;
+        }
+    }
+
+    free(task.orbits);
+    free(chunks);
+    if (!ok) {
+        free(task.bodies);
+        free(task.burns);
+        return 0;
+    }
+
+    out->n_bodies = (int) n_bodies;
+    out->bodies = task.bodies;
+    out->burns.n_burns = (int) n_burns;
+    out->burns.cap = (int) n_burns;
+    out->burns.burns = task.burns;
+    sort_burns(&out->burns);
+    return 1;
+}
+
+int load_scenario_file(const char *path, struct thread_pool *pool, struct scenario *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "'%s' is empty\n", path);
+        close(fd);
+        return 0;
+    }
+
+    size_t len = st.st_size;
+    const char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    if (len >= sizeof(SNAPSHOT_MAGIC) && memcmp(map, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0) {
+        munmap((void *) map, len);
+
+        struct snapshot snap;
+        if (!load_snapshot(path, &snap)) {
+            return 0;
+        }
+
+        int ok = init_scenario_snapshot(&snap, out);
+        close_snapshot(&snap);
+        return ok;
+    }
+
+    // Every chunk is read once front to back, possibly all at the same time
+    madvise((void *) map, len, MADV_WILLNEED);
+
+    int ok = parse_text(path, map, len, pool, out);
+    munmap((void *) map, len);
+    return ok;
+}
+
+int save_scenario_file(const char *path, const struct scenario *scenario) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open '%s' for writing\n", path);
+        return 0;
+    }
+
+    for (int i = 0; i < scenario->n_bodies; ++i) {
+        const struct body *body = scenario->bodies + i;
+        fprintf(file, "body %.17g %.17g %.17g %.17g %.17g %.17g %.17g%s\n", body->mass,
+                body->pos.x, body->pos.y, body->pos.z, body->vel.x, body->vel.y, body->vel.z,
+                body->flags & BODY_TEST_PARTICLE ? " test" : "");
+    }
+
+    for (int k = 0; k < scenario->burns.n_burns; ++k) {
+        const struct burn *burn = scenario->burns.burns + k;
+        fprintf(file, "burn %d %.17g %.17g %s %.17g %.17g %.17g\n", burn->body, burn->start, burn->duration,
+                burn->frame == BURN_ORBIT ? "orbit" : "inertial", burn->force.x, burn->force.y, burn->force.z);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Failed to write '%s'\n", path);
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,31 @@
+#ifndef ORBITAL_SCENARIO_FILE_H
+#define ORBITAL_SCENARIO_FILE_H
+
+#include "scenario.h"
+#include "thread_pool.h"
+
+/*
+ * Loads a scenario from either a binary snapshot or the text
+ * format below. Text is parsed straight from a read-only
+ * mapping, in parallel chunks on pool when one is given.
+ *
+ *   # comment
+ *   body  <mass> <x> <y> <z> <vx> <vy> <vz> [test]
+ *   orbit <mass> <primary> <a> <e> <i> <raan> <argp> <nu> [test]
+ *   burn  <body> <start> <duration> inertial|orbit <f1> <f2> <f3>
+ *
+ * Bodies are numbered from 0 in the order they appear. An orbit
+ * is relative to an earlier body, with a in metres (negative for
+ * hyperbolas) and angles in degrees. "test" marks a test
+ * particle. Burn forces are in newtons: x, y and z, or
+ * prograde, normal and radial relative to body 0.
+ */
+int load_scenario_file(const char *path, struct thread_pool *pool, struct scenario *out);
+
+/*
+ * Writes the scenario as body and burn declarations, with
+ * enough digits that loading it back is exact.
+ */
+int save_scenario_file(const char *path, const struct scenario *scenario);
+
+#endif // ORBITAL_SCENARIO_FILE_H
@@ -2,6 +2,10 @@
 
 #include <SDL.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
 
 char *get_shader_src(const char *path) {
     FILE *file = fopen(path, "r");
@@ -43,16 +47,50 @@ char *get_shader_src(const char *path) {
     return buf;
 }
 
-int compile_shader(GLenum type, const char *shader_path, GLuint *shader_id) {
-    GLuint shader = glCreateShader(type);
-    char *src = get_shader_src(shader_path);
-    if (!src) {
-        return 0;
+struct program_entry {
+    uint64_t hash;
+    GLuint prog;
+    int refs;
+};
+
+static struct program_entry program_cache[PROGRAM_CACHE_SIZE];
+static int n_cached_programs = 0;
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+static uint64_t hash_str(uint64_t hash, const char *str) {
+    // The terminator is hashed too so that ("ab", "c") and ("a", "bc") differ
+    do {
+        hash ^= (unsigned char) *str;
+        hash *= FNV_PRIME;
+    } while (*str++);
+
+    return hash;
+}
+
+/*
+ * Program binaries are only valid for the driver that produced
+ * them, so the driver strings are part of the key and an update
+ * simply misses the cache.
+ */
+static uint64_t program_hash(const char *vs_src, const char *fs_src) {
+    uint64_t hash = FNV_OFFSET;
+    hash = hash_str(hash, vs_src);
+    hash = hash_str(hash, fs_src);
+
+    GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for (int i = 0; i < 3; ++i) {
+        const char *str = (const char *) glGetString(names[i]);
+        hash = hash_str(hash, str ? str : "");
     }
 
-    glShaderSource(shader, 1, &src, NULL);
-    free(src);
+    return hash;
+}
 
+static int compile_src(GLenum type, const char *src, GLuint *shader_id) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &src, NULL);
     glCompileShader(shader);
 
     GLint compile_ec = GL_FALSE;
@@ -62,6 +100,7 @@ int compile_shader(GLenum type, const char *shader_path, GLuint *shader_id) {
         glGetShaderInfoLog(shader, 1024, NULL, log);
         fprintf(stderr, "Failed to compile shader: %s\n", log);
 
+        glDeleteShader(shader);
         return 0;
     }
 
@@ -69,19 +108,28 @@ int compile_shader(GLenum type, const char *shader_path, GLuint *shader_id) {
     return 1;
 }
 
-int create_prog(const char *vs_path, const char *fs_path, GLuint *prog_id) {
+static int check_link(GLuint prog) {
+    GLint prog_ec = GL_FALSE;
+    glGetProgramiv(prog, GL_LINK_STATUS, &prog_ec);
+    return prog_ec == GL_TRUE;
+}
+
+static int link_src(const char *vs_src, const char *fs_src, GLuint *prog_id) {
     GLuint vs;
-    if (!compile_shader(GL_VERTEX_SHADER, vs_path, &vs)) {
+    if (!compile_src(GL_VERTEX_SHADER, vs_src, &vs)) {
         return 0;
     }
 
     GLuint fs;
-    if (!compile_shader(GL_FRAGMENT_SHADER, fs_path, &fs)) {
+    if (!compile_src(GL_FRAGMENT_SHADER, fs_src, &fs)) {
+        glDeleteShader(vs);
         return 0;
     }
 
     GLuint prog = glCreateProgram();
-    glUseProgram(prog);
+    if (GLEW_ARB_get_program_binary) {
+        glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
 
     glAttachShader(prog, vs);
     glAttachShader(prog, fs);
@@ -89,23 +137,208 @@ int create_prog(const char *vs_path, const char *fs_path, GLuint *prog_id) {
     glDeleteShader(vs);
     glDeleteShader(fs);
 
-    GLint prog_ec = GL_FALSE;
-    glGetProgramiv(prog, GL_LINK_STATUS, &prog_ec);
-    if (prog_ec != GL_TRUE) {
+    if (!check_link(prog)) {
         char log[1024];
-        glGetProgramInfoLog(vs, 1024, NULL, log);
+        glGetProgramInfoLog(prog, 1024, NULL, log);
         fprintf(stderr, "Failed to link the shader pipeline: %s\n", log);
 
+        glDeleteProgram(prog);
+        return 0;
+    }
+
+    *prog_id = prog;
+    return 1;
+}
+
+static void binary_path(uint64_t hash, char *path, size_t len) {
+    snprintf(path, len, "%s/%016llx.bin", PROGRAM_CACHE_DIR, (unsigned long long) hash);
+}
+
+/*
+ * The file is the binary format followed by the driver's blob.
+ * A blob the driver rejects is treated as a miss rather than
+ * an error, since drivers may drop old formats at any time.
+ */
+static int load_program_binary(uint64_t hash, GLuint *prog_id) {
+    if (!GLEW_ARB_get_program_binary) {
+        return 0;
+    }
+
+    char path[256];
+    binary_path(hash, path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+
+    GLenum format;
+    long length = 0;
+    void *blob = NULL;
+    if (fread(&format, sizeof(format), 1, file) == 1 && fseek(file, 0, SEEK_END) == 0) {
+        length = ftell(file) - (long) sizeof(format);
+        if (length > 0 && fseek(file, sizeof(format), SEEK_SET) == 0) {
+            blob = malloc(length);
+        }
+    }
+
+    int ok = blob && fread(blob, 1, length, file) == (size_t) length;
+    fclose(file);
+
+    if (ok) {
+        GLuint prog = glCreateProgram();
+        glProgramBinary(prog, format, blob, (GLsizei) length);
+        ok = check_link(prog);
+        if (ok) {
+            *prog_id = prog;
+        } else {
+            glDeleteProgram(prog);
+        }
+    }
+
+    free(blob);
+    return ok;
+}
+
+static void save_program_binary(uint64_t hash, GLuint prog) {
+    if (!GLEW_ARB_get_program_binary) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    void *blob = malloc(length);
+    if (!blob) {
+        return;
+    }
+
+    GLenum format;
+    glGetProgramBinary(prog, length, &length, &format, blob);
+
+    if (mkdir(PROGRAM_CACHE_DIR, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create '%s': %s\n", PROGRAM_CACHE_DIR, strerror(errno));
+        free(blob);
+        return;
+    }
+
+    // Written beside the final path and renamed so a crash never leaves half a binary
+    char path[256];
+    char tmp_path[272];
+    binary_path(hash, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file) {
+        int ok = fwrite(&format, sizeof(format), 1, file) == 1 &&
+                 fwrite(blob, 1, length, file) == (size_t) length;
+        ok &= fclose(file) == 0;
+        if (!ok || rename(tmp_path, path) != 0) {
+            fprintf(stderr, "Failed to write program binary '%s'\n", path);
+            remove(tmp_path);
+        }
+    }
+
+    free(blob);
+}
+
+int compile_shader(GLenum type, const char *shader_path, GLuint *shader_id) {
+    char *src = get_shader_src(shader_path);
+    if (!src) {
+        return 0;
+    }
+
+    int ok = compile_src(type, src, shader_id);
+    free(src);
+    return ok;
+}
+
+int create_prog(const char *vs_path, const char *fs_path, GLuint *prog_id) {
+    char *vs_src = get_shader_src(vs_path);
+    char *fs_src = get_shader_src(fs_path);
+
+    int ok = vs_src && fs_src && link_src(vs_src, fs_src, prog_id);
+    free(vs_src);
+    free(fs_src);
+    return ok;
+}
+
+/*
+ * Wrappers with the same sources share one program. Lookup
+ * order is the in-memory cache, then the on-disk binaries,
+ * and only then a full compile and link.
+ */
+int acquire_prog(const char *vs_path, const char *fs_path, GLuint *prog_id) {
+    char *vs_src = get_shader_src(vs_path);
+    char *fs_src = get_shader_src(fs_path);
+    if (!vs_src || !fs_src) {
+        free(vs_src);
+        free(fs_src);
+        return 0;
+    }
+
+    uint64_t hash = program_hash(vs_src, fs_src);
+    for (int i = 0; i < n_cached_programs; ++i) {
+        if (program_cache[i].hash == hash) {
+            program_cache[i].refs++;
+            *prog_id = program_cache[i].prog;
+
+            free(vs_src);
+            free(fs_src);
+            return 1;
+        }
+    }
+
+    if (n_cached_programs == PROGRAM_CACHE_SIZE) {
+        fprintf(stderr, "Too many distinct shader programs\n");
+        free(vs_src);
+        free(fs_src);
+        return 0;
+    }
+
+    GLuint prog;
+    int ok = load_program_binary(hash, &prog);
+    if (!ok) {
+        ok = link_src(vs_src, fs_src, &prog);
+        if (ok) {
+            save_program_binary(hash, prog);
+        }
+    }
+    free(vs_src);
+    free(fs_src);
+
+    if (!ok) {
         return 0;
     }
 
+    struct program_entry entry = {hash, prog, 1};
+    program_cache[n_cached_programs++] = entry;
     *prog_id = prog;
     return 1;
 }
 
+void release_prog(GLuint prog) {
+    for (int i = 0; i < n_cached_programs; ++i) {
+        if (program_cache[i].prog != prog) {
+            continue;
+        }
+
+        if (--program_cache[i].refs == 0) {
+            glDeleteProgram(prog);
+            program_cache[i] = program_cache[--n_cached_programs];
+        }
+        return;
+    }
+
+    glDeleteProgram(prog);
+}
+
 int bind_shader(const char *vs_src, const char *fs_src, struct gl_shader_wrapper *out) {
     GLuint prog;
-    if (!create_prog(vs_src, fs_src, &prog)) {
+    if (!acquire_prog(vs_src, fs_src, &prog)) {
         return 0;
     }
 
@@ -116,12 +349,41 @@ int bind_shader(const char *vs_src, const char *fs_src, struct gl_shader_wrapper
     glGenBuffers(1, &vbo);
     glGenVertexArrays(1, &vao);
 
-    struct gl_shader_wrapper wrapper = {prog, vbo, vao, 0};
+    // Locations are per program, but values are uploaded per wrapper since programs are shared
+    struct gl_shader_wrapper wrapper = {
+            prog, vbo, vao,
+            glGetUniformLocation(prog, "in_color"), glGetUniformLocation(prog, "transform"),
+            {1.0F, 1.0F, 1.0F, 1.0F},
+            {1.0F, 0.0F, 0.0F, 0.0F, 0.0F, 1.0F, 0.0F, 0.0F, 0.0F, 0.0F, 1.0F, 0.0F, 0.0F, 0.0F, 0.0F, 1.0F},
+            0, 0, NULL, INSTANCE_NONE, 0, 0, 0
+    };
     *out = wrapper;
 
     return 1;
 }
 
+void set_shader_color(struct gl_shader_wrapper *wrapper, float r, float g, float b, float a) {
+    wrapper->color[0] = r;
+    wrapper->color[1] = g;
+    wrapper->color[2] = b;
+    wrapper->color[3] = a;
+}
+
+void set_shader_transform(struct gl_shader_wrapper *wrapper, const float *transform) {
+    memcpy(wrapper->transform, transform, sizeof(wrapper->transform));
+}
+
+static void use_shader(const struct gl_shader_wrapper *wrapper) {
+    glUseProgram(wrapper->prog);
+    if (wrapper->color_loc >= 0) {
+        glUniform4fv(wrapper->color_loc, 1, wrapper->color);
+    }
+    if (wrapper->transform_loc >= 0) {
+        glUniformMatrix4fv(wrapper->transform_loc, 1, GL_FALSE, wrapper->transform);
+    }
+    glBindVertexArray(wrapper->vao);
+}
+
 void buffer_data_2f(struct gl_shader_wrapper *wrapper, int n_points, size_t arr_len, const float *arr) {
     glUseProgram(wrapper->prog);
 
@@ -138,14 +400,184 @@ void buffer_data_2f(struct gl_shader_wrapper *wrapper, int n_points, size_t arr_
     wrapper->n_points = n_points;
 }
 
-void draw_shader_arrays(struct gl_shader_wrapper *wrapper, GLenum mode) {
+/*
+ * Allocates room for cap ring slots plus one mirror of slot 0
+ * so that a full ring can be drawn as a line strip in two
+ * ranges without a gap at the wrap point. The buffer is mapped
+ * persistently when ARB_buffer_storage is available; otherwise
+ * each point is written with glBufferSubData.
+ */
+int init_stream_buffer(struct gl_shader_wrapper *wrapper, int cap) {
+    GLsizeiptr len = 2 * (cap + 1) * sizeof(float);
+
+    glUseProgram(wrapper->prog);
+    glBindVertexArray(wrapper->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, wrapper->vbo);
+
+    wrapper->mapped = NULL;
+    if (GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, len, NULL, flags);
+        wrapper->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, len, flags);
+    }
+
+    if (!wrapper->mapped) {
+        glBufferData(GL_ARRAY_BUFFER, len, NULL, GL_DYNAMIC_DRAW);
+    }
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        fprintf(stderr, "Failed to allocate stream buffer: %s\n", gluErrorString(error));
+        return 0;
+    }
+
+    wrapper->cap = cap;
+    wrapper->n_points = 0;
+    return 1;
+}
+
+/*
+ * Only the newest vertex is written. With a coherent mapping
+ * a frame still in flight may see that single vertex change,
+ * which at worst moves the oldest end of the trail by one step.
+ */
+void stream_point_2f(struct gl_shader_wrapper *wrapper, int slot, float x, float y) {
+    float point[] = {x, y};
+
+    if (wrapper->mapped) {
+        wrapper->mapped[2 * slot] = x;
+        wrapper->mapped[2 * slot + 1] = y;
+        if (slot == 0) {
+            wrapper->mapped[2 * wrapper->cap] = x;
+            wrapper->mapped[2 * wrapper->cap + 1] = y;
+        }
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, wrapper->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 2 * slot * sizeof(float), sizeof(point), point);
+    if (slot == 0) {
+        glBufferSubData(GL_ARRAY_BUFFER, 2 * wrapper->cap * sizeof(float), sizeof(point), point);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/*
+ * Instance attributes advance once per instance when drawing
+ * a mesh. Point sprites have no mesh, so the same attributes
+ * advance per vertex and each instance becomes one point.
+ */
+int init_instance_buffer(struct gl_shader_wrapper *wrapper, enum instance_mode mode, int cap) {
+    GLuint divisor = mode == INSTANCE_MESH ? 1 : 0;
+
     glUseProgram(wrapper->prog);
     glBindVertexArray(wrapper->vao);
+
+    glGenBuffers(1, &wrapper->instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, wrapper->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, cap * sizeof(struct gl_instance), NULL, GL_STREAM_DRAW);
+
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct gl_instance),
+                          (void *) offsetof(struct gl_instance, x));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, divisor);
+
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(struct gl_instance),
+                          (void *) offsetof(struct gl_instance, color));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, divisor);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        fprintf(stderr, "Failed to allocate instance buffer: %s\n", gluErrorString(error));
+        return 0;
+    }
+
+    if (mode == INSTANCE_POINTS) {
+        glEnable(GL_PROGRAM_POINT_SIZE);
+    }
+
+    wrapper->instance_mode = mode;
+    wrapper->instance_cap = cap;
+    wrapper->n_instances = 0;
+    return 1;
+}
+
+/*
+ * Called once per frame. The old storage is orphaned first so
+ * the upload never waits on a frame that is still drawing it.
+ */
+int update_instances(struct gl_shader_wrapper *wrapper, int n_instances, const struct gl_instance *instances) {
+    if (n_instances > wrapper->instance_cap) {
+        fprintf(stderr, "Too many instances (%d > %d)\n", n_instances, wrapper->instance_cap);
+        return 0;
+    }
+
+    GLsizeiptr cap_len = wrapper->instance_cap * sizeof(struct gl_instance);
+    glBindBuffer(GL_ARRAY_BUFFER, wrapper->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, cap_len, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, n_instances * sizeof(struct gl_instance), instances);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    wrapper->n_instances = n_instances;
+    return 1;
+}
+
+void draw_instances(struct gl_shader_wrapper *wrapper, GLenum mode) {
+    if (wrapper->n_instances == 0) {
+        return;
+    }
+
+    use_shader(wrapper);
+
+    if (wrapper->instance_mode == INSTANCE_POINTS) {
+        glDrawArrays(GL_POINTS, 0, wrapper->n_instances);
+    } else {
+        glDrawArraysInstanced(mode, 0, wrapper->n_points, wrapper->n_instances);
+    }
+}
+
+void draw_shader_arrays(struct gl_shader_wrapper *wrapper, GLenum mode) {
+    use_shader(wrapper);
     glDrawArrays(mode, 0, wrapper->n_points);
 }
 
+void draw_ring_strip(struct gl_shader_wrapper *wrapper, int first, int count) {
+    use_shader(wrapper);
+
+    if (first + count <= wrapper->cap) {
+        glDrawArrays(GL_LINE_STRIP, first, count);
+        return;
+    }
+
+    // The run to the end of the ring continues through the mirrored slot 0, then resumes from 0
+    GLint firsts[] = {first, 0};
+    GLsizei counts[] = {wrapper->cap - first + 1, count - (wrapper->cap - first)};
+    glMultiDrawArrays(GL_LINE_STRIP, firsts, counts, 2);
+}
+
 void destroy_shader(struct gl_shader_wrapper *wrapper) {
+    if (wrapper->mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, wrapper->vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        wrapper->mapped = NULL;
+    }
+
+    if (wrapper->instance_vbo) {
+        glDeleteBuffers(1, &wrapper->instance_vbo);
+    }
+
     glDeleteVertexArrays(1, &wrapper->vao);
     glDeleteBuffers(1, &wrapper->vbo);
-    glDeleteProgram(wrapper->prog);
+    release_prog(wrapper->prog);
 }
@@ -3,12 +3,50 @@
 
 #include <GL/glew.h>
 
+#define PROGRAM_CACHE_SIZE 16
+#define PROGRAM_CACHE_DIR "./shader_cache"
+
+enum instance_mode {
+    INSTANCE_NONE,
+    INSTANCE_MESH,
+    INSTANCE_POINTS
+};
+
 struct gl_shader_wrapper {
     GLuint prog;
     GLuint vbo;
     GLuint vao;
 
+    GLint color_loc;
+    GLint transform_loc;
+    float color[4];
+    float transform[16];
+
     int n_points;
+
+    // Ring-buffer streaming state, see init_stream_buffer
+    int cap;
+    float *mapped;
+
+    // Per-instance state, see init_instance_buffer
+    enum instance_mode instance_mode;
+    GLuint instance_vbo;
+    int instance_cap;
+    int n_instances;
+};
+
+/*
+ * Matches the layout consumed by the instanced shaders:
+ * location 1 is (x, y, angle, size) and location 2 the colour.
+ * size scales the mesh, or is the diameter in pixels when
+ * drawn as point sprites.
+ */
+struct gl_instance {
+    float x;
+    float y;
+    float angle;
+    float size;
+    float color[4];
 };
 
 char *get_shader_src(const char *path);
@@ -17,12 +55,32 @@ int compile_shader(GLenum type, const char *shader_path, GLuint *shader_id);
 
 int create_prog(const char *vs_path, const char *fs_path, GLuint *prog_id);
 
+int acquire_prog(const char *vs_path, const char *fs_path, GLuint *prog_id);
+
+void release_prog(GLuint prog);
+
 int bind_shader(const char *vs_src, const char *fs_src, struct gl_shader_wrapper *out);
 
+void set_shader_color(struct gl_shader_wrapper *wrapper, float r, float g, float b, float a);
+
+void set_shader_transform(struct gl_shader_wrapper *wrapper, const float *transform);
+
 void buffer_data_2f(struct gl_shader_wrapper *wrapper, int n_points, size_t arr_len, const float *arr);
 
+int init_stream_buffer(struct gl_shader_wrapper *wrapper, int cap);
+
+void stream_point_2f(struct gl_shader_wrapper *wrapper, int slot, float x, float y);
+
+int init_instance_buffer(struct gl_shader_wrapper *wrapper, enum instance_mode mode, int cap);
+
+int update_instances(struct gl_shader_wrapper *wrapper, int n_instances, const struct gl_instance *instances);
+
+void draw_instances(struct gl_shader_wrapper *wrapper, GLenum mode);
+
 void draw_shader_arrays(struct gl_shader_wrapper *wrapper, GLenum mode);
 
+void draw_ring_strip(struct gl_shader_wrapper *wrapper, int first, int count);
+
 void destroy_shader(struct gl_shader_wrapper *wrapper);
 
 #endif // ORBITAL_SHADER_UTIL_H
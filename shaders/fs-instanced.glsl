@@ -0,0 +1,8 @@
+#version 460
+
+in vec4 color;
+out vec4 out_color;
+
+void main() {
+    out_color = color;
+}
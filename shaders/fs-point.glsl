@@ -0,0 +1,14 @@
+#version 460
+
+in vec4 color;
+out vec4 out_color;
+
+void main() {
+    // Round off the square sprite
+    vec2 d = gl_PointCoord - vec2(0.5);
+    if (dot(d, d) > 0.25) {
+        discard;
+    }
+
+    out_color = color;
+}
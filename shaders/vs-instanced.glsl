@@ -0,0 +1,17 @@
+#version 460
+
+layout (location = 0) in vec2 in_pos;
+// x, y, angle, size
+layout (location = 1) in vec4 in_place;
+layout (location = 2) in vec4 in_instance_color;
+
+out vec4 color;
+
+void main() {
+    float c = cos(in_place.z);
+    float s = sin(in_place.z);
+    vec2 pos = mat2(c, s, -s, c) * (in_pos * in_place.w) + in_place.xy;
+
+    gl_Position = vec4(pos, 0.0, 1.0);
+    color = in_instance_color;
+}
@@ -0,0 +1,13 @@
+#version 460
+
+// x, y, angle, size
+layout (location = 1) in vec4 in_place;
+layout (location = 2) in vec4 in_instance_color;
+
+out vec4 color;
+
+void main() {
+    gl_Position = vec4(in_place.xy, 0.0, 1.0);
+    gl_PointSize = in_place.w;
+    color = in_instance_color;
+}
@@ -0,0 +1,197 @@
+#include "simulation.h"
+#include "scenario.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// 5 s of simulated time per 20 ms frame
+static const double DEFAULT_TIME_WARP = 250.0;
+
+int init_simulation(int n_bodies, const struct body *bodies, struct system_workspace *ws, double dt,
+                    struct simulation *out) {
+    size_t len = n_bodies * sizeof(struct body);
+    struct simulation sim = {
+            n_bodies, malloc(len), malloc(len), ws,
+            n_bodies > 1 ? 1 : 0, F9_2_THRUST, IDLE, NULL,
+            {0.0, 0.0, 0.0, 0, 0.0, 0, 0.0, 0}, dt, 0.0, 0.0, 0, 0
+    };
+    init_time_warp(DEFAULT_TIME_WARP, &sim.warp);
+    if (!sim.bodies || !sim.initial) {
+        fprintf(stderr, "Failed to allocate the simulation\n");
+        free(sim.bodies);
+        free(sim.initial);
+        return 0;
+    }
+
+    memcpy(sim.bodies, bodies, len);
+    memcpy(sim.initial, bodies, len);
+    *out = sim;
+
+    return 1;
+}
+
+void destroy_simulation(struct simulation *sim) {
+    free(sim->bodies);
+    free(sim->initial);
+    sim->bodies = NULL;
+    sim->initial = NULL;
+}
+
+static double mag(struct vector v) {
+    return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+static struct vector cross(struct vector a, struct vector b) {
+    struct vector result = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+    return result;
+}
+
+/*
+ * UP and DOWN are prograde and retrograde; LEFT and RIGHT are
+ * perpendicular to the velocity in the orbital plane.
+ */
+struct vector thrust_vector(enum direction dir, double thrust, struct vector vel) {
+    switch (dir) {
+        case LEFT:
+        case RIGHT: {
+            struct vector axis = {0.0, 0.0, 1.0};
+            struct vector cx = cross(vel, axis);
+            double cx_mag = mag(cx);
+            double sign = dir == LEFT ? -1.0 : 1.0;
+
+            struct vector result = {sign * thrust * cx.x / cx_mag, sign * thrust * cx.y / cx_mag,
+                                    sign * thrust * cx.z / cx_mag};
+            return result;
+        }
+        case UP:
+        case DOWN: {
+            double v = mag(vel);
+            double sign = dir == DOWN ? -1.0 : 1.0;
+
+            struct vector result = {sign * thrust * vel.x / v, sign * thrust * vel.y / v, sign * thrust * vel.z / v};
+            return result;
+        }
+        default: {
+            struct vector zero = {0.0, 0.0, 0.0};
+            return zero;
+        }
+    }
+}
+
+void apply_command(struct simulation *sim, const struct sim_command *cmd) {
+    switch (cmd->type) {
+        case CMD_THRUST:
+            sim->dir = cmd->dir;
+            if (sim->dir == IDLE) {
+                struct vector zero = {0.0, 0.0, 0.0};
+                sim->bodies[sim->controlled].F_net_ext = zero;
+            }
+            break;
+        case CMD_RESET:
+            memcpy(sim->bodies, sim->initial, sim->n_bodies * sizeof(struct body));
+            sim->dir = IDLE;
+            sim->time = sim->initial_time;
+            sim->epoch++;
+            break;
+        case CMD_WARP:
+            set_time_warp(&sim->warp, sim->warp.requested * cmd->value);
+            break;
+        default:
+            break;
+    }
+}
+
+int is_thrusting(const struct simulation *sim) {
+    return sim->dir != IDLE || (sim->burns && is_burning(sim->burns, sim->time));
+}
+
+int step_simulation(struct simulation *sim) {
+    if (sim->burns) {
+        apply_burns(sim->burns, sim->time, sim->dt, sim->n_bodies, sim->bodies);
+    }
+
+    struct body *controlled = sim->bodies + sim->controlled;
+    if (sim->dir != IDLE) {
+        controlled->F_net_ext = thrust_vector(sim->dir, sim->thrust, controlled->vel);
+    }
+
+    if (!advance_system(sim->ws, sim->dt, sim->n_bodies, sim->bodies)) {
+        return 0;
+    }
+
+    sim->time += sim->dt;
+    sim->step++;
+    return 1;
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Advances by real_sec times the requested warp, split into
+ * equal sub-steps no longer than the step budget. When that
+ * would take more than max_substeps, or the sub-steps overrun
+ * max_wall_sec, less time is simulated and the warp actually
+ * achieved is left in sim->warp.effective. Analytic coasts
+ * cover the whole span in one step, but stop at the start of
+ * the next scheduled burn.
+ */
+static int advance(struct simulation *sim, double real_sec, double max_wall_sec, int max_done) {
+    struct time_warp *tw = &sim->warp;
+    int thrusting = is_thrusting(sim);
+    double span = tw->requested * real_sec;
+    if (thrusting && tw->requested > tw->burn_warp) {
+        span = tw->burn_warp * real_sec;
+    }
+    if (sim->burns) {
+        double next = next_burn_start(sim->burns, sim->time);
+        if (sim->time + span > next) {
+            span = next - sim->time;
+        }
+    }
+
+    int n_substeps = 1;
+    if (thrusting || !is_analytic_coast(sim->n_bodies, sim->bodies)) {
+        double budget = step_budget(tw->eta, sim->n_bodies, sim->bodies);
+        double needed = ceil(span / budget);
+        n_substeps = needed < 1.0 ? 1 : needed > tw->max_substeps ? tw->max_substeps : (int) needed;
+        if (span > n_substeps * budget) {
+            span = n_substeps * budget;
+        }
+    }
+
+    sim->dt = span / n_substeps;
+    double begin = now_sec();
+    int done = 0;
+    int limit = max_done < n_substeps ? max_done : n_substeps;
+    while (done < limit) {
+        if (!step_simulation(sim)) {
+            return 0;
+        }
+        done++;
+
+        if (max_wall_sec < INFINITY && now_sec() - begin > max_wall_sec) {
+            break;
+        }
+    }
+
+    tw->substeps = done;
+    tw->cut_short = done < n_substeps;
+    tw->substep_dt = sim->dt;
+    tw->effective = done * sim->dt / real_sec;
+    return 1;
+}
+
+int advance_simulation(struct simulation *sim, double real_sec, double max_wall_sec) {
+    return advance(sim, real_sec, max_wall_sec, sim->warp.max_substeps);
+}
+
+int repeat_advance(struct simulation *sim, double real_sec, int max_done) {
+    return advance(sim, real_sec, INFINITY, max_done);
+}
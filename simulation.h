@@ -0,0 +1,78 @@
+#ifndef ORBITAL_SIMULATION_H
+#define ORBITAL_SIMULATION_H
+
+#include "system.h"
+#include "burn.h"
+#include "timewarp.h"
+
+enum direction {
+    IDLE,
+    LEFT,
+    RIGHT,
+    UP,
+    DOWN
+};
+
+enum sim_command_type {
+    CMD_THRUST,
+    CMD_RESET,
+    // Multiplies the requested time warp by value
+    CMD_WARP
+};
+
+struct sim_command {
+    enum sim_command_type type;
+    enum direction dir;
+    double value;
+};
+
+/*
+ * A running system plus the controls applied to it. Commands
+ * only take effect between steps, so the trajectory depends
+ * solely on the initial state and which step each command
+ * arrived before. burns, when set, is applied before every
+ * step, with manual thrust on the controlled body on top.
+ */
+struct simulation {
+    int n_bodies;
+    struct body *bodies;
+    struct body *initial;
+    struct system_workspace *ws;
+
+    int controlled;
+    double thrust;
+    enum direction dir;
+    struct burn_schedule *burns;
+
+    struct time_warp warp;
+    double dt;
+    double time;
+    double initial_time;
+    long step;
+    int epoch;
+};
+
+int init_simulation(int n_bodies, const struct body *bodies, struct system_workspace *ws, double dt,
+                    struct simulation *out);
+
+void destroy_simulation(struct simulation *sim);
+
+struct vector thrust_vector(enum direction dir, double thrust, struct vector vel);
+
+void apply_command(struct simulation *sim, const struct sim_command *cmd);
+
+int is_thrusting(const struct simulation *sim);
+
+int step_simulation(struct simulation *sim);
+
+int advance_simulation(struct simulation *sim, double real_sec, double max_wall_sec);
+
+/*
+ * Repeats a frame of advance_simulation with the same span and
+ * sub-steps, but stops after max_done sub-steps rather than on
+ * the wall clock, so a recorded frame that was cut short comes
+ * out the same on any machine.
+ */
+int repeat_advance(struct simulation *sim, double real_sec, int max_done);
+
+#endif // ORBITAL_SIMULATION_H
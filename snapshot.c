@@ -0,0 +1,297 @@
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Records are read in place, so struct body must have no padding
+_Static_assert(sizeof(struct body) == 14 * sizeof(double), "struct body is not packed");
+_Static_assert(sizeof(struct snapshot_header) % sizeof(double) == 0, "snapshot header breaks alignment");
+
+static uint32_t swap32(uint32_t v) {
+    return __builtin_bswap32(v);
+}
+
+static uint64_t swap64(uint64_t v) {
+    return __builtin_bswap64(v);
+}
+
+static double swap_double(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bits = swap64(bits);
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+static void swap_body(const struct body *src, struct body *dst) {
+    const double *in = (const double *) src;
+    double *out = (double *) dst;
+    for (size_t i = 0; i < offsetof(struct body, flags) / sizeof(double); ++i) {
+        out[i] = swap_double(in[i]);
+    }
+
+    dst->flags = (int) swap32((uint32_t) src->flags);
+    dst->reserved = (int) swap32((uint32_t) src->reserved);
+}
+
+static void swap_header(struct snapshot_header *header) {
+    header->version = swap32(header->version);
+    header->header_size = swap32(header->header_size);
+    header->body_size = swap32(header->body_size);
+    header->n_bodies = swap64(header->n_bodies);
+    header->time = swap_double(header->time);
+    header->step = (int64_t) swap64((uint64_t) header->step);
+}
+
+static int check_header(const char *path, const struct snapshot_header *header, size_t len) {
+    if (header->version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "'%s' is snapshot version %u, expected %d\n", path, header->version, SNAPSHOT_VERSION);
+        return 0;
+    }
+
+    if (header->header_size != sizeof(struct snapshot_header) || header->body_size != sizeof(struct body)) {
+        fprintf(stderr, "'%s' has an unexpected record layout\n", path);
+        return 0;
+    }
+
+    if (header->n_bodies > (uint64_t) INT32_MAX ||
+        (len - header->header_size) / header->body_size < header->n_bodies) {
+        fprintf(stderr, "'%s' is truncated\n", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Maps the file read-only and uses the records in place, so a
+ * snapshot of the writer's byte order loads without parsing.
+ * Only a foreign byte order pays for a swapped copy.
+ */
+int load_snapshot(const char *path, struct snapshot *out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct snapshot_header)) {
+        fprintf(stderr, "'%s' is not a snapshot\n", path);
+        close(fd);
+        return 0;
+    }
+
+    size_t len = st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map '%s': %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    struct snapshot_header header;
+    memcpy(&header, map, sizeof(header));
+    int native = header.endian == SNAPSHOT_ENDIAN_MARK;
+    if (!native) {
+        swap_header(&header);
+    }
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        (!native && header.endian != swap32(SNAPSHOT_ENDIAN_MARK))) {
+        fprintf(stderr, "'%s' is not a snapshot\n", path);
+        munmap(map, len);
+        return 0;
+    }
+
+    if (!check_header(path, &header, len)) {
+        munmap(map, len);
+        return 0;
+    }
+
+    struct snapshot snap = {
+            (int) header.n_bodies, header.time, (long) header.step,
+            (const struct body *) ((const char *) map + header.header_size),
+            map, len, NULL
+    };
+
+    if (!native) {
+        struct body *swapped = malloc(header.n_bodies * sizeof(struct body));
+        if (!swapped) {
+            fprintf(stderr, "Failed to allocate %d bodies\n", snap.n_bodies);
+            munmap(map, len);
+            return 0;
+        }
+
+        for (int i = 0; i < snap.n_bodies; ++i) {
+            swap_body(snap.bodies + i, swapped + i);
+        }
+
+        snap.swapped = swapped;
+        snap.bodies = snap.swapped;
+    }
+
+    *out = snap;
+    return 1;
+}
+
+void close_snapshot(struct snapshot *snap) {
+    if (snap->map) {
+        munmap(snap->map, snap->map_len);
+    }
+    free(snap->swapped);
+
+    snap->map = NULL;
+    snap->swapped = NULL;
+    snap->bodies = NULL;
+}
+
+/*
+ * Writes to a temporary file beside path and renames it over
+ * path once it is on disk, so a crash mid-checkpoint leaves the
+ * previous snapshot intact.
+ */
+int save_snapshot(const char *path, double time, long step, int n_bodies, const struct body *bodies) {
+    size_t path_len = strlen(path);
+    char *tmp_path = malloc(path_len + 5);
+    if (!tmp_path) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 0;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.endian = SNAPSHOT_ENDIAN_MARK;
+    header.header_size = sizeof(header);
+    header.body_size = sizeof(struct body);
+    header.n_bodies = n_bodies;
+    header.time = time;
+    header.step = step;
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Failed to open '%s' for writing: %s\n", tmp_path, strerror(errno));
+        free(tmp_path);
+        return 0;
+    }
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(bodies, sizeof(struct body), n_bodies, file) == (size_t) n_bodies &&
+             fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok &= fclose(file) == 0;
+    ok = ok && rename(tmp_path, path) == 0;
+
+    if (!ok) {
+        fprintf(stderr, "Failed to write snapshot '%s': %s\n", path, strerror(errno));
+        remove(tmp_path);
+    }
+
+    free(tmp_path);
+    return ok;
+}
+
+static void *run_snapshot_writer(void *arg) {
+    struct snapshot_writer *writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+    while (1) {
+        while (!writer->has_pending && !writer->stop) {
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        }
+        if (!writer->has_pending) {
+            break;
+        }
+
+        struct body *bodies = writer->pending;
+        writer->pending = writer->writing;
+        writer->writing = bodies;
+        double time = writer->time;
+        long step = writer->step;
+        writer->has_pending = 0;
+        pthread_mutex_unlock(&writer->lock);
+
+        int ok = save_snapshot(writer->path, time, step, writer->n_bodies, bodies);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->n_failed += !ok;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+int open_snapshot_writer(const char *path, int n_bodies, struct snapshot_writer *out) {
+    out->path = path;
+    out->n_bodies = n_bodies;
+    out->pending = malloc(n_bodies * sizeof(struct body));
+    out->writing = malloc(n_bodies * sizeof(struct body));
+    out->time = 0.0;
+    out->step = 0;
+    out->has_pending = 0;
+    out->stop = 0;
+    out->n_failed = 0;
+
+    if (n_bodies > 0 && (!out->pending || !out->writing)) {
+        fprintf(stderr, "Failed to allocate the snapshot writer\n");
+        free(out->pending);
+        free(out->writing);
+        return 0;
+    }
+
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->cond, NULL);
+    if (pthread_create(&out->thread, NULL, run_snapshot_writer, out) != 0) {
+        fprintf(stderr, "Failed to start the snapshot writer\n");
+        pthread_cond_destroy(&out->cond);
+        pthread_mutex_destroy(&out->lock);
+        free(out->pending);
+        free(out->writing);
+        return 0;
+    }
+
+    return 1;
+}
+
+int submit_snapshot(struct snapshot_writer *writer, double time, long step, const struct body *bodies) {
+    pthread_mutex_lock(&writer->lock);
+    memcpy(writer->pending, bodies, writer->n_bodies * sizeof(struct body));
+    writer->time = time;
+    writer->step = step;
+    writer->has_pending = 1;
+    int ok = writer->n_failed == 0;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    return ok;
+}
+
+int close_snapshot_writer(struct snapshot_writer *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    int ok = writer->n_failed == 0;
+    if (!ok) {
+        fprintf(stderr, "%ld snapshots to '%s' failed\n", writer->n_failed, writer->path);
+    }
+
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->pending);
+    free(writer->writing);
+    writer->pending = NULL;
+    writer->writing = NULL;
+    return ok;
+}
@@ -0,0 +1,87 @@
+#ifndef ORBITAL_SNAPSHOT_H
+#define ORBITAL_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "system.h"
+
+#define SNAPSHOT_MAGIC "ORBSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_ENDIAN_MARK 0x01020304u
+
+/*
+ * On-disk layout: this header followed directly by n_bodies
+ * struct body records, all in the writer's byte order. The
+ * marker tells a reader whether that matches its own. The
+ * header is a multiple of 8 bytes so the records stay aligned
+ * in a mapping.
+ */
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t header_size;
+    uint32_t body_size;
+    uint64_t n_bodies;
+    double time;
+    int64_t step;
+    uint64_t reserved[2];
+};
+
+/*
+ * A loaded snapshot. bodies points straight into the mapped
+ * file when the byte order matches, and into a swapped copy
+ * otherwise.
+ */
+struct snapshot {
+    int n_bodies;
+    double time;
+    long step;
+    const struct body *bodies;
+
+    void *map;
+    size_t map_len;
+    struct body *swapped;
+};
+
+int load_snapshot(const char *path, struct snapshot *out);
+
+void close_snapshot(struct snapshot *snap);
+
+int save_snapshot(const char *path, double time, long step, int n_bodies, const struct body *bodies);
+
+/*
+ * Saves snapshots from a background thread, so that a slow
+ * disk never stalls the caller for the fsync. Only the latest
+ * request is kept: one submitted while another is still
+ * waiting replaces it.
+ */
+struct snapshot_writer {
+    const char *path;
+    int n_bodies;
+    struct body *pending;
+    struct body *writing;
+    double time;
+    long step;
+    int has_pending;
+    int stop;
+    long n_failed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+int open_snapshot_writer(const char *path, int n_bodies, struct snapshot_writer *out);
+
+/*
+ * Copies the bodies and returns straight away. Returns 0 if
+ * any earlier snapshot failed to save.
+ */
+int submit_snapshot(struct snapshot_writer *writer, double time, long step, const struct body *bodies);
+
+// Saves whatever is still pending; returns 0 if any snapshot failed
+int close_snapshot_writer(struct snapshot_writer *writer);
+
+#endif // ORBITAL_SNAPSHOT_H
@@ -0,0 +1,79 @@
+#include "spsc_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * cap is rounded up to a power of two so that indices wrap
+ * with a mask. head and tail only ever increase.
+ */
+int init_spsc_queue(size_t cap, size_t elem_size, struct spsc_queue *out) {
+    size_t pow2 = 1;
+    while (pow2 < cap) {
+        pow2 <<= 1;
+    }
+
+    atomic_init(&out->head, 0);
+    atomic_init(&out->tail, 0);
+    out->mask = pow2 - 1;
+    out->elem_size = elem_size;
+    out->buf = malloc(pow2 * elem_size);
+
+    return out->buf != NULL;
+}
+
+void destroy_spsc_queue(struct spsc_queue *queue) {
+    free(queue->buf);
+    queue->buf = NULL;
+}
+
+int spsc_push(struct spsc_queue *queue, const void *elem) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head > queue->mask) {
+        return 0;
+    }
+
+    memcpy(queue->buf + (tail & queue->mask) * queue->elem_size, elem, queue->elem_size);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+int spsc_pop(struct spsc_queue *queue, void *out) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+
+    memcpy(out, queue->buf + (head & queue->mask) * queue->elem_size, queue->elem_size);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return 1;
+}
+
+int spsc_reserve(struct spsc_queue *queue, size_t n, size_t *pos) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (queue->mask + 1 - (tail - head) < n) {
+        return 0;
+    }
+
+    *pos = tail;
+    return 1;
+}
+
+void spsc_commit(struct spsc_queue *queue, size_t end) {
+    atomic_store_explicit(&queue->tail, end, memory_order_release);
+}
+
+size_t spsc_readable(struct spsc_queue *queue, size_t *pos) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    *pos = head;
+    return tail - head;
+}
+
+void spsc_release(struct spsc_queue *queue, size_t end) {
+    atomic_store_explicit(&queue->head, end, memory_order_release);
+}
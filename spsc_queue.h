@@ -0,0 +1,46 @@
+#ifndef ORBITAL_SPSC_QUEUE_H
+#define ORBITAL_SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Bounded lock-free queue for exactly one producer thread and
+ * one consumer thread. Elements are copied in and out by value.
+ */
+struct spsc_queue {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+
+    _Alignas(64) size_t mask;
+    size_t elem_size;
+    unsigned char *buf;
+};
+
+int init_spsc_queue(size_t cap, size_t elem_size, struct spsc_queue *out);
+
+void destroy_spsc_queue(struct spsc_queue *queue);
+
+int spsc_push(struct spsc_queue *queue, const void *elem);
+
+int spsc_pop(struct spsc_queue *queue, void *out);
+
+/*
+ * Zero-copy access for bulk transfers. The producer reserves
+ * n slots, fills them in place through spsc_slot() and makes
+ * them visible with spsc_commit(). The consumer does the same
+ * with spsc_readable() and spsc_release().
+ */
+int spsc_reserve(struct spsc_queue *queue, size_t n, size_t *pos);
+
+void spsc_commit(struct spsc_queue *queue, size_t end);
+
+size_t spsc_readable(struct spsc_queue *queue, size_t *pos);
+
+void spsc_release(struct spsc_queue *queue, size_t end);
+
+static inline void *spsc_slot(const struct spsc_queue *queue, size_t pos) {
+    return queue->buf + (pos & queue->mask) * queue->elem_size;
+}
+
+#endif // ORBITAL_SPSC_QUEUE_H
@@ -1,71 +1,332 @@
 #include "system.h"
 
+#include "gravity.h"
+#include "integrator.h"
+#include "kepler.h"
+
 #include <stdlib.h>
-#include <string.h>
 #include <math.h>
 
-// CODATA 2018 value for G
-static const double G = 0.000000000066743;
+static const double DEFAULT_THETA = 0.5;
+static const double DEFAULT_RK_TOLERANCE = 1e-10;
+// Well below the usual 0.01-0.02, as satellites are followed for many more orbits than an N-body run
+static const double DEFAULT_BLOCK_ETA = 0.001;
+static const int ROW_BLOCK_SIZE = 64;
+static const int BODY_BLOCK_SIZE = 4096;
+
+struct step_task {
+    struct system_workspace *ws;
+    struct body *bodies;
+};
 
 void add_body(double mass, struct body *out) {
     struct body body = {
-            mass, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}
+            mass, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, 0, 0
     };
     *out = body;
 }
 
-static struct vector diff(struct vector a, struct vector b) {
-    struct vector diff = {
-            a.x - b.x, a.y - b.y, a.z - b.z
-    };
-    return diff;
+double gravitating_mass(const struct body *body) {
+    return body->flags & BODY_TEST_PARTICLE ? 0.0 : body->mass;
+}
+
+/*
+ * The kernels only skip test particles that form a tail after
+ * every massive body. Anywhere else they stay in the source
+ * range with zero mass, which is correct but no cheaper.
+ */
+static int count_massive(int n_bodies, const struct body *bodies) {
+    int m = n_bodies;
+    while (m > 0 && (bodies[m - 1].flags & BODY_TEST_PARTICLE)) {
+        m--;
+    }
+
+    return m;
+}
+
+int init_workspace(int cap, struct system_workspace *out) {
+    out->integrator = &INTEGRATOR_EULER;
+    out->backend = GRAVITY_DIRECT;
+    out->pool = NULL;
+    out->n_force_evals = 0;
+    out->n_force_rows = 0;
+    out->rk_tolerance = DEFAULT_RK_TOLERANCE;
+    out->rk_h = 0.0;
+    out->rk_buf = NULL;
+    out->rk_cap = 0;
+
+    struct block_steps blocks = {DEFAULT_BLOCK_ETA, 0.0, 0, 0, 0, NULL, NULL, NULL, NULL};
+    out->blocks = blocks;
+
+    init_bh_tree(DEFAULT_THETA, &out->tree);
+
+    return init_body_soa(cap, &out->soa);
 }
 
-static double mag(struct vector v) {
-    return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+int reserve_workspace(struct system_workspace *ws, int n_bodies) {
+    if (n_bodies <= ws->soa.cap) {
+        return 1;
+    }
+
+    struct body_soa soa;
+    if (!init_body_soa(n_bodies, &soa)) {
+        return 0;
+    }
+
+    destroy_body_soa(&ws->soa);
+    ws->soa = soa;
+
+    return 1;
+}
+
+void destroy_workspace(struct system_workspace *ws) {
+    destroy_body_soa(&ws->soa);
+    destroy_bh_tree(&ws->tree);
+    free(ws->rk_buf);
+    ws->rk_buf = NULL;
+    ws->rk_cap = 0;
+
+    free(ws->blocks.buf);
+    free(ws->blocks.time);
+    free(ws->blocks.level);
+    free(ws->blocks.active);
+    ws->blocks.buf = NULL;
+    ws->blocks.time = NULL;
+    ws->blocks.level = NULL;
+    ws->blocks.active = NULL;
+    ws->blocks.cap = 0;
+    ws->blocks.valid = 0;
+}
+
+int use_barnes_hut(struct system_workspace *ws, double theta) {
+    if (theta < 0.0) {
+        return 0;
+    }
+
+    ws->backend = GRAVITY_BARNES_HUT;
+    ws->tree.theta = theta;
+    return 1;
 }
 
-void recompute_system(double dt, int n_bodies, struct body *bodies) {
-    size_t temp_len = n_bodies * sizeof(struct body);
-    struct body *temp = malloc(temp_len);
-    memcpy(temp, bodies, temp_len);
-    
+static void load_soa(struct body_soa *soa, int n_bodies, const struct body *bodies) {
+    soa->n = n_bodies;
+    soa->n_massive = count_massive(n_bodies, bodies);
     for (int i = 0; i < n_bodies; ++i) {
-        struct body *body = bodies + i;
+        const struct body *body = bodies + i;
+        soa->mass[i] = gravitating_mass(body);
+        soa->x[i] = body->pos.x;
+        soa->y[i] = body->pos.y;
+        soa->z[i] = body->pos.z;
+    }
+}
 
-        struct vector F_net = body->F_net_ext;
-        for (int j = 0; j < n_bodies; ++j) {
-            if (j == i) {
-                continue;
+static void load_task(void *arg, int begin, int end) {
+    struct step_task *task = arg;
+    struct body_soa *soa = &task->ws->soa;
+
+    for (int i = begin; i < end; ++i) {
+        const struct body *body = task->bodies + i;
+        soa->mass[i] = gravitating_mass(body);
+        soa->x[i] = body->pos.x;
+        soa->y[i] = body->pos.y;
+        soa->z[i] = body->pos.z;
+        soa->vx[i] = body->vel.x;
+        soa->vy[i] = body->vel.y;
+        soa->vz[i] = body->vel.z;
+        soa->ex[i] = body->F_net_ext.x / body->mass;
+        soa->ey[i] = body->F_net_ext.y / body->mass;
+        soa->ez[i] = body->F_net_ext.z / body->mass;
+    }
+}
+
+static void store_task(void *arg, int begin, int end) {
+    struct step_task *task = arg;
+    const struct body_soa *soa = &task->ws->soa;
+
+    for (int i = begin; i < end; ++i) {
+        struct body *body = task->bodies + i;
+
+        struct vector pos = {soa->x[i], soa->y[i], soa->z[i]};
+        body->pos = pos;
+
+        struct vector vel = {soa->vx[i], soa->vy[i], soa->vz[i]};
+        body->vel = vel;
+
+        struct vector acl = {soa->ax[i] + soa->ex[i], soa->ay[i] + soa->ey[i], soa->az[i] + soa->ez[i]};
+        body->acl = acl;
+    }
+}
+
+static void direct_rows_task(void *arg, int begin, int end) {
+    struct step_task *task = arg;
+    compute_gravity_rows(&task->ws->soa, begin, end);
+}
+
+static void bh_rows_task(void *arg, int begin, int end) {
+    struct step_task *task = arg;
+    compute_gravity_bh(&task->ws->tree, &task->ws->soa, begin, end);
+}
+
+static int is_parallel(const struct system_workspace *ws) {
+    return ws->pool && ws->pool->n_threads > 1;
+}
+
+int compute_accelerations(struct system_workspace *ws) {
+    struct step_task task = {ws, NULL};
+    int n = ws->soa.n;
+    ws->n_force_evals++;
+    ws->n_force_rows += n;
+
+    switch (ws->backend) {
+        case GRAVITY_BARNES_HUT:
+            if (!build_bh_tree(&ws->tree, &ws->soa)) {
+                return 0;
             }
+            run_parallel(ws->pool, n, ROW_BLOCK_SIZE, bh_rows_task, &task);
+            break;
+        default:
+            if (is_parallel(ws)) {
+                run_parallel(ws->pool, n, ROW_BLOCK_SIZE, direct_rows_task, &task);
+            } else {
+                compute_gravity(&ws->soa);
+            }
+            break;
+    }
+
+    return 1;
+}
+
+/*
+ * Evaluates the Barnes-Hut accelerations of n_samples evenly
+ * spaced bodies against the direct sum, reporting the relative
+ * error |a_bh - a_direct| / |a_direct|.
+ */
+int compare_gravity_backends(struct system_workspace *ws, int n_samples, int n_bodies, const struct body *bodies,
+                             struct force_error_report *out) {
+    struct force_error_report report = {0, 0.0, 0.0, 0.0};
+    *out = report;
+    if (n_bodies == 0 || n_samples <= 0) {
+        return 1;
+    }
+
+    if (!reserve_workspace(ws, n_bodies)) {
+        return 0;
+    }
+
+    struct body_soa *soa = &ws->soa;
+    load_soa(soa, n_bodies, bodies);
+    if (!build_bh_tree(&ws->tree, soa)) {
+        return 0;
+    }
+
+    if (n_samples > n_bodies) {
+        n_samples = n_bodies;
+    }
 
-            struct body *other_body = temp + j;
-            struct vector r = diff(other_body->pos, body->pos);
-            double r_mag = mag(r);
-            double F_g = G * body->mass * other_body->mass / (r_mag * r_mag);
+    double sum = 0.0;
+    double sum_sq = 0.0;
+    for (int k = 0; k < n_samples; ++k) {
+        int i = (int) ((long long) k * n_bodies / n_samples);
 
-            F_net.x += F_g * r.x / r_mag;
-            F_net.y += F_g * r.y / r_mag;
-            F_net.z += F_g * r.z / r_mag;
+        compute_gravity_bh(&ws->tree, soa, i, i + 1);
+        struct vector bh = {soa->ax[i], soa->ay[i], soa->az[i]};
+
+        compute_gravity_rows(soa, i, i + 1);
+        struct vector direct = {soa->ax[i], soa->ay[i], soa->az[i]};
+
+        double direct_mag = sqrt(direct.x * direct.x + direct.y * direct.y + direct.z * direct.z);
+        if (direct_mag == 0.0) {
+            continue;
         }
 
-        struct vector acl = { F_net.x / body->mass, F_net.y / body->mass, F_net.z / body->mass };
-        body->acl = acl;
+        struct vector err = {bh.x - direct.x, bh.y - direct.y, bh.z - direct.z};
+        double rel = sqrt(err.x * err.x + err.y * err.y + err.z * err.z) / direct_mag;
+
+        report.n_samples++;
+        sum += rel;
+        sum_sq += rel * rel;
+        if (rel > report.max) {
+            report.max = rel;
+        }
+    }
+
+    if (report.n_samples > 0) {
+        report.mean = sum / report.n_samples;
+        report.rms = sqrt(sum_sq / report.n_samples);
+    }
+
+    *out = report;
+    return 1;
+}
+
+int recompute_system(struct system_workspace *ws, double dt, int n_bodies, struct body *bodies) {
+    if (!reserve_workspace(ws, n_bodies)) {
+        return 0;
     }
 
-    free(temp);
+    struct step_task task = {ws, bodies};
+    ws->soa.n = n_bodies;
+    ws->soa.n_massive = count_massive(n_bodies, bodies);
+    run_parallel(ws->pool, n_bodies, BODY_BLOCK_SIZE, load_task, &task);
 
+    if (!ws->integrator->step(ws, dt)) {
+        return 0;
+    }
+
+    run_parallel(ws->pool, n_bodies, BODY_BLOCK_SIZE, store_task, &task);
+    return 1;
+}
+
+static int is_coasting(const struct body *body) {
+    return body->F_net_ext.x == 0.0 && body->F_net_ext.y == 0.0 && body->F_net_ext.z == 0.0;
+}
+
+int is_analytic_coast(int n_bodies, const struct body *bodies) {
+    return n_bodies == 2 && is_coasting(bodies) && is_coasting(bodies + 1);
+}
+
+int advance_system(struct system_workspace *ws, double dt, int n_bodies, struct body *bodies) {
+    if (is_analytic_coast(n_bodies, bodies) && propagate_two_body(dt, bodies)) {
+        return 1;
+    }
+
+    return recompute_system(ws, dt, n_bodies, bodies);
+}
+
+double system_energy(int n_bodies, const struct body *bodies) {
+    double kinetic = 0.0;
+    double potential = 0.0;
     for (int i = 0; i < n_bodies; ++i) {
-        struct body *body = bodies + 1;
+        const struct body *a = bodies + i;
+        kinetic += 0.5 * a->mass * (a->vel.x * a->vel.x + a->vel.y * a->vel.y + a->vel.z * a->vel.z);
 
-        struct vector vel = { body->acl.x * dt, body->acl.y * dt, body->acl.z * dt };
-        body->vel.x += vel.x;
-        body->vel.y += vel.y;
-        body->vel.z += vel.z;
+        for (int j = i + 1; j < n_bodies; ++j) {
+            const struct body *b = bodies + j;
+            if (a->flags & b->flags & BODY_TEST_PARTICLE) {
+                continue;
+            }
 
-        struct vector pos = { body->vel.x * dt, body->vel.y * dt, body->vel.z * dt };
-        body->pos.x += pos.x;
-        body->pos.y += pos.y;
-        body->pos.z += pos.z;
+            double dx = b->pos.x - a->pos.x;
+            double dy = b->pos.y - a->pos.y;
+            double dz = b->pos.z - a->pos.z;
+            double r = sqrt(dx * dx + dy * dy + dz * dz);
+            if (r > 0.0) {
+                potential -= G * a->mass * b->mass / r;
+            }
+        }
     }
+
+    return kinetic + potential;
+}
+
+struct vector system_angular_momentum(int n_bodies, const struct body *bodies) {
+    struct vector L = {0.0, 0.0, 0.0};
+    for (int i = 0; i < n_bodies; ++i) {
+        const struct body *b = bodies + i;
+        L.x += b->mass * (b->pos.y * b->vel.z - b->pos.z * b->vel.y);
+        L.y += b->mass * (b->pos.z * b->vel.x - b->pos.x * b->vel.z);
+        L.z += b->mass * (b->pos.x * b->vel.y - b->pos.y * b->vel.x);
+    }
+
+    return L;
 }
@@ -1,22 +1,131 @@
 #ifndef ORBITAL_SYSTEM_H
 #define ORBITAL_SYSTEM_H
 
+#include "gravity.h"
+#include "barnes_hut.h"
+#include "thread_pool.h"
+
 struct vector {
     double x;
     double y;
     double z;
 };
 
+/*
+ * A test particle (BODY_TEST_PARTICLE) is pulled by the other
+ * bodies but pulls on none of them; its mass only converts
+ * F_net_ext into an acceleration. Test particles are cheapest
+ * when they all come after the massive bodies.
+ */
+#define BODY_TEST_PARTICLE 1
+
 struct body {
     double mass;
     struct vector F_net_ext;
     struct vector pos;
     struct vector vel;
     struct vector acl;
+    int flags;
+    int reserved;
+};
+
+struct integrator;
+
+enum gravity_backend {
+    GRAVITY_DIRECT,
+    GRAVITY_BARNES_HUT
+};
+
+// Block steps go down to dt / 2^BLOCK_MAX_LEVEL
+#define BLOCK_MAX_LEVEL 40
+
+/*
+ * Per-body state of the block-timestep Hermite integrator:
+ * the state, acceleration and jerk of each body as of its own
+ * last correction, its time in ticks of 2^-BLOCK_MAX_LEVEL
+ * steps and its step level. It is kept between steps, so while
+ * the bodies are left untouched a step starts from the last
+ * step's final force evaluation.
+ */
+struct block_steps {
+    double eta;
+    double dt;
+    int n;
+    int cap;
+    int valid;
+    double *buf;
+    long long *time;
+    int *level;
+    int *active;
+};
+
+/*
+ * Caller-owned scratch space for recompute_system. It only
+ * grows when a step sees more bodies than it has room for,
+ * so steady-state stepping never allocates.
+ *
+ * With a pool of more than one thread, forces are evaluated
+ * row by row rather than with the symmetric pair kernel, so
+ * each body's sum is independent of which worker computed it
+ * and results are bit-identical for a fixed thread count.
+ */
+struct system_workspace {
+    const struct integrator *integrator;
+    enum gravity_backend backend;
+    struct body_soa soa;
+    struct bh_tree tree;
+    struct thread_pool *pool;
+    long n_force_evals;
+    // Bodies whose force was evaluated, which is less than n per evaluation with block steps
+    long n_force_rows;
+
+    // Embedded RK error control and its stage storage
+    double rk_tolerance;
+    double rk_h;
+    double *rk_buf;
+    int rk_cap;
+
+    struct block_steps blocks;
+};
+
+struct force_error_report {
+    int n_samples;
+    double mean;
+    double rms;
+    double max;
 };
 
 void add_body(double mass, struct body *out);
 
-void recompute_system(double dt, int n_bodies, struct body *bodies);
+double gravitating_mass(const struct body *body);
+
+int init_workspace(int cap, struct system_workspace *out);
+
+int reserve_workspace(struct system_workspace *ws, int n_bodies);
+
+void destroy_workspace(struct system_workspace *ws);
+
+int use_barnes_hut(struct system_workspace *ws, double theta);
+
+int compute_accelerations(struct system_workspace *ws);
+
+int compare_gravity_backends(struct system_workspace *ws, int n_samples, int n_bodies, const struct body *bodies,
+                             struct force_error_report *out);
+
+int recompute_system(struct system_workspace *ws, double dt, int n_bodies, struct body *bodies);
+
+/*
+ * Same contract as recompute_system, but a coasting two-body
+ * system (no external force on either body) is propagated
+ * analytically, so dt can be arbitrarily large at no extra
+ * cost and without integration error.
+ */
+int advance_system(struct system_workspace *ws, double dt, int n_bodies, struct body *bodies);
+
+int is_analytic_coast(int n_bodies, const struct body *bodies);
+
+double system_energy(int n_bodies, const struct body *bodies);
+
+struct vector system_angular_momentum(int n_bodies, const struct body *bodies);
 
 #endif // ORBITAL_SYSTEM_H
@@ -0,0 +1,171 @@
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct pool_worker {
+    struct thread_pool *pool;
+    int idx;
+};
+
+static void drain(struct thread_pool *pool, int self) {
+    int n_threads = pool->n_threads;
+    int n_items = pool->n_items;
+    int block_size = pool->block_size;
+
+    // Own queue first, then steal from the others in a fixed rotation
+    for (int k = 0; k < n_threads; ++k) {
+        struct pool_queue *queue = pool->queues + (self + k) % n_threads;
+        while (1) {
+            int block = atomic_fetch_add_explicit(&queue->next, 1, memory_order_relaxed);
+            if (block >= queue->end) {
+                break;
+            }
+
+            int begin = block * block_size;
+            int end = begin + block_size < n_items ? begin + block_size : n_items;
+            pool->fn(pool->arg, begin, end);
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct pool_worker *worker = arg;
+    struct thread_pool *pool = worker->pool;
+
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen) {
+            pthread_cond_wait(&pool->start_cond, &pool->lock);
+        }
+
+        if (pool->stop) {
+            break;
+        }
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        drain(pool, worker->idx);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->n_running == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+int init_thread_pool(int n_threads, struct thread_pool *out) {
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+
+    out->n_threads = n_threads;
+    out->generation = 0;
+    out->n_running = 0;
+    out->stop = 0;
+    out->fn = NULL;
+    out->arg = NULL;
+    out->n_items = 0;
+    out->block_size = 1;
+
+    out->threads = malloc(n_threads * sizeof(*out->threads));
+    out->queues = aligned_alloc(_Alignof(struct pool_queue), n_threads * sizeof(*out->queues));
+    out->workers = malloc(n_threads * sizeof(*out->workers));
+    if (!out->threads || !out->queues || !out->workers) {
+        fprintf(stderr, "Failed to allocate the thread pool\n");
+        free(out->threads);
+        free(out->queues);
+        free(out->workers);
+        return 0;
+    }
+
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->start_cond, NULL);
+    pthread_cond_init(&out->done_cond, NULL);
+
+    for (int i = 0; i < n_threads; ++i) {
+        atomic_init(&out->queues[i].next, 0);
+        out->queues[i].end = 0;
+    }
+
+    for (int i = 1; i < n_threads; ++i) {
+        out->workers[i].pool = out;
+        out->workers[i].idx = i;
+        if (pthread_create(out->threads + i, NULL, worker_main, out->workers + i) != 0) {
+            fprintf(stderr, "Failed to start worker thread %d\n", i);
+            out->n_threads = i;
+            destroy_thread_pool(out);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void destroy_thread_pool(struct thread_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->n_threads; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->threads);
+    free(pool->queues);
+    free(pool->workers);
+    pool->threads = NULL;
+    pool->queues = NULL;
+    pool->workers = NULL;
+}
+
+void run_parallel(struct thread_pool *pool, int n_items, int block_size, pool_task_fn fn, void *arg) {
+    if (n_items <= 0) {
+        return;
+    }
+
+    if (block_size < 1) {
+        block_size = 1;
+    }
+
+    int n_blocks = (n_items + block_size - 1) / block_size;
+    if (!pool || pool->n_threads <= 1 || n_blocks <= 1) {
+        fn(arg, 0, n_items);
+        return;
+    }
+
+    int n_threads = pool->n_threads;
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->n_items = n_items;
+    pool->block_size = block_size;
+    for (int i = 0; i < n_threads; ++i) {
+        atomic_store_explicit(&pool->queues[i].next, (int) ((long long) i * n_blocks / n_threads),
+                              memory_order_relaxed);
+        pool->queues[i].end = (int) ((long long) (i + 1) * n_blocks / n_threads);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->n_running = n_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    drain(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->n_running > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
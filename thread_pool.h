@@ -0,0 +1,52 @@
+#ifndef ORBITAL_THREAD_POOL_H
+#define ORBITAL_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+typedef void (*pool_task_fn)(void *arg, int begin, int end);
+
+struct pool_worker;
+
+/*
+ * Block range owned by one worker. Blocks are claimed from
+ * the front by the owner and by thieves alike, so a claim is
+ * a single fetch-add and never needs a lock.
+ */
+struct pool_queue {
+    _Alignas(64) atomic_int next;
+    int end;
+};
+
+/*
+ * Persistent pool of n_threads - 1 workers; the thread that
+ * calls run_parallel works as the remaining member. Which
+ * worker executes a block is not deterministic, so tasks must
+ * write disjoint outputs that do not depend on block order.
+ */
+struct thread_pool {
+    int n_threads;
+    pthread_t *threads;
+    struct pool_queue *queues;
+    struct pool_worker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    unsigned long generation;
+    int n_running;
+    int stop;
+
+    pool_task_fn fn;
+    void *arg;
+    int n_items;
+    int block_size;
+};
+
+int init_thread_pool(int n_threads, struct thread_pool *out);
+
+void destroy_thread_pool(struct thread_pool *pool);
+
+void run_parallel(struct thread_pool *pool, int n_items, int block_size, pool_task_fn fn, void *arg);
+
+#endif // ORBITAL_THREAD_POOL_H
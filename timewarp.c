@@ -0,0 +1,58 @@
+#include "timewarp.h"
+
+#include <math.h>
+
+// Reproduces the historical 5 s step for a LEO orbit
+static const double DEFAULT_ETA = 0.005;
+static const int DEFAULT_MAX_SUBSTEPS = 1000;
+// Burns are integrated, so they are capped at the historical 5 s per 20 ms
+static const double DEFAULT_BURN_WARP = 250.0;
+
+void init_time_warp(double warp, struct time_warp *out) {
+    struct time_warp tw = {
+            MIN_TIME_WARP, MIN_TIME_WARP,
+            DEFAULT_ETA, DEFAULT_MAX_SUBSTEPS, DEFAULT_BURN_WARP,
+            0, 0.0, 0
+    };
+    *out = tw;
+
+    set_time_warp(out, warp);
+}
+
+void set_time_warp(struct time_warp *tw, double warp) {
+    if (warp < MIN_TIME_WARP) {
+        warp = MIN_TIME_WARP;
+    } else if (warp > MAX_TIME_WARP) {
+        warp = MAX_TIME_WARP;
+    }
+
+    tw->requested = warp;
+}
+
+/*
+ * The dynamical time of each body about the primary at index
+ * 0 is sqrt(r / |a|), which is the orbital period over 2 pi for
+ * a circular orbit and shrinks quickly on close approaches.
+ * Before the first force evaluation the primary's pull alone
+ * stands in for the acceleration.
+ */
+double step_budget(double eta, int n_bodies, const struct body *bodies) {
+    double min_t2 = INFINITY;
+    for (int i = 1; i < n_bodies; ++i) {
+        const struct body *b = bodies + i;
+        double dx = b->pos.x - bodies[0].pos.x;
+        double dy = b->pos.y - bodies[0].pos.y;
+        double dz = b->pos.z - bodies[0].pos.z;
+        double r = sqrt(dx * dx + dy * dy + dz * dz);
+        double a = sqrt(b->acl.x * b->acl.x + b->acl.y * b->acl.y + b->acl.z * b->acl.z);
+        if (a == 0.0 && r > 0.0) {
+            a = G * gravitating_mass(bodies) / (r * r);
+        }
+
+        if (a > 0.0 && r / a < min_t2) {
+            min_t2 = r / a;
+        }
+    }
+
+    return eta * sqrt(min_t2);
+}
@@ -0,0 +1,35 @@
+#ifndef ORBITAL_TIMEWARP_H
+#define ORBITAL_TIMEWARP_H
+
+#include "system.h"
+
+#define MIN_TIME_WARP 1.0
+#define MAX_TIME_WARP 1000000.0
+
+/*
+ * requested is what the user asked for; effective is what the
+ * last frame actually achieved after the burn cap, the sub-step
+ * limit and the wall-clock budget were applied.
+ */
+struct time_warp {
+    double requested;
+    double effective;
+
+    // Sub-steps are at most eta times the shortest dynamical time sqrt(r / |a|)
+    double eta;
+    int max_substeps;
+    double burn_warp;
+
+    int substeps;
+    double substep_dt;
+    // Set when the wall-clock budget stopped the last frame before all its sub-steps
+    int cut_short;
+};
+
+void init_time_warp(double warp, struct time_warp *out);
+
+void set_time_warp(struct time_warp *tw, double warp);
+
+double step_budget(double eta, int n_bodies, const struct body *bodies);
+
+#endif // ORBITAL_TIMEWARP_H
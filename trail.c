@@ -0,0 +1,197 @@
+#include "trail.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+static const double TWO_PI = 6.283185307179586;
+
+int init_trail(int cap, double tolerance, struct trail *out) {
+    struct trail trail = {0};
+    *out = trail;
+
+    int ok = cap >= 2;
+    for (int k = 0; k < TRAIL_LEVELS; ++k) {
+        struct trail_level *level = out->levels + k;
+        level->tolerance = tolerance * pow(TRAIL_LEVEL_RATIO, k);
+        level->cap = cap;
+        level->points = malloc(cap * sizeof(struct vector));
+        level->seqs = malloc(cap * sizeof(long));
+        ok &= level->points != NULL && level->seqs != NULL;
+    }
+
+    if (!ok) {
+        destroy_trail(out);
+    }
+    return ok;
+}
+
+void destroy_trail(struct trail *trail) {
+    for (int k = 0; k < TRAIL_LEVELS; ++k) {
+        struct trail_level *level = trail->levels + k;
+        free(level->points);
+        free(level->seqs);
+        level->points = NULL;
+        level->seqs = NULL;
+        level->cap = 0;
+    }
+    clear_trail(trail);
+}
+
+void clear_trail(struct trail *trail) {
+    trail->n_points = 0;
+    trail->generation++;
+    for (int k = 0; k < TRAIL_LEVELS; ++k) {
+        struct trail_level *level = trail->levels + k;
+        level->head = 0;
+        level->count = 0;
+        level->n_appended = 0;
+        level->floating = 0;
+    }
+}
+
+static void append(struct trail_level *level, struct vector point, long seq) {
+    int slot = level->head;
+    level->points[slot] = point;
+    level->seqs[slot] = seq;
+
+    level->head = (slot + 1) % level->cap;
+    if (level->count < level->cap) {
+        level->count++;
+    }
+    level->n_appended++;
+}
+
+/*
+ * Sleeve fitting: a point at distance d from the anchor stays
+ * within tolerance of any chord from the anchor whose direction
+ * is within asin(tolerance / d) of its own. Intersecting those
+ * wedges gives the directions a longer chord may still take.
+ * Points within tolerance of the anchor constrain nothing.
+ */
+static void absorb(struct trail_level *level, struct vector point) {
+    double dx = point.x - level->anchor.x;
+    double dy = point.y - level->anchor.y;
+    double d = sqrt(dx * dx + dy * dy);
+    if (d > level->max_dist) {
+        level->max_dist = d;
+    }
+    if (d <= level->tolerance) {
+        return;
+    }
+
+    double angle = atan2(dy, dx);
+    double half = asin(level->tolerance / d);
+    if (!level->has_dir) {
+        level->has_dir = 1;
+        level->ref = angle;
+        level->lo = -half;
+        level->hi = half;
+        return;
+    }
+
+    double rel = remainder(angle - level->ref, TWO_PI);
+    level->lo = fmax(level->lo, rel - half);
+    level->hi = fmin(level->hi, rel + half);
+}
+
+// Whether the chord from the anchor to point passes within tolerance of every absorbed point
+static int fits(const struct trail_level *level, struct vector point) {
+    if (!level->has_dir) {
+        return 1;
+    }
+
+    double dx = point.x - level->anchor.x;
+    double dy = point.y - level->anchor.y;
+    double d = sqrt(dx * dx + dy * dy);
+    // A chord that ends short of an absorbed point does not pass beside it
+    if (d <= level->tolerance || d < level->max_dist - level->tolerance) {
+        return 0;
+    }
+
+    double rel = remainder(atan2(dy, dx) - level->ref, TWO_PI);
+    return rel >= level->lo && rel <= level->hi;
+}
+
+static void restart(struct trail_level *level, struct vector anchor, struct vector point) {
+    level->anchor = anchor;
+    level->has_dir = 0;
+    level->max_dist = 0.0;
+    absorb(level, point);
+}
+
+static void push_level(struct trail_level *level, struct vector point, long seq) {
+    if (level->n_appended == 0) {
+        append(level, point, seq);
+        return;
+    }
+
+    int newest = (level->head + level->cap - 1) % level->cap;
+    if (!level->floating) {
+        restart(level, level->points[newest], point);
+        append(level, point, seq);
+        level->floating = 1;
+    } else if (fits(level, point)) {
+        absorb(level, point);
+        level->points[newest] = point;
+        level->seqs[newest] = seq;
+    } else {
+        restart(level, level->points[newest], point);
+        append(level, point, seq);
+    }
+}
+
+void push_trail(struct trail *trail, struct vector point) {
+    for (int k = 0; k < TRAIL_LEVELS; ++k) {
+        push_level(trail->levels + k, point, trail->n_points);
+    }
+    trail->n_points++;
+}
+
+int trail_level_for(const struct trail *trail, double max_error) {
+    int best = 0;
+    for (int k = 1; k < TRAIL_LEVELS; ++k) {
+        if (trail->levels[k].tolerance <= max_error) {
+            best = k;
+        }
+    }
+
+    return best;
+}
+
+static int oldest_slot(const struct trail_level *level) {
+    return (level->head - level->count + level->cap) % level->cap;
+}
+
+int trail_spans(const struct trail *trail, int finest, struct trail_span *out) {
+    const struct trail_level *level = trail->levels + finest;
+    if (level->count == 0) {
+        return 0;
+    }
+
+    struct trail_span span = {finest, oldest_slot(level), level->count};
+    out[0] = span;
+    int n_spans = 1;
+
+    // A level that never wrapped still holds everything since the clear
+    long covered = level->seqs[span.first];
+    int complete = level->n_appended <= level->cap;
+    for (int k = finest + 1; k < TRAIL_LEVELS && !complete; ++k) {
+        level = trail->levels + k;
+        complete = level->n_appended <= level->cap;
+
+        int first = oldest_slot(level);
+        int n_older = 0;
+        while (n_older < level->count && level->seqs[(first + n_older) % level->cap] < covered) {
+            n_older++;
+        }
+        if (n_older == 0) {
+            continue;
+        }
+
+        struct trail_span older = {k, first, n_older < level->count ? n_older + 1 : n_older};
+        out[n_spans++] = older;
+        covered = level->seqs[first];
+    }
+
+    return n_spans;
+}
@@ -0,0 +1,78 @@
+#ifndef ORBITAL_TRAIL_H
+#define ORBITAL_TRAIL_H
+
+#include "system.h"
+
+#define TRAIL_LEVELS 4
+// Each level may stray this many times further from the path than the one below
+#define TRAIL_LEVEL_RATIO 8.0
+
+/*
+ * One simplification of the path: a fixed-capacity ring of
+ * vertices, where the vertex for point n_appended - 1 sits in
+ * slot (n_appended - 1) % cap. Once full, each append
+ * overwrites the oldest vertex. The newest vertex always
+ * follows the latest point and is only kept in place once a
+ * point arrives that the segment ending at it cannot absorb.
+ */
+struct trail_level {
+    double tolerance;
+    int cap;
+    int head;
+    int count;
+    long n_appended;
+    struct vector *points;
+    // Index of the pushed point each vertex came from
+    long *seqs;
+
+    int floating;
+    struct vector anchor;
+    // Directions from the anchor, relative to ref, that keep every absorbed point within tolerance
+    int has_dir;
+    double ref;
+    double lo;
+    double hi;
+    double max_dist;
+};
+
+/*
+ * Past positions at TRAIL_LEVELS levels of detail. Every level
+ * sees every point but keeps only the vertices needed to stay
+ * within its tolerance in the xy plane, so coarser levels reach
+ * further back with the same number of vertices: a straight
+ * coast costs a handful, a hard turn as many as it needs.
+ */
+struct trail {
+    long n_points;
+    // Bumped by every clear, so mirrors of the levels know to start over
+    int generation;
+    struct trail_level levels[TRAIL_LEVELS];
+};
+
+// A run of count vertices of one level, oldest first, starting at slot first
+struct trail_span {
+    int level;
+    int first;
+    int count;
+};
+
+int init_trail(int cap, double tolerance, struct trail *out);
+
+void destroy_trail(struct trail *trail);
+
+void clear_trail(struct trail *trail);
+
+void push_trail(struct trail *trail, struct vector point);
+
+// The coarsest level that strays no more than max_error, or the finest
+int trail_level_for(const struct trail *trail, double max_error);
+
+/*
+ * Splits the history into spans: all of level finest, then for
+ * each coarser level only the vertices older than what the
+ * levels before it cover, overlapping by one so the line stays
+ * connected. Returns the number of spans, at most TRAIL_LEVELS.
+ */
+int trail_spans(const struct trail *trail, int finest, struct trail_span *out);
+
+#endif // ORBITAL_TRAIL_H
@@ -0,0 +1,197 @@
+#include "trajectory.h"
+
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// The queue holds this many frames, up to QUEUE_MAX_RECORDS records
+static const int QUEUE_FRAMES = 64;
+static const size_t QUEUE_MAX_RECORDS = 1 << 20;
+static const size_t FILE_BUF_SIZE = 1 << 22;
+static const long IDLE_SLEEP_NS = 1000000;
+static const long FULL_SLEEP_NS = 100000;
+
+struct trajectory_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t header_size;
+    uint32_t record_size;
+};
+
+static int write_records(struct trajectory_writer *writer, const struct trajectory_record *records, size_t n) {
+    if (writer->format == TRAJECTORY_BINARY) {
+        return fwrite(records, sizeof(*records), n, writer->file) == n;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        const struct trajectory_record *r = records + i;
+        if (fprintf(writer->file, "%lld,%.17g,%d,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+                    (long long) r->step, r->time, r->index, r->pos[0], r->pos[1], r->pos[2],
+                    r->vel[0], r->vel[1], r->vel[2]) < 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Drains whatever is readable in at most two contiguous runs
+ * (the queue may wrap) and only sleeps once it is empty.
+ */
+static void *run_writer(void *arg) {
+    struct trajectory_writer *writer = arg;
+    size_t cap = writer->queue.mask + 1;
+
+    while (1) {
+        int stopping = atomic_load(&writer->stop);
+
+        size_t pos;
+        size_t n = spsc_readable(&writer->queue, &pos);
+        if (n == 0) {
+            if (stopping) {
+                break;
+            }
+
+            struct timespec ts = {0, IDLE_SLEEP_NS};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        size_t first = cap - (pos & writer->queue.mask);
+        size_t run = n < first ? n : first;
+        int ok = write_records(writer, spsc_slot(&writer->queue, pos), run);
+        if (ok && run < n) {
+            ok = write_records(writer, spsc_slot(&writer->queue, pos + run), n - run);
+        }
+
+        if (!ok) {
+            writer->write_failed = 1;
+        }
+        writer->n_written += n;
+        spsc_release(&writer->queue, pos + n);
+    }
+
+    return NULL;
+}
+
+int open_trajectory(const char *path, enum trajectory_format format, int decimation, int n_bodies,
+                    struct trajectory_writer *out) {
+    size_t cap = (size_t) n_bodies * QUEUE_FRAMES;
+    if (cap > QUEUE_MAX_RECORDS) {
+        cap = QUEUE_MAX_RECORDS > (size_t) n_bodies ? QUEUE_MAX_RECORDS : (size_t) n_bodies;
+    }
+
+    FILE *file = fopen(path, format == TRAJECTORY_BINARY ? "wb" : "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open '%s' for writing: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    out->file = file;
+    out->file_buf = malloc(FILE_BUF_SIZE);
+    out->format = format;
+    out->decimation = decimation < 1 ? 1 : decimation;
+    out->blocking = 0;
+    atomic_init(&out->stop, 0);
+    atomic_init(&out->n_dropped, 0);
+    out->n_written = 0;
+    out->write_failed = 0;
+
+    if (!out->file_buf || !init_spsc_queue(cap, sizeof(struct trajectory_record), &out->queue)) {
+        fprintf(stderr, "Failed to allocate the trajectory queue\n");
+        fclose(file);
+        free(out->file_buf);
+        return 0;
+    }
+    setvbuf(file, out->file_buf, _IOFBF, FILE_BUF_SIZE);
+
+    if (format == TRAJECTORY_BINARY) {
+        struct trajectory_header header = {
+                TRAJECTORY_MAGIC, TRAJECTORY_VERSION, SNAPSHOT_ENDIAN_MARK,
+                sizeof(header), sizeof(struct trajectory_record)
+        };
+        fwrite(&header, sizeof(header), 1, file);
+    } else {
+        fprintf(file, "step,time,index,x,y,z,vx,vy,vz\n");
+    }
+
+    if (pthread_create(&out->thread, NULL, run_writer, out) != 0) {
+        fprintf(stderr, "Failed to start the trajectory writer\n");
+        destroy_spsc_queue(&out->queue);
+        fclose(file);
+        free(out->file_buf);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Called from the stepping thread. Costs one copy of the
+ * decimated bodies into the queue and, unless the writer is
+ * blocking, never waits; returns 0 if the frame was dropped
+ * because the writer is behind.
+ */
+int record_trajectory(struct trajectory_writer *writer, long step, double time, int n_bodies,
+                      const struct body *bodies) {
+    if (step % writer->decimation != 0) {
+        return 1;
+    }
+
+    size_t pos;
+    while (!spsc_reserve(&writer->queue, n_bodies, &pos)) {
+        if (!writer->blocking) {
+            atomic_fetch_add_explicit(&writer->n_dropped, 1, memory_order_relaxed);
+            return 0;
+        }
+
+        struct timespec ts = {0, FULL_SLEEP_NS};
+        nanosleep(&ts, NULL);
+    }
+
+    for (int i = 0; i < n_bodies; ++i) {
+        const struct body *b = bodies + i;
+        struct trajectory_record *r = spsc_slot(&writer->queue, pos + i);
+        r->step = step;
+        r->time = time;
+        r->index = i;
+        r->reserved = 0;
+        r->pos[0] = b->pos.x;
+        r->pos[1] = b->pos.y;
+        r->pos[2] = b->pos.z;
+        r->vel[0] = b->vel.x;
+        r->vel[1] = b->vel.y;
+        r->vel[2] = b->vel.z;
+    }
+
+    spsc_commit(&writer->queue, pos + n_bodies);
+    return 1;
+}
+
+int close_trajectory(struct trajectory_writer *writer) {
+    atomic_store(&writer->stop, 1);
+    pthread_join(writer->thread, NULL);
+
+    int ok = !writer->write_failed;
+    ok &= fclose(writer->file) == 0;
+    free(writer->file_buf);
+    destroy_spsc_queue(&writer->queue);
+
+    // Only a live writer may lose frames; a blocking one promised the whole run
+    long dropped = atomic_load(&writer->n_dropped);
+    if (dropped > 0) {
+        fprintf(stderr, "Trajectory writer fell behind and dropped %ld frames\n", dropped);
+        ok &= !writer->blocking;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Failed to write the trajectory\n");
+    }
+
+    return ok;
+}
@@ -0,0 +1,63 @@
+#ifndef ORBITAL_TRAJECTORY_H
+#define ORBITAL_TRAJECTORY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "system.h"
+#include "spsc_queue.h"
+
+#define TRAJECTORY_MAGIC "ORBTRAJ"
+#define TRAJECTORY_VERSION 1
+
+enum trajectory_format {
+    TRAJECTORY_BINARY,
+    TRAJECTORY_CSV
+};
+
+/*
+ * One body at one recorded step. Binary files are a
+ * snapshot-style header (see trajectory.c) followed by these
+ * records in the writer's byte order.
+ */
+struct trajectory_record {
+    int64_t step;
+    double time;
+    int32_t index;
+    int32_t reserved;
+    double pos[3];
+    double vel[3];
+};
+
+/*
+ * Frames are handed to a background thread through a lock-free
+ * queue and written in large sequential batches. A frame that
+ * does not fit in the queue is dropped and counted instead of
+ * making the producer wait, unless blocking is set, for offline
+ * runs that need every frame.
+ */
+struct trajectory_writer {
+    FILE *file;
+    char *file_buf;
+    enum trajectory_format format;
+    int decimation;
+    int blocking;
+
+    struct spsc_queue queue;
+    pthread_t thread;
+    atomic_int stop;
+    atomic_long n_dropped;
+    long n_written;
+    int write_failed;
+};
+
+int open_trajectory(const char *path, enum trajectory_format format, int decimation, int n_bodies,
+                    struct trajectory_writer *out);
+
+int record_trajectory(struct trajectory_writer *writer, long step, double time, int n_bodies,
+                      const struct body *bodies);
+
+int close_trajectory(struct trajectory_writer *writer);
+
+#endif // ORBITAL_TRAJECTORY_H
@@ -0,0 +1,40 @@
+#include "triple_buffer.h"
+
+#include <stdlib.h>
+
+#define TB_FRESH 4
+
+int init_triple_buffer(size_t size, struct triple_buffer *out) {
+    out->size = size;
+    out->slots = calloc(3, size);
+    out->back = 0;
+    out->front = 1;
+    atomic_init(&out->middle, 2);
+
+    return out->slots != NULL;
+}
+
+void destroy_triple_buffer(struct triple_buffer *tb) {
+    free(tb->slots);
+    tb->slots = NULL;
+}
+
+void *tb_write_slot(struct triple_buffer *tb) {
+    return tb->slots + tb->back * tb->size;
+}
+
+void tb_publish(struct triple_buffer *tb) {
+    int prev = atomic_exchange_explicit(&tb->middle, tb->back | TB_FRESH, memory_order_acq_rel);
+    tb->back = prev & ~TB_FRESH;
+}
+
+const void *tb_read(struct triple_buffer *tb, int *fresh) {
+    *fresh = 0;
+    if (atomic_load_explicit(&tb->middle, memory_order_relaxed) & TB_FRESH) {
+        int prev = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+        tb->front = prev & ~TB_FRESH;
+        *fresh = 1;
+    }
+
+    return tb->slots + tb->front * tb->size;
+}
@@ -0,0 +1,33 @@
+#ifndef ORBITAL_TRIPLE_BUFFER_H
+#define ORBITAL_TRIPLE_BUFFER_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Lock-free handoff of the latest value from one writer to one
+ * reader. The writer fills its back slot and publishes it; the
+ * reader picks up the most recently published slot and never
+ * waits, skipping any that were superseded in between.
+ */
+struct triple_buffer {
+    size_t size;
+    unsigned char *slots;
+
+    int back;
+    int front;
+    // Index of the middle slot, with TB_FRESH set when it is unread
+    atomic_int middle;
+};
+
+int init_triple_buffer(size_t size, struct triple_buffer *out);
+
+void destroy_triple_buffer(struct triple_buffer *tb);
+
+void *tb_write_slot(struct triple_buffer *tb);
+
+void tb_publish(struct triple_buffer *tb);
+
+const void *tb_read(struct triple_buffer *tb, int *fresh);
+
+#endif // ORBITAL_TRIPLE_BUFFER_H